@@ -0,0 +1,1531 @@
+/**
+ * @file GnomonicProjection.c
+ * Native equirectangular -> gnomonic (rectilinear) projection
+ *
+ * NFOV computes the inverse gnomonic projection with arctan, arcsin and
+ * arctan2 per pixel. Here a screen point (x, y) on the tangent plane is the
+ * direction forward + x * east + y * north of the view center, which gives
+ * the same longitude and latitude with two atan2 and no other trigonometry.
+ * Roll turns east and north around forward.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "GnomonicProjection.h"
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GNOMONIC_AVX2 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define GNOMONIC_AVX2 0
+#endif
+
+#define PI_D 3.14159265358979323846
+
+/** Scaled by the field of view and the center point, NFOV.PI: the source covers +-90 degrees */
+#define HALF_PI_D (PI_D * 0.5)
+
+/** Bilinear weights of remap tables are in 1/256 pixel */
+#define WEIGHT_BITS 8
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+#define REMAP_TABLE_MAGIC "VZMAP1"
+
+/** Source pixel coordinates of the output pixels of one view */
+typedef struct
+{
+    /** Orthonormal view basis, x right, y up, z forward */
+    float forward[3];
+    float east[3];
+    float north[3];
+
+    /** Tangent plane coordinates of screen column i / row j: offset + i * scale */
+    float xOffset;
+    float xScale;
+    float yOffset;
+    float yScale;
+
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    int32_t targetWidth;
+    int32_t targetHeight;
+} SViewMapping;
+
+static bool IsValidLayout(int32_t width, int32_t height, int32_t channels, int64_t stride)
+{
+    return width >= 1 && height >= 1 && channels >= 1 && channels <= 4 && stride >= (int64_t)width * channels;
+}
+
+static bool IsValidImage(const SImage* image)
+{
+    return image != NULL && image->data != NULL &&
+        IsValidLayout(image->width, image->height, image->channels, image->stride);
+}
+
+/* Unrolled basis of the view direction (lon, lat): east is horizontal */
+static void GetCenterBasis(double lon, double lat, double forward[3], double east[3], double north[3])
+{
+    forward[0] = cos(lat) * sin(lon);
+    forward[1] = sin(lat);
+    forward[2] = cos(lat) * cos(lon);
+    east[0] = cos(lon);
+    east[1] = 0.0;
+    east[2] = -sin(lon);
+    north[0] = -sin(lat) * sin(lon);
+    north[1] = cos(lat);
+    north[2] = -sin(lat) * cos(lon);
+}
+
+static void GetViewBasis(const SGnomonicView* view, double forward[3], double east[3], double north[3])
+{
+    // NFOV._get_coord_rad(): (point * 2 - 1) * PI, screen points additionally scaled by FOV
+    double lon = (view->center[0] * 2.0 - 1.0) * HALF_PI_D;
+    double lat = (view->center[1] * 2.0 - 1.0) * HALF_PI_D;
+    double levelEast[3], levelNorth[3];
+    GetCenterBasis(lon, lat, forward, levelEast, levelNorth);
+
+    double c = cos(view->roll);
+    double s = sin(view->roll);
+    for (int i = 0; i < 3; i++)
+    {
+        east[i] = c * levelEast[i] + s * levelNorth[i];
+        north[i] = c * levelNorth[i] - s * levelEast[i];
+    }
+}
+
+static int InitMapping(SViewMapping* m, const SGnomonicView* view, int32_t sourceWidth, int32_t sourceHeight)
+{
+    if (view == NULL || view->width < 1 || view->height < 1)
+    {
+        return -1;
+    }
+
+    memset(m, 0, sizeof(*m));
+
+    double forward[3], east[3], north[3];
+    GetViewBasis(view, forward, east, north);
+    for (int i = 0; i < 3; i++)
+    {
+        m->forward[i] = (float)forward[i];
+        m->east[i] = (float)east[i];
+        m->north[i] = (float)north[i];
+    }
+
+    // np.linspace(0, 1, n) is [0] for n == 1
+    double xRange = HALF_PI_D * view->fov[0];
+    double yRange = HALF_PI_D * view->fov[1];
+    m->xOffset = (float)-xRange;
+    m->xScale = view->width > 1 ? (float)(2.0 * xRange / (view->width - 1)) : 0.0f;
+    m->yOffset = (float)-yRange;
+    m->yScale = view->height > 1 ? (float)(2.0 * yRange / (view->height - 1)) : 0.0f;
+
+    m->sourceWidth = sourceWidth;
+    m->sourceHeight = sourceHeight;
+    m->targetWidth = view->width;
+    m->targetHeight = view->height;
+    return 0;
+}
+
+/* Tangent plane y of output row 'row': NFOV flips its output vertically */
+static float GetRowY(const SViewMapping* m, int32_t row)
+{
+    return m->yOffset + (float)(m->targetHeight - 1 - row) * m->yScale;
+}
+
+/* Unwrapped source coordinates of the direction (dx, dy, dz) */
+static void UnwrapDirection(float dx, float dy, float dz, float* s, float* t)
+{
+    float lon = atan2f(dx, dz);
+    float lat = atan2f(dy, sqrtf(dx * dx + dz * dz));
+    *s = lon * (float)(1.0 / PI_D) + 0.5f;
+    *t = lat * (float)(1.0 / PI_D) + 0.5f;
+}
+
+static void MapPointUnwrapped(const SViewMapping* m, float x, float y, float* s, float* t)
+{
+    UnwrapDirection(m->forward[0] + x * m->east[0] + y * m->north[0],
+        m->forward[1] + x * m->east[1] + y * m->north[1],
+        m->forward[2] + x * m->east[2] + y * m->north[2], s, t);
+}
+
+/* Source pixel coordinates of the tangent plane point (x, y) */
+static void MapPoint(const SViewMapping* m, float x, float y, float* u, float* v)
+{
+    float s, t;
+    MapPointUnwrapped(m, x, y, &s, &t);
+
+    // wrapped like np.mod(..., 1)
+    *u = (s - floorf(s)) * m->sourceWidth;
+    *v = (t - floorf(t)) * m->sourceHeight;
+}
+
+static void SamplePixel(const SImage* source, float u, float v, uint8_t* out)
+{
+    float x0f = floorf(u);
+    float y0f = floorf(v);
+    float fx = u - x0f;
+    float fy = v - y0f;
+
+    int32_t x0 = (int32_t)x0f;
+    int32_t y0 = (int32_t)y0f;
+    x0 = x0 < 0 ? 0 : x0 > source->width - 1 ? source->width - 1 : x0;
+    y0 = y0 < 0 ? 0 : y0 > source->height - 1 ? source->height - 1 : y0;
+    int32_t x1 = x0 + 1 < source->width ? x0 + 1 : x0;
+    int32_t y1 = y0 + 1 < source->height ? y0 + 1 : y0;
+
+    // source rows are addressed bottom up, NFOV samples frame[::-1]
+    const uint8_t* row0 = source->data + (int64_t)(source->height - 1 - y0) * source->stride;
+    const uint8_t* row1 = source->data + (int64_t)(source->height - 1 - y1) * source->stride;
+    const uint8_t* a = row0 + x0 * source->channels;
+    const uint8_t* b = row1 + x0 * source->channels;
+    const uint8_t* c = row0 + x1 * source->channels;
+    const uint8_t* d = row1 + x1 * source->channels;
+
+    float wa = (1.0f - fx) * (1.0f - fy);
+    float wb = (1.0f - fx) * fy;
+    float wc = fx * (1.0f - fy);
+    float wd = fx * fy;
+
+    for (int32_t i = 0; i < source->channels; i++)
+    {
+        out[i] = (uint8_t)lrintf(wa * a[i] + wb * b[i] + wc * c[i] + wd * d[i]);
+    }
+}
+
+static void ProjectPixels(const SViewMapping* m, const SImage* source, SImage* target, int32_t row,
+    int32_t from, int32_t to)
+{
+    float y = GetRowY(m, row);
+    uint8_t* out = target->data + row * target->stride;
+
+    for (int32_t i = from; i < to; i++)
+    {
+        float u, v;
+        MapPoint(m, m->xOffset + i * m->xScale, y, &u, &v);
+        SamplePixel(source, u, v, out + i * source->channels);
+    }
+}
+
+/*
+ * Fixed-point form of a source position: offset of the top-left tap and
+ * the weights of the right and lower taps. At the right and bottom border
+ * the taps move one pixel inwards with full weight on the border pixel,
+ * which is the clamped sampling of SamplePixel() without out of range taps.
+ */
+static void MakeRemapEntry(const SRemapKey* key, float u, float v, uint32_t* offset, uint32_t* weight)
+{
+    float x0f = floorf(u);
+    float y0f = floorf(v);
+    int32_t x0 = (int32_t)x0f;
+    int32_t y0 = (int32_t)y0f;
+    int32_t fx = (int32_t)lrintf((u - x0f) * WEIGHT_ONE);
+    int32_t fy = (int32_t)lrintf((v - y0f) * WEIGHT_ONE);
+
+    if (x0 < 0)
+    {
+        x0 = 0;
+        fx = 0;
+    }
+    else if (x0 >= key->sourceWidth - 1)
+    {
+        x0 = key->sourceWidth > 1 ? key->sourceWidth - 2 : 0;
+        fx = key->sourceWidth > 1 ? WEIGHT_ONE : 0;
+    }
+
+    if (y0 < 0)
+    {
+        y0 = 0;
+        fy = 0;
+    }
+    else if (y0 >= key->sourceHeight - 1)
+    {
+        y0 = key->sourceHeight > 1 ? key->sourceHeight - 2 : 0;
+        fy = key->sourceHeight > 1 ? WEIGHT_ONE : 0;
+    }
+
+    *offset = (uint32_t)((key->sourceHeight - 1 - y0) * key->sourceStride + (int64_t)x0 * key->channels);
+    *weight = (uint32_t)fx | (uint32_t)fy << 16;
+}
+
+static void RemapPixels(const SRemapTable* table, const SImage* source, SImage* target, int32_t row,
+    int32_t from, int32_t to)
+{
+    const int32_t channels = source->channels;
+    const uint32_t* offsets = table->offsets + (int64_t)row * target->width;
+    const uint32_t* weights = table->weights + (int64_t)row * target->width;
+    uint8_t* out = target->data + row * target->stride;
+
+    for (int32_t i = from; i < to; i++)
+    {
+        const uint8_t* a = source->data + offsets[i];
+        const uint8_t* b = a + table->lowerTap;
+        const uint8_t* c = a + table->rightTap;
+        const uint8_t* d = b + table->rightTap;
+        uint32_t fx = weights[i] & 0xffff;
+        uint32_t fy = weights[i] >> 16;
+
+        for (int32_t k = 0; k < channels; k++)
+        {
+            uint32_t top = a[k] * (WEIGHT_ONE - fx) + c[k] * fx;
+            uint32_t bottom = b[k] * (WEIGHT_ONE - fx) + d[k] * fx;
+            out[i * channels + k] = (uint8_t)((top * (WEIGHT_ONE - fy) + bottom * fy +
+                (1 << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS));
+        }
+    }
+}
+
+/* Node k of a grid over n pixels sits at pixel min(k * GNOMONIC_GRID_STEP, n - 1) */
+static int32_t GetGridNode(int32_t k, int32_t n)
+{
+    int32_t pixel = k * GNOMONIC_GRID_STEP;
+    return pixel < n - 1 ? pixel : n - 1;
+}
+
+/* Grid cell of 'pixel' and its weight towards the next node */
+static int32_t GetGridCell(int32_t pixel, int32_t n, int32_t nodes, float* weight)
+{
+    int32_t k = pixel / GNOMONIC_GRID_STEP;
+    int32_t from = GetGridNode(k, n);
+    int32_t to = GetGridNode(k + 1 < nodes ? k + 1 : k, n);
+    *weight = to > from ? (float)(pixel - from) / (float)(to - from) : 0.0f;
+    return k;
+}
+
+/*
+ * Cells whose corners lie on both sides of the longitude wrap at +-180
+ * degrees can not be interpolated, their pixels are mapped exactly.
+ */
+static bool IsSeamCell(const float* grid, int32_t columns, int32_t rows, int32_t row, int32_t column)
+{
+    int32_t nextRow = row + 1 < rows ? row + 1 : row;
+    int32_t nextColumn = column + 1 < columns ? column + 1 : column;
+    float s[4] = {
+        grid[2 * (row * columns + column)], grid[2 * (row * columns + nextColumn)],
+        grid[2 * (nextRow * columns + column)], grid[2 * (nextRow * columns + nextColumn)],
+    };
+
+    float low = s[0], high = s[0];
+    for (int i = 1; i < 4; i++)
+    {
+        low = s[i] < low ? s[i] : low;
+        high = s[i] > high ? s[i] : high;
+    }
+    return high - low > 0.25f;
+}
+
+/* One output row of UpdateRemapTable(): its grid line and the seam flags of its cells */
+typedef struct
+{
+    const SViewMapping* m;
+    const SRemapKey* key;
+    int32_t row;
+    const float* line;
+    const bool* seams;
+    int32_t columns;
+} SGridRow;
+
+static void UpdatePixels(const SGridRow* g, int32_t from, int32_t to, uint32_t* offsets, uint32_t* weights)
+{
+    const SViewMapping* m = g->m;
+    float y = GetRowY(m, g->row);
+
+    for (int32_t i = from; i < to; i++)
+    {
+        float wx, u, v;
+        int32_t c = GetGridCell(i, m->targetWidth, g->columns, &wx);
+
+        if (g->seams[c])
+        {
+            MapPoint(m, m->xOffset + i * m->xScale, y, &u, &v);
+        }
+        else
+        {
+            const float* left = &g->line[2 * c];
+            const float* right = &g->line[2 * (c + 1 < g->columns ? c + 1 : c)];
+            float s = left[0] + (right[0] - left[0]) * wx;
+            float t = left[1] + (right[1] - left[1]) * wx;
+            u = (s - floorf(s)) * m->sourceWidth;
+            v = (t - floorf(t)) * m->sourceHeight;
+        }
+        MakeRemapEntry(g->key, u, v, &offsets[i], &weights[i]);
+    }
+}
+
+/* Largest offset a 4 byte gather may start at without reading past the image */
+static int64_t GetMaxGatherOffset(int32_t width, int32_t height, int32_t channels, int64_t stride)
+{
+    return (int64_t)(height - 1) * stride + (int64_t)width * channels - 4;
+}
+
+#if GNOMONIC_AVX2
+
+/* atan2 with a minimax polynomial for atan on [0, 1], error below 1e-5 rad */
+AVX2_TARGET static __m256 Atan2Avx2(__m256 y, __m256 x)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_andnot_ps(signMask, x);
+    __m256 ay = _mm256_andnot_ps(signMask, y);
+
+    __m256 swap = _mm256_cmp_ps(ay, ax, _CMP_GT_OQ);
+    __m256 num = _mm256_min_ps(ax, ay);
+    __m256 den = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+    __m256 a = _mm256_div_ps(num, den);
+    __m256 s = _mm256_mul_ps(a, a);
+
+    __m256 r = _mm256_set1_ps(-0.01172120f);
+    r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(0.05265332f));
+    r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(-0.11643287f));
+    r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(0.19354346f));
+    r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(-0.33262347f));
+    r = _mm256_fmadd_ps(r, s, _mm256_set1_ps(0.99997726f));
+    r = _mm256_mul_ps(r, a);
+
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)HALF_PI_D), r), swap);
+    // blendv selects on the sign bit, so x = -0 counts as negative like in atan2
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps((float)PI_D), r), x);
+    return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+}
+
+/* Wrapped source coordinate of an angle: ((angle / PI + 1) * 0.5 mod 1) * size */
+AVX2_TARGET static __m256 AngleToPixel(__m256 angle, float size)
+{
+    __m256 s = _mm256_fmadd_ps(angle, _mm256_set1_ps((float)(1.0 / PI_D)), _mm256_set1_ps(0.5f));
+    s = _mm256_sub_ps(s, _mm256_floor_ps(s));
+    return _mm256_mul_ps(s, _mm256_set1_ps(size));
+}
+
+/* MapPoint() for output columns i .. i + 7 of the row at tangent plane 'y' */
+AVX2_TARGET static void MapPointsAvx2(const SViewMapping* m, int32_t i, float y, __m256* u, __m256* v)
+{
+    // y is constant along the row
+    __m256 column = _mm256_add_ps(_mm256_set1_ps((float)i), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 x = _mm256_fmadd_ps(column, _mm256_set1_ps(m->xScale), _mm256_set1_ps(m->xOffset));
+    __m256 dx = _mm256_fmadd_ps(x, _mm256_set1_ps(m->east[0]), _mm256_set1_ps(m->forward[0] + y * m->north[0]));
+    __m256 dy = _mm256_fmadd_ps(x, _mm256_set1_ps(m->east[1]), _mm256_set1_ps(m->forward[1] + y * m->north[1]));
+    __m256 dz = _mm256_fmadd_ps(x, _mm256_set1_ps(m->east[2]), _mm256_set1_ps(m->forward[2] + y * m->north[2]));
+
+    __m256 lon = Atan2Avx2(dx, dz);
+    __m256 lat = Atan2Avx2(dy, _mm256_sqrt_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dz, dz))));
+    *u = AngleToPixel(lon, (float)m->sourceWidth);
+    *v = AngleToPixel(lat, (float)m->sourceHeight);
+}
+
+/*
+ * Gather one 4 byte word per lane at byte offset 'offsets'. Lanes that would
+ * read past the end of the source start earlier and are shifted back down.
+ */
+AVX2_TARGET static __m256i GatherPixels(const uint8_t* data, __m256i offsets, __m256i maxOffset)
+{
+    __m256i clamped = _mm256_min_epi32(offsets, maxOffset);
+    __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(offsets, clamped), 3);
+    __m256i words = _mm256_i32gather_epi32((const int*)data, clamped, 1);
+    return _mm256_srlv_epi32(words, shift);
+}
+
+/* Write 8 packed pixels of 'channels' bytes */
+AVX2_TARGET static void StorePixels(uint8_t* out, __m256i pixels, int32_t channels)
+{
+    if (channels == 4)
+    {
+        _mm256_storeu_si256((__m256i*)out, pixels);
+        return;
+    }
+
+    uint32_t words[8];
+    _mm256_storeu_si256((__m256i*)words, pixels);
+    for (int32_t k = 0; k < 8; k++)
+    {
+        memcpy(out + k * channels, &words[k], channels);
+    }
+}
+
+AVX2_TARGET static void ProjectRowAvx2(const SViewMapping* m, const SImage* source, SImage* target, int32_t row)
+{
+    const int32_t channels = source->channels;
+    const float y = GetRowY(m, row);
+    uint8_t* out = target->data + row * target->stride;
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i maxX = _mm256_set1_epi32(source->width - 1);
+    const __m256i maxY = _mm256_set1_epi32(source->height - 1);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m256i pixelSize = _mm256_set1_epi32(channels);
+    const __m256i stride = _mm256_set1_epi32((int32_t)source->stride);
+    const __m256i maxOffset = _mm256_set1_epi32((int32_t)GetMaxGatherOffset(source->width, source->height,
+        channels, source->stride));
+
+    int32_t i = 0;
+    for (; i + 8 <= target->width; i += 8)
+    {
+        __m256 u, v;
+        MapPointsAvx2(m, i, y, &u, &v);
+
+        __m256 x0f = _mm256_floor_ps(u);
+        __m256 y0f = _mm256_floor_ps(v);
+        __m256 fx = _mm256_sub_ps(u, x0f);
+        __m256 fy = _mm256_sub_ps(v, y0f);
+
+        __m256i x0 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(x0f), zero), maxX);
+        __m256i y0 = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(y0f), zero), maxY);
+        __m256i x1 = _mm256_min_epi32(_mm256_add_epi32(x0, one), maxX);
+        __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, one), maxY);
+
+        // bottom up source rows, see SamplePixel()
+        __m256i row0 = _mm256_mullo_epi32(_mm256_sub_epi32(maxY, y0), stride);
+        __m256i row1 = _mm256_mullo_epi32(_mm256_sub_epi32(maxY, y1), stride);
+        __m256i col0 = _mm256_mullo_epi32(x0, pixelSize);
+        __m256i col1 = _mm256_mullo_epi32(x1, pixelSize);
+
+        __m256i a = GatherPixels(source->data, _mm256_add_epi32(row0, col0), maxOffset);
+        __m256i b = GatherPixels(source->data, _mm256_add_epi32(row1, col0), maxOffset);
+        __m256i c = GatherPixels(source->data, _mm256_add_epi32(row0, col1), maxOffset);
+        __m256i d = GatherPixels(source->data, _mm256_add_epi32(row1, col1), maxOffset);
+
+        __m256 gx = _mm256_sub_ps(_mm256_set1_ps(1.0f), fx);
+        __m256 gy = _mm256_sub_ps(_mm256_set1_ps(1.0f), fy);
+        __m256 wa = _mm256_mul_ps(gx, gy);
+        __m256 wb = _mm256_mul_ps(gx, fy);
+        __m256 wc = _mm256_mul_ps(fx, gy);
+        __m256 wd = _mm256_mul_ps(fx, fy);
+
+        __m256i pixels = zero;
+        for (int32_t channel = 0; channel < channels; channel++)
+        {
+            __m256 va = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(a, 8 * channel), byteMask));
+            __m256 vb = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(b, 8 * channel), byteMask));
+            __m256 vc = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(c, 8 * channel), byteMask));
+            __m256 vd = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(d, 8 * channel), byteMask));
+
+            __m256 value = _mm256_mul_ps(wd, vd);
+            value = _mm256_fmadd_ps(wc, vc, value);
+            value = _mm256_fmadd_ps(wb, vb, value);
+            value = _mm256_fmadd_ps(wa, va, value);
+
+            // round half to even like np.round
+            __m256i rounded = _mm256_min_epi32(_mm256_cvtps_epi32(value), byteMask);
+            pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(rounded, 8 * channel));
+        }
+
+        StorePixels(out + i * channels, pixels, channels);
+    }
+
+    ProjectPixels(m, source, target, row, i, target->width);
+}
+
+/* Clamp one axis like MakeRemapEntry(): below 0 onto the first tap, from size - 1 on onto the last */
+AVX2_TARGET static void ClampTapsAvx2(__m256i* first, __m256i* weight, int32_t size)
+{
+    __m256i below = _mm256_cmpgt_epi32(_mm256_setzero_si256(), *first);
+    *first = _mm256_andnot_si256(below, *first);
+    *weight = _mm256_andnot_si256(below, *weight);
+
+    __m256i beyond = _mm256_cmpgt_epi32(*first, _mm256_set1_epi32(size - 2));
+    *first = _mm256_blendv_epi8(*first, _mm256_set1_epi32(size > 1 ? size - 2 : 0), beyond);
+    *weight = _mm256_blendv_epi8(*weight, _mm256_set1_epi32(size > 1 ? WEIGHT_ONE : 0), beyond);
+}
+
+/* MakeRemapEntry() for 8 positions */
+AVX2_TARGET static void MakeRemapEntriesAvx2(const SRemapKey* key, __m256 u, __m256 v, uint32_t* offsets,
+    uint32_t* weights)
+{
+    const __m256 one = _mm256_set1_ps((float)WEIGHT_ONE);
+    __m256 x0f = _mm256_floor_ps(u);
+    __m256 y0f = _mm256_floor_ps(v);
+
+    // cvtps rounds to nearest even like lrintf
+    __m256i fx = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(u, x0f), one));
+    __m256i fy = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(v, y0f), one));
+    __m256i x0 = _mm256_cvttps_epi32(x0f);
+    __m256i y0 = _mm256_cvttps_epi32(y0f);
+    ClampTapsAvx2(&x0, &fx, key->sourceWidth);
+    ClampTapsAvx2(&y0, &fy, key->sourceHeight);
+
+    // the low 32 bits of the products are the offset, BuildRemapTable() checked that it fits
+    __m256i row = _mm256_sub_epi32(_mm256_set1_epi32(key->sourceHeight - 1), y0);
+    __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(row, _mm256_set1_epi32((int32_t)(uint32_t)key->sourceStride)),
+        _mm256_mullo_epi32(x0, _mm256_set1_epi32(key->channels)));
+
+    _mm256_storeu_si256((__m256i*)offsets, offset);
+    _mm256_storeu_si256((__m256i*)weights, _mm256_or_si256(fx, _mm256_slli_epi32(fy, 16)));
+}
+
+AVX2_TARGET static void BuildRowAvx2(const SViewMapping* m, const SRemapKey* key, int32_t row,
+    uint32_t* offsets, uint32_t* weights)
+{
+    const float y = GetRowY(m, row);
+
+    int32_t i = 0;
+    for (; i + 8 <= m->targetWidth; i += 8)
+    {
+        __m256 u, v;
+        MapPointsAvx2(m, i, y, &u, &v);
+        MakeRemapEntriesAvx2(key, u, v, offsets + i, weights + i);
+    }
+
+    for (; i < m->targetWidth; i++)
+    {
+        float u, v;
+        MapPoint(m, m->xOffset + i * m->xScale, y, &u, &v);
+        MakeRemapEntry(key, u, v, &offsets[i], &weights[i]);
+    }
+}
+
+AVX2_TARGET static void UpdateRowAvx2(const SGridRow* g, uint32_t* offsets, uint32_t* weights)
+{
+    const SViewMapping* m = g->m;
+    const float y = GetRowY(m, g->row);
+    const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+    // 8 pixels starting at a multiple of 8 lie in one cell
+#if GNOMONIC_GRID_STEP % 8 != 0
+#error GNOMONIC_GRID_STEP must be a multiple of 8
+#endif
+    int32_t i = 0;
+    for (; i + 8 <= m->targetWidth; i += 8)
+    {
+        int32_t c = i / GNOMONIC_GRID_STEP;
+        __m256 u, v;
+
+        if (g->seams[c])
+        {
+            MapPointsAvx2(m, i, y, &u, &v);
+        }
+        else
+        {
+            int32_t next = c + 1 < g->columns ? c + 1 : c;
+            int32_t from = GetGridNode(c, m->targetWidth);
+            int32_t to = GetGridNode(next, m->targetWidth);
+            __m256 wx = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)(i - from)), lanes),
+                _mm256_set1_ps(to > from ? 1.0f / (float)(to - from) : 0.0f));
+
+            const float* left = &g->line[2 * c];
+            const float* right = &g->line[2 * next];
+            __m256 s = _mm256_fmadd_ps(wx, _mm256_set1_ps(right[0] - left[0]), _mm256_set1_ps(left[0]));
+            __m256 t = _mm256_fmadd_ps(wx, _mm256_set1_ps(right[1] - left[1]), _mm256_set1_ps(left[1]));
+            u = _mm256_mul_ps(_mm256_sub_ps(s, _mm256_floor_ps(s)), _mm256_set1_ps((float)m->sourceWidth));
+            v = _mm256_mul_ps(_mm256_sub_ps(t, _mm256_floor_ps(t)), _mm256_set1_ps((float)m->sourceHeight));
+        }
+        MakeRemapEntriesAvx2(g->key, u, v, offsets + i, weights + i);
+    }
+
+    UpdatePixels(g, i, m->targetWidth, offsets, weights);
+}
+
+AVX2_TARGET static void RemapRowAvx2(const SRemapTable* table, const SImage* source, SImage* target, int32_t row)
+{
+    const int32_t channels = source->channels;
+    const uint32_t* offsets = table->offsets + (int64_t)row * target->width;
+    const uint32_t* weights = table->weights + (int64_t)row * target->width;
+    uint8_t* out = target->data + row * target->stride;
+
+    const __m256i byteMask = _mm256_set1_epi32(0xff);
+    const __m256i weightMask = _mm256_set1_epi32(0xffff);
+    const __m256i weightOne = _mm256_set1_epi32(WEIGHT_ONE);
+    const __m256i rounding = _mm256_set1_epi32(1 << (2 * WEIGHT_BITS - 1));
+    const __m256i rightTap = _mm256_set1_epi32(table->rightTap);
+    const __m256i lowerTap = _mm256_set1_epi32(table->lowerTap);
+    const __m256i maxOffset = _mm256_set1_epi32((int32_t)GetMaxGatherOffset(source->width, source->height,
+        channels, source->stride));
+
+    int32_t i = 0;
+    for (; i + 8 <= target->width; i += 8)
+    {
+        __m256i offsetA = _mm256_loadu_si256((const __m256i*)(offsets + i));
+        __m256i weight = _mm256_loadu_si256((const __m256i*)(weights + i));
+        __m256i fx = _mm256_and_si256(weight, weightMask);
+        __m256i fy = _mm256_srli_epi32(weight, 16);
+        __m256i gx = _mm256_sub_epi32(weightOne, fx);
+        __m256i gy = _mm256_sub_epi32(weightOne, fy);
+
+        __m256i offsetB = _mm256_add_epi32(offsetA, lowerTap);
+        __m256i a = GatherPixels(source->data, offsetA, maxOffset);
+        __m256i b = GatherPixels(source->data, offsetB, maxOffset);
+        __m256i c = GatherPixels(source->data, _mm256_add_epi32(offsetA, rightTap), maxOffset);
+        __m256i d = GatherPixels(source->data, _mm256_add_epi32(offsetB, rightTap), maxOffset);
+
+        __m256i pixels = _mm256_setzero_si256();
+        for (int32_t channel = 0; channel < channels; channel++)
+        {
+            __m256i va = _mm256_and_si256(_mm256_srli_epi32(a, 8 * channel), byteMask);
+            __m256i vb = _mm256_and_si256(_mm256_srli_epi32(b, 8 * channel), byteMask);
+            __m256i vc = _mm256_and_si256(_mm256_srli_epi32(c, 8 * channel), byteMask);
+            __m256i vd = _mm256_and_si256(_mm256_srli_epi32(d, 8 * channel), byteMask);
+
+            __m256i top = _mm256_add_epi32(_mm256_mullo_epi32(va, gx), _mm256_mullo_epi32(vc, fx));
+            __m256i bottom = _mm256_add_epi32(_mm256_mullo_epi32(vb, gx), _mm256_mullo_epi32(vd, fx));
+            __m256i value = _mm256_add_epi32(_mm256_mullo_epi32(top, gy), _mm256_mullo_epi32(bottom, fy));
+            value = _mm256_srli_epi32(_mm256_add_epi32(value, rounding), 2 * WEIGHT_BITS);
+
+            pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(value, 8 * channel));
+        }
+
+        StorePixels(out + i * channels, pixels, channels);
+    }
+
+    RemapPixels(table, source, target, row, i, target->width);
+}
+
+static bool HasAvx2(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    return supported != 0;
+}
+
+/* 32-bit gather offsets must reach the whole source, which needs 4 bytes to gather from */
+static bool CanGatherAvx2(const SImage* source)
+{
+    int64_t maxOffset = GetMaxGatherOffset(source->width, source->height, source->channels, source->stride);
+    return HasAvx2() && maxOffset >= 0 && maxOffset < INT32_MAX;
+}
+
+#endif
+
+int GnomonicUsesAvx2(void)
+{
+#if GNOMONIC_AVX2
+    return HasAvx2();
+#else
+    return 0;
+#endif
+}
+
+int ProjectGnomonic(const SImage* source, const SGnomonicView* view, SImage* target)
+{
+    SViewMapping m;
+    if (!IsValidImage(source) || !IsValidImage(target) || target->channels != source->channels ||
+        InitMapping(&m, view, source->width, source->height) != 0 ||
+        target->width != view->width || target->height != view->height)
+    {
+        return -1;
+    }
+
+#if GNOMONIC_AVX2
+    if (CanGatherAvx2(source))
+    {
+        for (int32_t row = 0; row < target->height; row++)
+        {
+            ProjectRowAvx2(&m, source, target, row);
+        }
+        return 0;
+    }
+#endif
+
+    for (int32_t row = 0; row < target->height; row++)
+    {
+        ProjectPixels(&m, source, target, row, 0, target->width);
+    }
+    return 0;
+}
+
+void GetRemapKey(const SImage* source, const SGnomonicView* view, SRemapKey* key)
+{
+    memset(key, 0, sizeof(*key));
+    key->view = *view;
+    key->sourceWidth = source->width;
+    key->sourceHeight = source->height;
+    key->channels = source->channels;
+    key->sourceStride = source->stride;
+}
+
+int BuildRemapTable(const SRemapKey* key, SRemapTable* table)
+{
+    SViewMapping m;
+    memset(table, 0, sizeof(*table));
+
+    // table offsets are 32 bits
+    if (!IsValidLayout(key->sourceWidth, key->sourceHeight, key->channels, key->sourceStride) ||
+        key->sourceHeight * key->sourceStride > UINT32_MAX ||
+        InitMapping(&m, &key->view, key->sourceWidth, key->sourceHeight) != 0)
+    {
+        return -1;
+    }
+
+    size_t count = (size_t)key->view.width * key->view.height;
+    table->key = *key;
+    table->offsets = malloc(count * sizeof(uint32_t));
+    table->weights = malloc(count * sizeof(uint32_t));
+    if (table->offsets == NULL || table->weights == NULL)
+    {
+        FreeRemapTable(table);
+        return -1;
+    }
+
+    table->rightTap = key->sourceWidth > 1 ? key->channels : 0;
+    table->lowerTap = key->sourceHeight > 1 ? (int32_t)-key->sourceStride : 0;
+
+    for (int32_t row = 0; row < m.targetHeight; row++)
+    {
+        uint32_t* offsets = table->offsets + (size_t)row * m.targetWidth;
+        uint32_t* weights = table->weights + (size_t)row * m.targetWidth;
+
+#if GNOMONIC_AVX2
+        if (HasAvx2())
+        {
+            BuildRowAvx2(&m, key, row, offsets, weights);
+            continue;
+        }
+#endif
+        float y = GetRowY(&m, row);
+        for (int32_t i = 0; i < m.targetWidth; i++)
+        {
+            float u, v;
+            MapPoint(&m, m.xOffset + i * m.xScale, y, &u, &v);
+            MakeRemapEntry(key, u, v, &offsets[i], &weights[i]);
+        }
+    }
+
+    return 0;
+}
+
+void FreeRemapTable(SRemapTable* table)
+{
+    free(table->offsets);
+    free(table->weights);
+    table->offsets = NULL;
+    table->weights = NULL;
+}
+
+/* Unwrapped source coordinates of the grid nodes and the cells that have to be mapped exactly */
+typedef struct
+{
+    int32_t columns;
+    int32_t rows;
+    float* nodes;
+    bool* seams;
+} SRemapGrid;
+
+static void FreeRemapGrid(SRemapGrid* grid)
+{
+    free(grid->nodes);
+    free(grid->seams);
+}
+
+static int InitRemapGrid(SRemapGrid* grid, const SGnomonicView* view)
+{
+    grid->columns = (view->width - 1 + GNOMONIC_GRID_STEP - 1) / GNOMONIC_GRID_STEP + 1;
+    grid->rows = (view->height - 1 + GNOMONIC_GRID_STEP - 1) / GNOMONIC_GRID_STEP + 1;
+    grid->nodes = malloc((size_t)grid->columns * grid->rows * 2 * sizeof(float));
+    grid->seams = malloc((size_t)grid->columns * grid->rows * sizeof(bool));
+    if (grid->nodes == NULL || grid->seams == NULL)
+    {
+        FreeRemapGrid(grid);
+        return -1;
+    }
+    return 0;
+}
+
+/* (s, t) at the grid nodes, the only points with trigonometry */
+static void MapGrid(const SViewMapping* m, SRemapGrid* grid, float* nodes)
+{
+    for (int32_t r = 0; r < grid->rows; r++)
+    {
+        float y = GetRowY(m, GetGridNode(r, m->targetHeight));
+        for (int32_t c = 0; c < grid->columns; c++)
+        {
+            float* node = &nodes[2 * (r * grid->columns + c)];
+            MapPointUnwrapped(m, m->xOffset + GetGridNode(c, m->targetWidth) * m->xScale, y, &node[0], &node[1]);
+        }
+    }
+}
+
+/*
+ * Fill 'table' from the grid. Seam cells of grid row r are mapped exactly
+ * with mappings[rowMapping[r]], or mappings[0] without 'rowMapping'.
+ */
+static int FillRemapTable(SRemapTable* table, const SViewMapping* mappings, const uint8_t* rowMapping,
+    SRemapGrid* grid)
+{
+    int32_t columns = grid->columns;
+    int32_t rows = grid->rows;
+    float* line = malloc((size_t)columns * 2 * sizeof(float));
+    if (line == NULL)
+    {
+        return -1;
+    }
+
+    for (int32_t r = 0; r < rows; r++)
+    {
+        for (int32_t c = 0; c < columns; c++)
+        {
+            grid->seams[r * columns + c] = IsSeamCell(grid->nodes, columns, rows, r, c);
+        }
+    }
+
+    int32_t width = table->key.view.width;
+    for (int32_t row = 0; row < table->key.view.height; row++)
+    {
+        float wy;
+        int32_t r = GetGridCell(row, table->key.view.height, rows, &wy);
+        const float* upper = &grid->nodes[2 * r * columns];
+        const float* lower = &grid->nodes[2 * (r + 1 < rows ? r + 1 : r) * columns];
+        for (int32_t k = 0; k < 2 * columns; k++)
+        {
+            line[k] = upper[k] + (lower[k] - upper[k]) * wy;
+        }
+
+        const SViewMapping* m = &mappings[rowMapping != NULL ? rowMapping[r] : 0];
+        SGridRow gridRow = { m, &table->key, row, line, &grid->seams[r * columns], columns };
+        uint32_t* offsets = table->offsets + (size_t)row * width;
+        uint32_t* weights = table->weights + (size_t)row * width;
+
+#if GNOMONIC_AVX2
+        if (HasAvx2())
+        {
+            UpdateRowAvx2(&gridRow, offsets, weights);
+            continue;
+        }
+#endif
+        UpdatePixels(&gridRow, 0, width, offsets, weights);
+    }
+
+    free(line);
+    return 0;
+}
+
+static bool IsUpdatable(const SRemapTable* table, const SGnomonicView* view)
+{
+    return table->offsets != NULL && view != NULL &&
+        view->width == table->key.view.width && view->height == table->key.view.height;
+}
+
+int UpdateRemapTable(SRemapTable* table, const SGnomonicView* view)
+{
+    SRemapKey* key = &table->key;
+    SViewMapping m;
+    SRemapGrid grid;
+    if (!IsUpdatable(table, view) || InitMapping(&m, view, key->sourceWidth, key->sourceHeight) != 0 ||
+        InitRemapGrid(&grid, view) != 0)
+    {
+        return -1;
+    }
+
+    MapGrid(&m, &grid, grid.nodes);
+    key->view = *view;
+    int ret = FillRemapTable(table, &m, NULL, &grid);
+
+    FreeRemapGrid(&grid);
+    return ret;
+}
+
+/* Key interval of the scanline fraction 'line' and the weight towards the later key */
+static int32_t GetShutterKey(float line, int32_t count, float* weight)
+{
+    float position = line * (float)(count - 1);
+    position = position < 0.0f ? 0.0f : position > (float)(count - 1) ? (float)(count - 1) : position;
+    int32_t k = (int32_t)position < count - 1 ? (int32_t)position : count - 2;
+    *weight = position - (float)k;
+    return k;
+}
+
+/* Camera directions of the grid nodes seen with 'm', 3 floats per node */
+static void GetGridDirections(const SViewMapping* m, const SRemapGrid* grid, float* directions)
+{
+    for (int32_t r = 0; r < grid->rows; r++)
+    {
+        float y = GetRowY(m, GetGridNode(r, m->targetHeight));
+        for (int32_t c = 0; c < grid->columns; c++)
+        {
+            float x = m->xOffset + GetGridNode(c, m->targetWidth) * m->xScale;
+            float* direction = &directions[3 * (r * grid->columns + c)];
+            for (int i = 0; i < 3; i++)
+            {
+                direction[i] = m->forward[i] + x * m->east[i] + y * m->north[i];
+            }
+        }
+    }
+}
+
+int UpdateRemapTableRollingShutter(SRemapTable* table, const SGnomonicView* view, const SRollingShutter* shutter)
+{
+    if (shutter == NULL || shutter->count < 1 || shutter->count > GNOMONIC_MAX_SHUTTER_KEYS)
+    {
+        return -1;
+    }
+    if (shutter->count == 1)
+    {
+        SGnomonicView stabilized;
+        StabilizeView(view, shutter->rotations[0], &stabilized);
+        return UpdateRemapTable(table, &stabilized);
+    }
+
+    SRemapKey* key = &table->key;
+    int32_t count = shutter->count;
+    SViewMapping mappings[GNOMONIC_MAX_SHUTTER_KEYS];
+    SGnomonicView views[GNOMONIC_MAX_SHUTTER_KEYS];
+    SRemapGrid grid;
+    if (!IsUpdatable(table, view) || InitRemapGrid(&grid, view) != 0)
+    {
+        return -1;
+    }
+
+    size_t nodeCount = (size_t)grid.columns * grid.rows;
+    float* keyNodes = malloc(nodeCount * 3 * count * sizeof(float));
+    uint8_t* rowMapping = malloc((size_t)grid.rows);
+    int ret = keyNodes != NULL && rowMapping != NULL ? 0 : -1;
+
+    for (int32_t k = 0; k < count && ret == 0; k++)
+    {
+        StabilizeView(view, shutter->rotations[k], &views[k]);
+        ret = InitMapping(&mappings[k], &views[k], key->sourceWidth, key->sourceHeight);
+        if (ret == 0)
+        {
+            GetGridDirections(&mappings[k], &grid, keyNodes + nodeCount * 3 * k);
+        }
+    }
+
+    for (size_t i = 0; i < nodeCount && ret == 0; i++)
+    {
+        // the scanline a node is read from decides its orientation, which moves the node: start at the
+        // line of the middle key and refine once, source rows are addressed bottom up. Directions are
+        // blended rather than (s, t), which stays valid near the poles
+        float* node = &grid.nodes[2 * i];
+        const float* middle = keyNodes + nodeCount * 3 * (count / 2) + 3 * i;
+        UnwrapDirection(middle[0], middle[1], middle[2], &node[0], &node[1]);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            float weight;
+            int32_t k = GetShutterKey(1.0f - (node[1] - floorf(node[1])), count, &weight);
+            const float* a = keyNodes + nodeCount * 3 * k + 3 * i;
+            const float* b = keyNodes + nodeCount * 3 * (k + 1) + 3 * i;
+            UnwrapDirection(a[0] + (b[0] - a[0]) * weight, a[1] + (b[1] - a[1]) * weight,
+                a[2] + (b[2] - a[2]) * weight, &node[0], &node[1]);
+        }
+    }
+
+    // seam cells are mapped exactly with the key nearest to the scanline of their grid row
+    for (int32_t r = 0; r < grid.rows && ret == 0; r++)
+    {
+        float t = grid.nodes[2 * (r * grid.columns + grid.columns / 2) + 1];
+        float weight;
+        int32_t k = GetShutterKey(1.0f - (t - floorf(t)), count, &weight);
+        rowMapping[r] = (uint8_t)(weight < 0.5f ? k : k + 1);
+    }
+
+    if (ret == 0)
+    {
+        key->view = views[count / 2];
+        ret = FillRemapTable(table, mappings, rowMapping, &grid);
+    }
+
+    free(keyNodes);
+    free(rowMapping);
+    FreeRemapGrid(&grid);
+    return ret;
+}
+
+/* v' = conj(q) * v * q, the camera coordinates of the reference direction v */
+static void RotateInverse(const double q[4], const double v[3], double out[3])
+{
+    // R(q)^T v with q = (w, x, y, z)
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+    out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y + w * z) * v[1] + 2 * (x * z - w * y) * v[2];
+    out[1] = 2 * (x * y - w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1] + 2 * (y * z + w * x) * v[2];
+    out[2] = 2 * (x * z + w * y) * v[0] + 2 * (y * z - w * x) * v[1] + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+static double Dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void StabilizeView(const SGnomonicView* view, const float rotation[4], SGnomonicView* stabilized)
+{
+    double norm = sqrt((double)rotation[0] * rotation[0] + (double)rotation[1] * rotation[1] +
+        (double)rotation[2] * rotation[2] + (double)rotation[3] * rotation[3]);
+    double q[4] = { 1.0, 0.0, 0.0, 0.0 };
+    if (norm > 0.0)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            q[i] = rotation[i] / norm;
+        }
+    }
+
+    double forward[3], east[3], north[3];
+    GetViewBasis(view, forward, east, north);
+
+    double cameraForward[3], cameraEast[3];
+    RotateInverse(q, forward, cameraForward);
+    RotateInverse(q, east, cameraEast);
+
+    double lat = asin(cameraForward[1] < -1.0 ? -1.0 : cameraForward[1] > 1.0 ? 1.0 : cameraForward[1]);
+    double lon = atan2(cameraForward[0], cameraForward[2]);
+    double levelForward[3], levelEast[3], levelNorth[3];
+    GetCenterBasis(lon, lat, levelForward, levelEast, levelNorth);
+
+    *stabilized = *view;
+    stabilized->center[0] = (float)((lon / HALF_PI_D + 1.0) * 0.5);
+    stabilized->center[1] = (float)((lat / HALF_PI_D + 1.0) * 0.5);
+    stabilized->roll = (float)atan2(Dot(cameraEast, levelNorth), Dot(cameraEast, levelEast));
+}
+
+static bool MatchesTable(const SRemapTable* table, const SImage* source, const SImage* target)
+{
+    const SRemapKey* key = &table->key;
+    return IsValidImage(source) && IsValidImage(target) &&
+        source->width == key->sourceWidth && source->height == key->sourceHeight &&
+        source->channels == key->channels && source->stride == key->sourceStride &&
+        target->width == key->view.width && target->height == key->view.height &&
+        target->channels == key->channels;
+}
+
+static void RemapRows(const SRemapTable* table, const SImage* source, SImage* target, bool avx2,
+    int32_t fromRow, int32_t toRow)
+{
+    for (int32_t row = fromRow; row < toRow; row++)
+    {
+#if GNOMONIC_AVX2
+        if (avx2)
+        {
+            RemapRowAvx2(table, source, target, row);
+            continue;
+        }
+#endif
+        RemapPixels(table, source, target, row, 0, target->width);
+    }
+}
+
+static bool UseAvx2Gather(const SImage* source)
+{
+#if GNOMONIC_AVX2
+    return CanGatherAvx2(source);
+#else
+    (void)source;
+    return false;
+#endif
+}
+
+int RemapImage(const SRemapTable* table, const SImage* source, SImage* target)
+{
+    if (!MatchesTable(table, source, target))
+    {
+        return -1;
+    }
+
+    RemapRows(table, source, target, UseAvx2Gather(source), 0, target->height);
+    return 0;
+}
+
+/* Table file name: FNV-1a hash of the key, the key itself is stored in the file and compared on load */
+static void GetRemapTablePath(const char* directory, const SRemapKey* key, char* path, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const uint8_t* bytes = (const uint8_t*)key;
+    for (size_t i = 0; i < sizeof(*key); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    snprintf(path, size, "%s/remap_%016llx.vzmap", directory, (unsigned long long)hash);
+}
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    int32_t rightTap;
+    int32_t lowerTap;
+    int32_t reserved;
+    SRemapKey key;
+} SRemapFileHeader;
+
+int SaveRemapTable(const char* directory, const SRemapTable* table)
+{
+    char path[1024];
+    GetRemapTablePath(directory, &table->key, path, sizeof(path));
+
+    SRemapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REMAP_TABLE_MAGIC, sizeof(REMAP_TABLE_MAGIC));
+    header.version = REMAP_TABLE_VERSION;
+    header.rightTap = table->rightTap;
+    header.lowerTap = table->lowerTap;
+    header.key = table->key;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    size_t count = (size_t)table->key.view.width * table->key.view.height;
+    int ret = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(table->offsets, sizeof(uint32_t), count, file) != count ||
+        fwrite(table->weights, sizeof(uint32_t), count, file) != count)
+    {
+        ret = -1;
+    }
+
+    if (fclose(file) != 0 || ret != 0)
+    {
+        perror(path);
+        remove(path);
+        return -1;
+    }
+    return 0;
+}
+
+int LoadRemapTable(const char* directory, const SRemapKey* key, SRemapTable* table)
+{
+    char path[1024];
+    GetRemapTablePath(directory, key, path, sizeof(path));
+    memset(table, 0, sizeof(*table));
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    SRemapFileHeader header;
+    size_t count = (size_t)key->view.width * key->view.height;
+    int ret = -1;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, REMAP_TABLE_MAGIC, sizeof(REMAP_TABLE_MAGIC)) == 0 &&
+        header.version == REMAP_TABLE_VERSION && memcmp(&header.key, key, sizeof(*key)) == 0)
+    {
+        table->key = *key;
+        table->rightTap = header.rightTap;
+        table->lowerTap = header.lowerTap;
+        table->offsets = malloc(count * sizeof(uint32_t));
+        table->weights = malloc(count * sizeof(uint32_t));
+
+        if (table->offsets != NULL && table->weights != NULL &&
+            fread(table->offsets, sizeof(uint32_t), count, file) == count &&
+            fread(table->weights, sizeof(uint32_t), count, file) == count)
+        {
+            ret = 0;
+        }
+    }
+
+    fclose(file);
+    if (ret != 0)
+    {
+        FreeRemapTable(table);
+    }
+    return ret;
+}
+
+static struct
+{
+    pthread_mutex_t lock;
+    SRemapTable* tables[REMAP_CACHE_SIZE];
+    size_t next;
+} s_remapCache = { PTHREAD_MUTEX_INITIALIZER, { NULL }, 0 };
+
+/* Drop one reference, the caller holds the cache lock */
+static void DropReference(SRemapTable* table)
+{
+    if (--table->references == 0)
+    {
+        FreeRemapTable(table);
+        free(table);
+    }
+}
+
+SRemapTable* AcquireRemapTable(const SRemapKey* key, const char* cacheDirectory)
+{
+    pthread_mutex_lock(&s_remapCache.lock);
+    for (size_t i = 0; i < REMAP_CACHE_SIZE; i++)
+    {
+        SRemapTable* table = s_remapCache.tables[i];
+        if (table != NULL && memcmp(&table->key, key, sizeof(*key)) == 0)
+        {
+            table->references++;
+            pthread_mutex_unlock(&s_remapCache.lock);
+            return table;
+        }
+    }
+    pthread_mutex_unlock(&s_remapCache.lock);
+
+    // built outside the lock, two threads missing the same key at once both build it
+    SRemapTable* table = malloc(sizeof(SRemapTable));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    if (cacheDirectory == NULL || LoadRemapTable(cacheDirectory, key, table) != 0)
+    {
+        if (BuildRemapTable(key, table) != 0)
+        {
+            free(table);
+            return NULL;
+        }
+        if (cacheDirectory != NULL)
+        {
+            SaveRemapTable(cacheDirectory, table);
+        }
+    }
+
+    // one reference for the cache, one for the caller
+    table->references = 2;
+
+    pthread_mutex_lock(&s_remapCache.lock);
+    SRemapTable* evicted = s_remapCache.tables[s_remapCache.next];
+    s_remapCache.tables[s_remapCache.next] = table;
+    s_remapCache.next = (s_remapCache.next + 1) % REMAP_CACHE_SIZE;
+    if (evicted != NULL)
+    {
+        DropReference(evicted);
+    }
+    pthread_mutex_unlock(&s_remapCache.lock);
+
+    return table;
+}
+
+void ReleaseRemapTable(SRemapTable* table)
+{
+    if (table == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_remapCache.lock);
+    DropReference(table);
+    pthread_mutex_unlock(&s_remapCache.lock);
+}
+
+void ClearRemapTableCache(void)
+{
+    pthread_mutex_lock(&s_remapCache.lock);
+    for (size_t i = 0; i < REMAP_CACHE_SIZE; i++)
+    {
+        if (s_remapCache.tables[i] != NULL)
+        {
+            DropReference(s_remapCache.tables[i]);
+            s_remapCache.tables[i] = NULL;
+        }
+    }
+    s_remapCache.next = 0;
+    pthread_mutex_unlock(&s_remapCache.lock);
+}
+
+int ProjectGnomonicCached(const SImage* source, const SGnomonicView* view, SImage* target,
+    const char* cacheDirectory)
+{
+    if (!IsValidImage(source) || view == NULL)
+    {
+        return -1;
+    }
+
+    SRemapKey key;
+    GetRemapKey(source, view, &key);
+
+    SRemapTable* table = AcquireRemapTable(&key, cacheDirectory);
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    int ret = RemapImage(table, source, target);
+    ReleaseRemapTable(table);
+    return ret;
+}
+
+/* One output tile of one view, ordered by the source row it reads in its center */
+typedef struct
+{
+    uint32_t sourceRow;
+    uint32_t view;
+    uint32_t tile;
+} STileJob;
+
+typedef struct
+{
+    const SImage* source;
+    SImage* targets;
+    SRemapTable** tables;
+    bool avx2;
+
+    STileJob* jobs;
+    size_t jobCount;
+
+    /** Guards 'next' */
+    pthread_mutex_t lock;
+    size_t next;
+} SViewBatch;
+
+static int GetProcessorCount(void)
+{
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static int32_t MinInt(int32_t a, int32_t b)
+{
+    return a < b ? a : b;
+}
+
+static int CompareJobs(const void* a, const void* b)
+{
+    const STileJob* x = a;
+    const STileJob* y = b;
+    return x->sourceRow < y->sourceRow ? -1 : x->sourceRow > y->sourceRow;
+}
+
+/*
+ * Tiles of all views sorted by the source row of their center pixel. Taken
+ * in this order the workers move down the source together, so the rows a
+ * tile reads are mostly still in cache from the tiles of the other views.
+ */
+static size_t PlanTiles(SViewBatch* batch, int32_t count)
+{
+    size_t jobCount = 0;
+    for (int32_t v = 0; v < count; v++)
+    {
+        const SRemapTable* table = batch->tables[v];
+        const SGnomonicView* view = &table->key.view;
+
+        for (int32_t tile = 0; tile * GNOMONIC_TILE_ROWS < view->height; tile++)
+        {
+            int32_t row = tile * GNOMONIC_TILE_ROWS;
+            row = (row + MinInt(row + GNOMONIC_TILE_ROWS, view->height)) / 2;
+
+            STileJob* job = &batch->jobs[jobCount++];
+            job->sourceRow = (uint32_t)(table->offsets[(size_t)row * view->width + view->width / 2] /
+                table->key.sourceStride);
+            job->view = (uint32_t)v;
+            job->tile = (uint32_t)tile;
+        }
+    }
+
+    qsort(batch->jobs, jobCount, sizeof(STileJob), CompareJobs);
+    return jobCount;
+}
+
+static void* ProjectTiles(void* context)
+{
+    SViewBatch* batch = context;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&batch->lock);
+        size_t index = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (index >= batch->jobCount)
+        {
+            return NULL;
+        }
+
+        const STileJob* job = &batch->jobs[index];
+        SImage* target = &batch->targets[job->view];
+        int32_t row = job->tile * GNOMONIC_TILE_ROWS;
+        RemapRows(batch->tables[job->view], batch->source, target, batch->avx2,
+            row, MinInt(row + GNOMONIC_TILE_ROWS, target->height));
+    }
+}
+
+static size_t CountTiles(const SGnomonicView* view)
+{
+    return (size_t)((view->height + GNOMONIC_TILE_ROWS - 1) / GNOMONIC_TILE_ROWS);
+}
+
+int ProjectGnomonicViews(const SImage* source, const SGnomonicView* views, SImage* targets, int32_t count,
+    int32_t threads, const char* cacheDirectory)
+{
+    if (!IsValidImage(source) || views == NULL || targets == NULL || count < 0)
+    {
+        return -1;
+    }
+
+    SViewBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.source = source;
+    batch.targets = targets;
+    batch.avx2 = UseAvx2Gather(source);
+    batch.tables = calloc(count > 0 ? count : 1, sizeof(SRemapTable*));
+    if (batch.tables == NULL)
+    {
+        return -1;
+    }
+
+    int ret = 0;
+    size_t tileCount = 0;
+    for (int32_t v = 0; v < count && ret == 0; v++)
+    {
+        SRemapKey key;
+        GetRemapKey(source, &views[v], &key);
+        batch.tables[v] = AcquireRemapTable(&key, cacheDirectory);
+        if (batch.tables[v] == NULL || !MatchesTable(batch.tables[v], source, &targets[v]))
+        {
+            ret = -1;
+        }
+        tileCount += CountTiles(&views[v]);
+    }
+
+    batch.jobs = ret == 0 ? malloc((tileCount > 0 ? tileCount : 1) * sizeof(STileJob)) : NULL;
+    if (ret == 0 && batch.jobs != NULL)
+    {
+        batch.jobCount = PlanTiles(&batch, count);
+        pthread_mutex_init(&batch.lock, NULL);
+
+        if (threads <= 0)
+        {
+            threads = GetProcessorCount();
+        }
+        if ((size_t)threads > batch.jobCount)
+        {
+            threads = batch.jobCount > 0 ? (int32_t)batch.jobCount : 1;
+        }
+
+        // the calling thread is one of the workers
+        pthread_t* workers = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+        int32_t started = 0;
+        while (workers != NULL && started < threads - 1 &&
+            pthread_create(&workers[started], NULL, ProjectTiles, &batch) == 0)
+        {
+            started++;
+        }
+
+        ProjectTiles(&batch);
+        for (int32_t i = 0; i < started; i++)
+        {
+            pthread_join(workers[i], NULL);
+        }
+
+        free(workers);
+        pthread_mutex_destroy(&batch.lock);
+    }
+    else
+    {
+        ret = -1;
+    }
+
+    for (int32_t v = 0; v < count; v++)
+    {
+        ReleaseRemapTable(batch.tables[v]);
+    }
+    free(batch.tables);
+    free(batch.jobs);
+    return ret;
+}
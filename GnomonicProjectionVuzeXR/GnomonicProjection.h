@@ -0,0 +1,206 @@
+/**
+ * @file GnomonicProjection.h
+ * Native equirectangular -> gnomonic (rectilinear) projection, the fused
+ * equivalent of NFOV.toNFOV() in GnomonicProjectionVuzeXR.py.
+ *
+ * The mapping follows NFOV exactly: the source covers +-90 degrees in both
+ * directions (one eye of the Vuze XR), both images are stored top row first
+ * and addressed bottom row first like NFOV does with frame[::-1]. Samples
+ * outside the source are clamped to the border instead of wrapping into the
+ * next row. Loaded from Python with ctypes, see NativeNFOV.py.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if _WIN32
+#define GNOMONIC_API __declspec(dllexport)
+#else
+#define GNOMONIC_API
+#endif
+
+/** Interleaved 8-bit image with 1 to 4 channels, rows 'stride' bytes apart */
+typedef struct
+{
+    uint8_t* data;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int64_t stride;
+} SImage;
+
+typedef struct
+{
+    /** Output size in pixels */
+    int32_t width;
+    int32_t height;
+
+    /** NFOV.FOV: the tangent plane spans +-fov * pi / 2 horizontally and vertically */
+    float fov[2];
+
+    /** View center in [0, 1] x [0, 1] of the source, NFOV center_point */
+    float center[2];
+
+    /** Rotation of the view around its center in radians, counter-clockwise; NFOV has none */
+    float roll;
+} SGnomonicView;
+
+/**
+ * Everything a remap table depends on: the view and the source layout.
+ * Tables are looked up by comparing keys byte by byte, so keep it zeroed
+ * apart from the fields.
+ */
+typedef struct
+{
+    SGnomonicView view;
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    int32_t channels;
+    int32_t reserved[2];
+    int64_t sourceStride;
+} SRemapKey;
+
+/**
+ * Precomputed projection of one view: per output pixel the byte offset of
+ * its top-left source tap and the bilinear weights towards the right and
+ * the lower tap in 1/256 pixel. Offsets and weights are separate arrays so
+ * that 8 pixels are loaded with one vector load each.
+ */
+typedef struct
+{
+    SRemapKey key;
+
+    /** width * height entries in target order */
+    uint32_t* offsets;
+
+    /** (fx | fy << 16), both in [0, 256] */
+    uint32_t* weights;
+
+    /** Byte distance from a tap to its right and to its lower neighbour */
+    int32_t rightTap;
+    int32_t lowerTap;
+
+    /** References held by the cache and by callers of AcquireRemapTable() */
+    int32_t references;
+} SRemapTable;
+
+/**
+ * Output tiles of ProjectGnomonicViews() are bands of this many full rows.
+ * Narrower tiles measured slower: the table and target rows are then no
+ * longer read and written as long sequential streams.
+ */
+#define GNOMONIC_TILE_ROWS 16
+
+/** Version of the table files written to the disk cache */
+#define REMAP_TABLE_VERSION 2
+
+/** Number of tables kept in memory by AcquireRemapTable() */
+#define REMAP_CACHE_SIZE 16
+
+/** Node distance in pixels of the grid UpdateRemapTable() maps exactly, a multiple of 8 */
+#define GNOMONIC_GRID_STEP 8
+
+/**
+ * Project 'source' into 'target', which must have the view size and the
+ * channel count of the source.
+ * @return 0 on success, -1 on invalid arguments
+ */
+GNOMONIC_API int ProjectGnomonic(const SImage* source, const SGnomonicView* view, SImage* target);
+
+/** 1 if the AVX2 kernel is used on this CPU, 0 for the scalar one */
+GNOMONIC_API int GnomonicUsesAvx2(void);
+
+/** Key of the table that projects 'source' (only its layout is used) with 'view' */
+GNOMONIC_API void GetRemapKey(const SImage* source, const SGnomonicView* view, SRemapKey* key);
+
+/** Compute a table, release it with FreeRemapTable() */
+GNOMONIC_API int BuildRemapTable(const SRemapKey* key, SRemapTable* table);
+
+GNOMONIC_API void FreeRemapTable(SRemapTable* table);
+
+/**
+ * Store a table in / load it from 'directory', the file name is derived from
+ * the key. Loading fails with -1 if there is no file with a matching key.
+ */
+GNOMONIC_API int SaveRemapTable(const char* directory, const SRemapTable* table);
+GNOMONIC_API int LoadRemapTable(const char* directory, const SRemapKey* key, SRemapTable* table);
+
+/**
+ * Table for 'key' from the in-memory cache. On a miss it is loaded from
+ * 'cacheDirectory', or built and saved there; 'cacheDirectory' may be NULL
+ * for no disk cache. The table stays valid until ReleaseRemapTable(), even
+ * if the cache drops it meanwhile.
+ * @return NULL on failure
+ */
+GNOMONIC_API SRemapTable* AcquireRemapTable(const SRemapKey* key, const char* cacheDirectory);
+
+GNOMONIC_API void ReleaseRemapTable(SRemapTable* table);
+
+/** Drop all tables from the in-memory cache */
+GNOMONIC_API void ClearRemapTableCache(void);
+
+/**
+ * Turn a table into the one of 'view', which must have the size of the
+ * table's view. Only a grid of every GNOMONIC_GRID_STEP-th pixel is mapped
+ * exactly, the pixels in between are interpolated from it: a few
+ * hundredths of a pixel off near the view center, up to about half a pixel
+ * close to the poles or with a strong roll. Cells across the 0/360 degree
+ * seam of the source are mapped exactly. Only for
+ * tables of the caller (BuildRemapTable(), LoadRemapTable()), never for the
+ * shared ones of AcquireRemapTable().
+ * @return 0 on success, -1 on invalid arguments
+ */
+GNOMONIC_API int UpdateRemapTable(SRemapTable* table, const SGnomonicView* view);
+
+/**
+ * Counter-rotate 'view' by the camera orientation 'rotation' (quaternion
+ * w, x, y, z from camera to reference coordinates; x right, y up, z forward
+ * of the source image): 'stabilized' shows the scene 'view' showed with the
+ * camera in its reference orientation.
+ */
+GNOMONIC_API void StabilizeView(const SGnomonicView* view, const float rotation[4], SGnomonicView* stabilized);
+
+/** Most orientations of one frame in SRollingShutter */
+#define GNOMONIC_MAX_SHUTTER_KEYS 8
+
+/**
+ * Orientations of a rolling shutter frame, taken top to bottom: rotation k
+ * holds while source row k * (height - 1) / (count - 1) is exposed, rows in
+ * between are interpolated (see ExtractMetadata --orientation).
+ */
+typedef struct
+{
+    int32_t count;
+    float rotations[GNOMONIC_MAX_SHUTTER_KEYS][4];
+} SRollingShutter;
+
+/**
+ * UpdateRemapTable() with 'view' stabilized like StabilizeView() for every
+ * source row at its own orientation. The grid is mapped once per key and
+ * each node takes the blend of the keys around the row it is read from, so
+ * the cost is one grid per key on top of UpdateRemapTable(). Cells across
+ * the seam are mapped exactly with the key nearest to their row.
+ * @return 0 on success, -1 on invalid arguments
+ */
+GNOMONIC_API int UpdateRemapTableRollingShutter(SRemapTable* table, const SGnomonicView* view,
+    const SRollingShutter* shutter);
+
+/** Per frame part of a table projection: gather and blend, no trigonometry */
+GNOMONIC_API int RemapImage(const SRemapTable* table, const SImage* source, SImage* target);
+
+/** ProjectGnomonic() through a cached table, see AcquireRemapTable() */
+GNOMONIC_API int ProjectGnomonicCached(const SImage* source, const SGnomonicView* view, SImage* target,
+    const char* cacheDirectory);
+
+/**
+ * Project 'source' into 'count' views at once, targets[i] receives views[i].
+ * The output tiles of all views are taken in the order they read the source,
+ * so each part of the source is loaded into the cache about once for all
+ * views. Tiles are spread over 'threads' threads including the caller, 0 for
+ * one per processor. Tables come from AcquireRemapTable() with 'cacheDirectory'.
+ * @return 0 on success, -1 on invalid arguments
+ */
+GNOMONIC_API int ProjectGnomonicViews(const SImage* source, const SGnomonicView* views, SImage* targets,
+    int32_t count, int32_t threads, const char* cacheDirectory);
@@ -0,0 +1,287 @@
+import ctypes
+import os
+import sys
+from math import pi
+import numpy as np
+
+# ctypes mirror of GnomonicProjection.h, build the library as described in HowToCompile.txt
+class SImage(ctypes.Structure):
+    _fields_ = [
+        ("data", ctypes.POINTER(ctypes.c_uint8)),
+        ("width", ctypes.c_int32),
+        ("height", ctypes.c_int32),
+        ("channels", ctypes.c_int32),
+        ("stride", ctypes.c_int64),
+    ]
+
+class SGnomonicView(ctypes.Structure):
+    _fields_ = [
+        ("width", ctypes.c_int32),
+        ("height", ctypes.c_int32),
+        ("fov", ctypes.c_float * 2),
+        ("center", ctypes.c_float * 2),
+        ("roll", ctypes.c_float),
+    ]
+
+class SRemapKey(ctypes.Structure):
+    _fields_ = [
+        ("view", SGnomonicView),
+        ("sourceWidth", ctypes.c_int32),
+        ("sourceHeight", ctypes.c_int32),
+        ("channels", ctypes.c_int32),
+        ("reserved", ctypes.c_int32 * 2),
+        ("sourceStride", ctypes.c_int64),
+    ]
+
+class SRemapTable(ctypes.Structure):
+    _fields_ = [
+        ("key", SRemapKey),
+        ("offsets", ctypes.POINTER(ctypes.c_uint32)),
+        ("weights", ctypes.POINTER(ctypes.c_uint32)),
+        ("rightTap", ctypes.c_int32),
+        ("lowerTap", ctypes.c_int32),
+        ("references", ctypes.c_int32),
+    ]
+
+GNOMONIC_MAX_SHUTTER_KEYS = 8
+
+class SRollingShutter(ctypes.Structure):
+    _fields_ = [
+        ("count", ctypes.c_int32),
+        ("rotations", (ctypes.c_float * 4) * GNOMONIC_MAX_SHUTTER_KEYS),
+    ]
+
+def LoadProjectionLibrary():
+
+    name = "GnomonicProjection.dll" if sys.platform == "win32" else "libGnomonicProjection.so"
+    lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), name))
+
+    lib.ProjectGnomonic.argtypes = [ctypes.POINTER(SImage), ctypes.POINTER(SGnomonicView), ctypes.POINTER(SImage)]
+    lib.ProjectGnomonic.restype = ctypes.c_int
+    lib.GnomonicUsesAvx2.argtypes = []
+    lib.GnomonicUsesAvx2.restype = ctypes.c_int
+    lib.ProjectGnomonicCached.argtypes = [ctypes.POINTER(SImage), ctypes.POINTER(SGnomonicView), ctypes.POINTER(SImage), ctypes.c_char_p]
+    lib.ProjectGnomonicCached.restype = ctypes.c_int
+    lib.GetRemapKey.argtypes = [ctypes.POINTER(SImage), ctypes.POINTER(SGnomonicView), ctypes.POINTER(SRemapKey)]
+    lib.GetRemapKey.restype = None
+    lib.AcquireRemapTable.argtypes = [ctypes.POINTER(SRemapKey), ctypes.c_char_p]
+    lib.AcquireRemapTable.restype = ctypes.POINTER(SRemapTable)
+    lib.ReleaseRemapTable.argtypes = [ctypes.POINTER(SRemapTable)]
+    lib.ReleaseRemapTable.restype = None
+    lib.RemapImage.argtypes = [ctypes.POINTER(SRemapTable), ctypes.POINTER(SImage), ctypes.POINTER(SImage)]
+    lib.RemapImage.restype = ctypes.c_int
+    lib.ClearRemapTableCache.argtypes = []
+    lib.ClearRemapTableCache.restype = None
+    lib.ProjectGnomonicViews.argtypes = [ctypes.POINTER(SImage), ctypes.POINTER(SGnomonicView), ctypes.POINTER(SImage),
+                                         ctypes.c_int32, ctypes.c_int32, ctypes.c_char_p]
+    lib.ProjectGnomonicViews.restype = ctypes.c_int
+    lib.BuildRemapTable.argtypes = [ctypes.POINTER(SRemapKey), ctypes.POINTER(SRemapTable)]
+    lib.BuildRemapTable.restype = ctypes.c_int
+    lib.FreeRemapTable.argtypes = [ctypes.POINTER(SRemapTable)]
+    lib.FreeRemapTable.restype = None
+    lib.UpdateRemapTable.argtypes = [ctypes.POINTER(SRemapTable), ctypes.POINTER(SGnomonicView)]
+    lib.UpdateRemapTable.restype = ctypes.c_int
+    lib.StabilizeView.argtypes = [ctypes.POINTER(SGnomonicView), ctypes.c_float * 4, ctypes.POINTER(SGnomonicView)]
+    lib.StabilizeView.restype = None
+    lib.UpdateRemapTableRollingShutter.argtypes = [ctypes.POINTER(SRemapTable), ctypes.POINTER(SGnomonicView),
+                                                   ctypes.POINTER(SRollingShutter)]
+    lib.UpdateRemapTableRollingShutter.restype = ctypes.c_int
+    return lib
+
+def ToImage(array):
+    """SImage view of a HxWxC uint8 array with packed pixels (see AsImageArray()), no copy"""
+
+    return SImage(array.ctypes.data_as(ctypes.POINTER(ctypes.c_uint8)),
+                  array.shape[1], array.shape[0], array.shape[2], array.strides[0])
+
+def AsImageArray(frame):
+    """'frame' as HxWxC uint8 array that ToImage() accepts. Rows may be strided, so the eye halves
+    of UnstitchImage() are used in place, anything else is copied to a contiguous array"""
+
+    if frame.ndim == 2:
+        frame = frame[:, :, np.newaxis]
+
+    channels = frame.shape[2]
+    packed = frame.dtype == np.uint8 and (channels == 1 or frame.strides[2] == 1) and \
+        frame.strides[1] == channels and frame.strides[0] >= frame.shape[1] * channels
+    return frame if packed else np.ascontiguousarray(frame, dtype=np.uint8)
+
+class NativeNFOV():
+    """Drop-in for NFOV.toNFOV() without the analysis plots and image dumps"""
+
+    def __init__(self, height=800, width=1600, use_tables=True, cache_dir=None):
+        """With 'use_tables' the projection of each view is computed once and reused for every
+        frame (8-bit bilinear weights), tables are also kept in 'cache_dir' across runs if given"""
+
+        self.FOV = [pi*0.5 * 0.61, pi*0.5 * 0.38] # same view as NFOV
+        self.height = height
+        self.width = width
+        self.use_tables = use_tables
+        self.cache_dir = os.fsencode(cache_dir) if cache_dir is not None else None
+        self.lib = LoadProjectionLibrary()
+
+        # tables of toStabilizedNFOVs(), one per center point, changed every frame
+        self.stabilized_tables = []
+
+    def __del__(self):
+        self.close()
+
+    def close(self):
+        """Frees the tables of toStabilizedNFOVs()"""
+
+        for table in self.stabilized_tables:
+            self.lib.FreeRemapTable(table)
+        self.stabilized_tables = []
+
+    def _get_view(self, center_point):
+        view = SGnomonicView()
+        view.width = self.width
+        view.height = self.height
+        view.fov[0], view.fov[1] = self.FOV
+        view.center[0], view.center[1] = center_point
+        return view
+
+    def toNFOV(self, frame, center_point, out=None):
+        """Projects the HxWxC uint8 'frame' around 'center_point' ([0,1] x [0,1]), reusing 'out' if given"""
+
+        frame = AsImageArray(frame)
+        if out is None:
+            out = np.empty((self.height, self.width, frame.shape[2]), dtype=np.uint8)
+
+        view = self._get_view(center_point)
+        if self.use_tables:
+            ret = self.lib.ProjectGnomonicCached(ToImage(frame), view, ToImage(out), self.cache_dir)
+        else:
+            ret = self.lib.ProjectGnomonic(ToImage(frame), view, ToImage(out))
+        if ret != 0:
+            raise ValueError("Invalid frame %s or output %s for the projection" % (frame.shape, out.shape))
+        return out
+
+    def toNFOVs(self, frame, center_points, outs=None, threads=0):
+        """toNFOV() for every point of 'center_points' in one pass over 'frame', spread over 'threads'
+        threads (0: one per processor). Always uses remap tables, returns the list of outputs"""
+
+        frame = AsImageArray(frame)
+        if outs is None:
+            outs = [np.empty((self.height, self.width, frame.shape[2]), dtype=np.uint8) for _ in center_points]
+
+        count = len(center_points)
+        views = (SGnomonicView * count)(*(self._get_view(center_point) for center_point in center_points))
+        targets = (SImage * count)(*(ToImage(out) for out in outs))
+        if self.lib.ProjectGnomonicViews(ToImage(frame), views, targets, count, threads, self.cache_dir) != 0:
+            raise ValueError("Invalid frame %s or outputs %s for the projection" % (
+                frame.shape, [out.shape for out in outs]))
+        return outs
+
+    def toStabilizedNFOVs(self, frame, center_points, orientation, outs=None):
+        """
+        toNFOVs() with every view counter-rotated by the camera 'orientation' (quaternion w, x, y, z
+        from ExtractMetadata --orientation), so the views stay on the scene they show at the
+        reference orientation. The table of each view is built on the first frame and then only
+        updated from a coarse grid of exact points (see UpdateRemapTable() for the accuracy).
+        'orientation' may also be several quaternions, taken from the first to the last scanline
+        of the rolling shutter, each row is then corrected for the orientation it was exposed at
+        """
+
+        frame = AsImageArray(frame)
+        if outs is None:
+            outs = [np.empty((self.height, self.width, frame.shape[2]), dtype=np.uint8) for _ in center_points]
+
+        source = ToImage(frame)
+        keys = np.asarray(orientation, dtype=np.float32).reshape(-1, 4)
+        if len(keys) > GNOMONIC_MAX_SHUTTER_KEYS:
+            raise ValueError("At most %d rolling shutter orientations" %GNOMONIC_MAX_SHUTTER_KEYS)
+        shutter = SRollingShutter()
+        shutter.count = len(keys)
+        for index, key in enumerate(keys):
+            shutter.rotations[index][:] = key.tolist()
+        rotation = shutter.rotations[len(keys) // 2]
+        if len(self.stabilized_tables) != len(center_points) or \
+                any(table.key.sourceStride != source.stride or table.key.channels != source.channels or
+                    table.key.sourceWidth != source.width or table.key.sourceHeight != source.height
+                    for table in self.stabilized_tables):
+            self.close()
+
+        for index, (center_point, out) in enumerate(zip(center_points, outs)):
+            view = SGnomonicView()
+            self.lib.StabilizeView(self._get_view(center_point), rotation, view)
+
+            built = index == len(self.stabilized_tables)
+            if built:
+                key = SRemapKey()
+                table = SRemapTable()
+                self.lib.GetRemapKey(source, view, key)
+                if self.lib.BuildRemapTable(key, table) != 0:
+                    raise MemoryError("Can not build the remap table of %s" %(frame.shape,))
+                self.stabilized_tables.append(table)
+            if len(keys) > 1:
+                ret = self.lib.UpdateRemapTableRollingShutter(self.stabilized_tables[index],
+                                                              self._get_view(center_point), shutter)
+            else:
+                ret = 0 if built else self.lib.UpdateRemapTable(self.stabilized_tables[index], view)
+            if ret != 0:
+                raise ValueError("Invalid view for the remap table")
+
+            if self.lib.RemapImage(self.stabilized_tables[index], source, ToImage(out)) != 0:
+                raise ValueError("Invalid frame %s or output %s for the projection" % (frame.shape, out.shape))
+        return outs
+
+
+# measure frames per second on one core
+if __name__ == "__main__":
+
+    import time
+
+    eye_height, eye_width = (int(v) for v in sys.argv[1:3]) if len(sys.argv) >= 3 else (1920, 1920)
+    frames = int(sys.argv[3]) if len(sys.argv) >= 4 else 50
+
+    source = np.random.randint(0, 256, (eye_height, eye_width, 3), dtype=np.uint8)
+    center_point = np.array([0.5, 0.75])
+
+    for use_tables in (False, True):
+        nfov = NativeNFOV(use_tables=use_tables)
+        out = np.empty((nfov.height, nfov.width, 3), dtype=np.uint8)
+
+        # the first frame builds the table
+        start = time.perf_counter()
+        nfov.toNFOV(source, center_point, out)
+        first = time.perf_counter() - start
+
+        start = time.perf_counter()
+        for i in range(frames):
+            nfov.toNFOV(source, center_point, out)
+        elapsed = time.perf_counter() - start
+
+        print("%dx%d -> %dx%d, %s %s: first frame %.2f ms, %.2f ms/frame, %.1f frames/s" % (
+            eye_width, eye_height, nfov.width, nfov.height,
+            "AVX2" if nfov.lib.GnomonicUsesAvx2() else "scalar",
+            "remap table" if use_tables else "fused kernel",
+            first * 1000, elapsed / frames * 1000, frames / elapsed))
+
+    # several views of the same frame, one call each against one batched call
+    center_points = [np.array([x, y]) for x in (0.3, 0.5, 0.7) for y in (0.4, 0.6)]
+    outs = [np.empty((nfov.height, nfov.width, 3), dtype=np.uint8) for _ in center_points]
+    nfov.toNFOVs(source, center_points, outs)
+
+    start = time.perf_counter()
+    for i in range(frames):
+        for center_point, out in zip(center_points, outs):
+            nfov.toNFOV(source, center_point, out)
+    separate = time.perf_counter() - start
+
+    start = time.perf_counter()
+    for i in range(frames):
+        nfov.toNFOVs(source, center_points, outs)
+    batched = time.perf_counter() - start
+
+    print("%d views: %.2f ms/frame separately, %.2f ms/frame batched on %d threads" % (
+        len(center_points), separate / frames * 1000, batched / frames * 1000, os.cpu_count()))
+
+    # one stabilized view, its table follows a slowly turning camera
+    angles = np.linspace(0, 0.2, frames)
+    nfov.toStabilizedNFOVs(source, [center_point], (1, 0, 0, 0), outs[:1])
+    start = time.perf_counter()
+    for angle in angles:
+        nfov.toStabilizedNFOVs(source, [center_point], (np.cos(angle / 2), 0, np.sin(angle / 2), 0), outs[:1])
+    stabilized = time.perf_counter() - start
+    print("stabilized view: %.2f ms/frame with the table updated every frame" % (stabilized / frames * 1000))
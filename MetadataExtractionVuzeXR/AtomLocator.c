@@ -0,0 +1,374 @@
+/**
+ * @file AtomLocator.c
+ * Locating atoms of a MOV/MP4 file, including 64-bit 'largesize' atoms
+ */
+
+// Instruct GCC to use 64-bit off_t/fseeko/ftello, which is not the default on MinGW
+#define _FILE_OFFSET_BITS 64
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "AtomLocator.h"
+#include "LargeFile.h"
+#include "Threads.h"
+
+#if _WIN32
+#include <windows.h>
+#include <io.h>
+#endif
+
+/** Top-level atoms read from the start of the file before the tail is tried: ftyp, mdat, moov */
+#define TOP_LEVEL_PROBE_ATOMS 3
+
+/** The tail is only read if an atom this large was stepped over, else the walk reads less */
+#define TAIL_SCAN_MIN_SKIP (64 * 1024 * 1024)
+
+/** Bytes read from the end of the file, a 'moov' of a few KB without a large bmdt fits */
+#define TAIL_SCAN_WINDOW (64 * 1024)
+
+/** Number of files whose atom locations are remembered */
+#define ATOM_CACHE_SIZE 16
+
+static struct
+{
+    SMutex lock;
+    SAtomLocation entries[ATOM_CACHE_SIZE];
+    size_t count;
+    size_t next;
+} s_atomCache = { .lock = MUTEX_INITIALIZER };
+
+static uint32_t ReadBigEndian32(const uint8_t* data)
+{
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static uint64_t ReadBigEndian64(const uint8_t* data)
+{
+    return (uint64_t)ReadBigEndian32(data) << 32 | ReadBigEndian32(data + 4);
+}
+
+int GetFileIdentity(FILE* file, SFileIdentity* out)
+{
+    memset(out, 0, sizeof(*out));
+
+#if _WIN32
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    if (handle == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(handle, &info))
+    {
+        return -1;
+    }
+
+    out->device = info.dwVolumeSerialNumber;
+    out->inode = (uint64_t)info.nFileIndexHigh << 32 | info.nFileIndexLow;
+    out->size = (uint64_t)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+    out->mtime = (int64_t)((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32 |
+        info.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat attribut;
+    if (fstat(fileno(file), &attribut) != 0)
+    {
+        return -1;
+    }
+
+    out->device = (uint64_t)attribut.st_dev;
+    out->inode = (uint64_t)attribut.st_ino;
+    out->size = (uint64_t)attribut.st_size;
+    out->mtime = (int64_t)attribut.st_mtim.tv_sec * 1000000000 + attribut.st_mtim.tv_nsec;
+#endif
+
+    return 0;
+}
+
+int ReadAtomHeader(FILE* mov, uint64_t position, uint64_t end, SAtom* out)
+{
+    uint8_t header[16];
+
+    if (position + 8 > end)
+    {
+        return -2;
+    }
+
+    if (fseeko(mov, (off_t)position, SEEK_SET) != 0 || fread(header, 1, 8, mov) != 8)
+    {
+        return -1;
+    }
+
+    uint64_t size = ReadBigEndian32(header);
+    uint64_t headerSize = 8;
+
+    if (size == 1)
+    {
+        // 64-bit largesize follows the type
+        if (fread(header + 8, 1, 8, mov) != 8)
+        {
+            return -1;
+        }
+        size = ReadBigEndian64(header + 8);
+        headerSize = 16;
+    }
+    else if (size == 0)
+    {
+        // atom extends to the end of its parent
+        size = end - position;
+    }
+
+    if (size < headerSize || size > end - position)
+    {
+        return -2;
+    }
+
+    out->type = ReadBigEndian32(header + 4);
+    out->start = position;
+    out->offset = position + headerSize;
+    out->size = size - headerSize;
+    return 0;
+}
+
+int FindChildAtom(FILE* mov, uint64_t start, uint64_t end, uint32_t type, SAtom* out)
+{
+    uint64_t position = start;
+
+    while (position + 8 <= end)
+    {
+        SAtom atom;
+        int ret = ReadAtomHeader(mov, position, end, &atom);
+        if (ret != 0)
+        {
+            return ret;
+        }
+
+        if (atom.type == type)
+        {
+            *out = atom;
+            return 0;
+        }
+
+        // skip contents of the current atom, which can be gigabytes
+        position = atom.offset + atom.size;
+    }
+
+    return -2;
+}
+
+static bool IsPlausibleType(uint32_t type)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint8_t c = (uint8_t)(type >> shift);
+        if ((c < 0x20 || c > 0x7e) && c != 0xa9)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A 'moov' candidate is accepted if its first child and the atom after it look like atoms */
+static bool IsValidMoov(FILE* mov, uint64_t position, uint64_t fileSize, SAtom* moov)
+{
+    SAtom child;
+    if (ReadAtomHeader(mov, position, fileSize, moov) != 0 ||
+        moov->type != ATOM_TAG('m', 'o', 'o', 'v') ||
+        ReadAtomHeader(mov, moov->offset, moov->offset + moov->size, &child) != 0 ||
+        !IsPlausibleType(child.type))
+    {
+        return false;
+    }
+
+    uint64_t end = moov->offset + moov->size;
+    SAtom next;
+    return end == fileSize ||
+        (ReadAtomHeader(mov, end, fileSize, &next) == 0 && IsPlausibleType(next.type));
+}
+
+/*
+ * Look for a 'moov' header in the last TAIL_SCAN_WINDOW bytes of the file,
+ * at or after 'start'. One read, the last valid match wins.
+ */
+static int FindMoovInTail(FILE* mov, uint64_t start, uint64_t fileSize, SAtom* moov)
+{
+    uint64_t window = fileSize - start < TAIL_SCAN_WINDOW ? fileSize - start : TAIL_SCAN_WINDOW;
+    if (window < 16)
+    {
+        return -2;
+    }
+
+    uint8_t* buffer = malloc(window);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    int ret = -2;
+    if (fseeko(mov, (off_t)(fileSize - window), SEEK_SET) != 0 || fread(buffer, 1, window, mov) != window)
+    {
+        ret = -1;
+    }
+
+    for (uint64_t i = window - 4; ret == -2 && i >= 4; i--)
+    {
+        if (memcmp(buffer + i, "moov", 4) == 0 &&
+            IsValidMoov(mov, fileSize - window + i - 4, fileSize, moov))
+        {
+            ret = 0;
+        }
+    }
+
+    free(buffer);
+    return ret;
+}
+
+/*
+ * Walk at most 'maxAtoms' top-level atoms from '*position' and find 'moov'.
+ * 'skippedLarge' is set if an atom of at least TAIL_SCAN_MIN_SKIP bytes was
+ * stepped over.
+ * @return 0 if found, 1 if 'maxAtoms' atoms were walked, -1 on read error,
+ *         -2 at the end of the file or at an invalid atom
+ */
+static int WalkTopLevel(FILE* mov, uint64_t fileSize, int maxAtoms, uint64_t* position, SAtom* moov,
+    bool* skippedLarge)
+{
+    for (int i = 0; i < maxAtoms; i++)
+    {
+        if (*position + 8 > fileSize)
+        {
+            return -2;
+        }
+
+        int ret = ReadAtomHeader(mov, *position, fileSize, moov);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        if (moov->type == ATOM_TAG('m', 'o', 'o', 'v'))
+        {
+            return 0;
+        }
+
+        if (moov->size >= TAIL_SCAN_MIN_SKIP)
+        {
+            *skippedLarge = true;
+        }
+        *position = moov->offset + moov->size;
+    }
+    return 1;
+}
+
+static bool LookupAtomCache(const SFileIdentity* file, SAtomLocation* out)
+{
+    bool found = false;
+
+    LockMutex(&s_atomCache.lock);
+    for (size_t i = 0; i < s_atomCache.count && !found; i++)
+    {
+        if (memcmp(&s_atomCache.entries[i].file, file, sizeof(*file)) == 0)
+        {
+            *out = s_atomCache.entries[i];
+            found = true;
+        }
+    }
+    UnlockMutex(&s_atomCache.lock);
+
+    return found;
+}
+
+static void StoreAtomCache(const SAtomLocation* location)
+{
+    LockMutex(&s_atomCache.lock);
+    s_atomCache.entries[s_atomCache.next] = *location;
+    s_atomCache.next = (s_atomCache.next + 1) % ATOM_CACHE_SIZE;
+    if (s_atomCache.count < ATOM_CACHE_SIZE)
+    {
+        s_atomCache.count++;
+    }
+    UnlockMutex(&s_atomCache.lock);
+}
+
+/* udta and bmdt below out->moov, 'missing' is set to the path of the first atom not found */
+static int FindBmdtInMoov(FILE* mov, SAtomLocation* out, const char** missing)
+{
+    if (FindChildAtom(mov, out->moov.offset, out->moov.offset + out->moov.size,
+        ATOM_TAG('u', 'd', 't', 'a'), &out->udta) != 0)
+    {
+        *missing = "moov/udta";
+        return -1;
+    }
+
+    if (FindChildAtom(mov, out->udta.offset, out->udta.offset + out->udta.size,
+        ATOM_TAG('b', 'm', 'd', 't'), &out->bmdt) != 0)
+    {
+        *missing = "moov/udta/bmdt";
+        return -1;
+    }
+    return 0;
+}
+
+int LocateBmdt(FILE* mov, SAtomLocation* out)
+{
+    memset(out, 0, sizeof(*out));
+
+    bool identified = GetFileIdentity(mov, &out->file) == 0;
+    if (identified && LookupAtomCache(&out->file, out))
+    {
+        out->cached = true;
+        return 0;
+    }
+
+    uint64_t fileSize = out->file.size;
+    if (!identified)
+    {
+        if (fseeko(mov, 0, SEEK_END) != 0)
+        {
+            perror("Failed to get file size");
+            return -1;
+        }
+        fileSize = (uint64_t)ftello(mov);
+    }
+
+    // the first headers usually lead to moov, the tail is tried once if a large mdat is in the way
+    uint64_t position = 0;
+    bool skippedLarge = false;
+    int ret = WalkTopLevel(mov, fileSize, TOP_LEVEL_PROBE_ATOMS, &position, &out->moov, &skippedLarge);
+    if (ret == 1 && skippedLarge)
+    {
+        out->fromTail = FindMoovInTail(mov, position, fileSize, &out->moov) == 0;
+        ret = out->fromTail ? 0 : 1;
+    }
+    if (ret == 1)
+    {
+        ret = WalkTopLevel(mov, fileSize, INT_MAX, &position, &out->moov, &skippedLarge);
+    }
+
+    const char* missing = "moov";
+    if (ret == 0)
+    {
+        ret = FindBmdtInMoov(mov, out, &missing);
+    }
+    if (ret != 0 && out->fromTail)
+    {
+        // the tail match may be a 'moov' inside the payload of another atom, walk on from the probe
+        out->fromTail = false;
+        memset(&out->udta, 0, sizeof(out->udta));
+        missing = "moov";
+        if (WalkTopLevel(mov, fileSize, INT_MAX, &position, &out->moov, &skippedLarge) == 0)
+        {
+            ret = FindBmdtInMoov(mov, out, &missing);
+        }
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "Failed to find '%s'\n", missing);
+        return -1;
+    }
+
+    if (identified)
+    {
+        StoreAtomCache(out);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file AtomLocator.h
+ * Locating atoms of a MOV/MP4 file, including 64-bit 'largesize' atoms
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Atom type as read from the file in big-endian order, e.g. ATOM_TAG('m', 'o', 'o', 'v') */
+#define ATOM_TAG(c1, c2, c3, c4) \
+    ((uint32_t)(c1) << 24 | (uint32_t)(c2) << 16 | (uint32_t)(c3) << 8 | (uint32_t)(c4))
+
+typedef struct
+{
+    uint32_t type;
+
+    /** Absolute offset of the atom header */
+    uint64_t start;
+
+    /** Absolute offset and size of the atom payload, after the 8 or 16 byte header */
+    uint64_t offset;
+    uint64_t size;
+} SAtom;
+
+/** Identifies a file version: same file, same size, same modification time */
+typedef struct
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+
+    /** Modification time in ns since 1970, FILETIME ticks of 100 ns on Windows */
+    int64_t mtime;
+} SFileIdentity;
+
+typedef struct
+{
+    SFileIdentity file;
+    SAtom moov;
+    SAtom udta;
+    SAtom bmdt;
+
+    /** Taken from the in-process cache, the file was not scanned */
+    bool cached;
+
+    /** 'moov' was found in the last 64 KB of the file, see LocateBmdt() */
+    bool fromTail;
+} SAtomLocation;
+
+int GetFileIdentity(FILE* file, SFileIdentity* out);
+
+/**
+ * Read the atom header at 'position'. Size 1 (64-bit largesize follows) and
+ * size 0 (atom extends to 'end') are resolved.
+ * @return 0 on success, -1 on read error, -2 if the header is invalid or exceeds 'end'
+ */
+int ReadAtomHeader(FILE* mov, uint64_t position, uint64_t end, SAtom* out);
+
+/** Walk the atoms in [start, end) and find the first one of 'type' */
+int FindChildAtom(FILE* mov, uint64_t start, uint64_t end, uint32_t type, SAtom* out);
+
+/**
+ * Locate moov/udta/bmdt. The top-level atoms are walked from the start of
+ * the file, one 8 or 16 byte header each; 'moov' after 'mdat', where Vuze
+ * cameras put it, takes three reads. Only if the first three atoms did not
+ * lead to 'moov' and a large one (mdat) was stepped over, the last 64 KB of
+ * the file are read once for a small 'moov' before the walk goes on. The
+ * moov of a Vuze file holds the bmdt, tens of MB per hour of IMU, and is
+ * never found there. Results are cached per file identity, a second query
+ * on an unchanged file does not touch the file.
+ * @return 0 on success, -1 if not found (reported to stderr)
+ */
+int LocateBmdt(FILE* mov, SAtomLocation* out);
@@ -0,0 +1,236 @@
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+# Reproducible ExtractMetadata measurements on synthetic movies: decode throughput,
+# I/O calls and peak RSS per parser (--benchmark), and wall time of full extractions.
+# The movies are written by SyntheticMovie.py in its own process: under Linux a child
+# inherits the RSS high-water mark of this process, which must stay small for that.
+
+# line printed by SyntheticMovie.py
+GENERATED_LINE = re.compile(r"^.*: (\d+) bytes, bmdt (\d+) bytes")
+
+# line printed per parser by ExtractMetadata --benchmark
+BENCHMARK_LINE = re.compile(r"^(\w+)\s*: (\d+) packets in ([\d.]+) s, (\d+) packets/s, ([\d.]+) MB/s, "
+                            r"([-\d.]+) I/O calls/iteration, peak RSS (-?\d+) kB")
+
+PARSER_MODES = ("stdio", "mmap", "index")
+
+# ExtractMetadata options of the full extraction runs
+EXTRACTION_MODES = {
+    "csv": [],
+    "columnar": ["--format", "columnar"],
+    "columnar+mmap": ["--format", "columnar", "--mmap"],
+    "frames": ["--format", "columnar", "--mmap", "--frames", "--orientation"],
+}
+
+def MakeScenarios(packets, huge):
+    """(name, SyntheticMovie.py options) of the generated movies"""
+
+    # rates of a Vuze XR recording: IMU far ahead of IQ, geo and temperature
+    common = ["--imu", str(packets), "--geo", str(packets // 1000), "--iq", str(packets // 33),
+              "--temperature", str(packets // 1000), "--duration-s", str(packets / 1000.0)]
+    mdat = ["--mdat-size", str(64 << 20)]
+    scenarios = [
+        ("moov-last", common + mdat),
+        ("moov-first", common + mdat + ["--order", "ftyp,moov,mdat"]),
+        ("corrupt-1%", common + mdat + ["--corrupt", str(packets // 100)]),
+        ("two-sources", common + mdat + ["--sources", "2"]),
+    ]
+    if huge:
+        # sparse where the file system allows, else 5 GB are written
+        scenarios.append(("mdat-5GB", common + ["--mdat-size", str(5 << 30)]))
+    return scenarios
+
+def GenerateMovie(movie, options):
+    """Writes 'movie' with SyntheticMovie.py, returns (movie bytes, bmdt bytes)"""
+
+    generator = os.path.join(os.path.dirname(os.path.abspath(__file__)), "SyntheticMovie.py")
+    output = subprocess.run([sys.executable, generator, movie] + options, stdout=subprocess.PIPE,
+                            universal_newlines=True, check=True).stdout
+    match = GENERATED_LINE.match(output)
+    return int(match.group(1)), int(match.group(2))
+
+def RunProcess(command, capture=True):
+    """(exit code, stdout or None, wall seconds, peak RSS in kB or None) of 'command'"""
+
+    start = time.perf_counter()
+    if not hasattr(os, "posix_spawn"):
+        process = subprocess.run(command, stdout=subprocess.PIPE if capture else subprocess.DEVNULL,
+                                 stderr=subprocess.DEVNULL, universal_newlines=True)
+        return process.returncode, process.stdout, time.perf_counter() - start, None
+
+    # posix_spawn does not copy the address space of this process like fork,
+    # the CSV on stdout of a full extraction is dropped for the same reason
+    read_end, write_end = os.pipe() if capture else (None, None)
+    devnull = os.open(os.devnull, os.O_WRONLY)
+    try:
+        actions = [(os.POSIX_SPAWN_DUP2, write_end if capture else devnull, 1), (os.POSIX_SPAWN_DUP2, devnull, 2)]
+        if capture:
+            actions.append((os.POSIX_SPAWN_CLOSE, read_end))
+        pid = os.posix_spawn(command[0], command, os.environ, file_actions=actions)
+    finally:
+        if capture:
+            os.close(write_end)
+        os.close(devnull)
+    output = None
+    if capture:
+        with os.fdopen(read_end) as f:
+            output = f.read()
+
+    _, status, usage = os.wait4(pid, 0)
+    returncode = os.waitstatus_to_exitcode(status) if hasattr(os, "waitstatus_to_exitcode") else status
+    peak_rss_kb = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+    return returncode, output, time.perf_counter() - start, peak_rss_kb
+
+def CountSyscalls(command):
+    """System calls of 'command' by strace -c, None without strace"""
+
+    strace = shutil.which("strace")
+    if strace is None:
+        return None
+
+    with tempfile.NamedTemporaryFile(suffix=".txt", delete=False) as summary:
+        path = summary.name
+    try:
+        subprocess.run([strace, "-f", "-c", "-o", path] + command, stdout=subprocess.DEVNULL,
+                       stderr=subprocess.DEVNULL)
+        with open(path) as f:
+            totals = [line.split() for line in f if line.rstrip().endswith("total")]
+        return int(totals[-1][2]) if totals else None
+    finally:
+        os.remove(path)
+
+def BenchmarkParsers(extract_metadata, movie, iterations):
+    """ExtractMetadata --benchmark, one process per parser so that each gets its own peak RSS"""
+
+    results = []
+    for mode in PARSER_MODES:
+        ret, output, _, _ = RunProcess([extract_metadata, "--benchmark", str(iterations), "--benchmark-mode", mode,
+                                        movie])
+        match = next((BENCHMARK_LINE.match(line) for line in output.splitlines() if BENCHMARK_LINE.match(line)), None)
+        if ret != 0 or match is None:
+            results.append({"mode": mode, "error": ret})
+            continue
+        results.append({
+            "mode": mode,
+            "packets_per_second": int(match.group(4)),
+            "mb_per_second": float(match.group(5)),
+            "io_calls_per_decode": float(match.group(6)),
+            "peak_rss_kb": int(match.group(7)),
+        })
+    return results
+
+def BenchmarkExtractions(extract_metadata, movie):
+    """Full ExtractMetadata runs with their output files, wall time, peak RSS and system calls"""
+
+    results = []
+    for mode, options in EXTRACTION_MODES.items():
+        command = [extract_metadata] + options + [movie]
+        ret, _, elapsed, peak_rss_kb = RunProcess(command, capture=False)
+        results.append({
+            "mode": mode,
+            "seconds": elapsed if ret == 0 else None,
+            "peak_rss_kb": peak_rss_kb,
+            "syscalls": CountSyscalls(command),
+            "error": ret if ret != 0 else None,
+        })
+    return results
+
+def PrintResults(name, movie_bytes, bmdt_bytes, parsers, extractions):
+
+    print("%s: movie %.1f MB, bmdt %.1f MB" %(name, movie_bytes / 1e6, bmdt_bytes / 1e6))
+    for result in parsers:
+        if "error" in result:
+            print("  decode %-14s FAILED (%s)" %(result["mode"], result["error"]))
+            continue
+        print("  decode %-14s %10.0f packets/s %8.1f MB/s %10.1f I/O calls %8d kB peak RSS" %(
+            result["mode"], result["packets_per_second"], result["mb_per_second"], result["io_calls_per_decode"],
+            result["peak_rss_kb"]))
+    for result in extractions:
+        if result["error"] is not None:
+            print("  extract %-13s FAILED (%s)" %(result["mode"], result["error"]))
+            continue
+        print("  extract %-13s %8.3f s %21s %10s syscalls %8s kB peak RSS" %(
+            result["mode"], result["seconds"], "",
+            result["syscalls"] if result["syscalls"] is not None else "n/a",
+            result["peak_rss_kb"] if result["peak_rss_kb"] is not None else "n/a"))
+
+def PrintUsage():
+
+    print("Usage: python BenchmarkExtraction.py EXTRACT_METADATA [--packets N] [--iterations N] [--work-dir DIR]")
+    print("                                     [--huge] [--json FILE]")
+    print("  EXTRACT_METADATA  the ExtractMetadata executable, see HowToCompile.txt")
+    print("  --packets N       IMU packets per movie (default 1000000), other types at Vuze XR ratios")
+    print("  --iterations N    decodes per parser (default 5)")
+    print("  --work-dir DIR    keep the movies and outputs in DIR instead of a temporary directory")
+    print("  --huge            also a movie with a 5 GB mdat (64-bit atom size)")
+    print("  --json FILE       also write the results to FILE")
+    print("I/O calls are counted by the process itself (Linux /proc/self/io, Windows I/O operations),")
+    print("system calls of full extractions need strace")
+
+def main():
+
+    args = sys.argv[1:]
+    if not args or args[0].startswith("-"):
+        PrintUsage()
+        return -1
+
+    extract_metadata = os.path.abspath(args[0])
+    packets = 1000000
+    iterations = 5
+    work_dir = None
+    huge = False
+    json_path = None
+
+    i = 1
+    while i < len(args):
+        if args[i] == "--packets" and i + 1 < len(args):
+            i += 1
+            packets = int(args[i])
+        elif args[i] == "--iterations" and i + 1 < len(args):
+            i += 1
+            iterations = int(args[i])
+        elif args[i] == "--work-dir" and i + 1 < len(args):
+            i += 1
+            work_dir = args[i]
+        elif args[i] == "--huge":
+            huge = True
+        elif args[i] == "--json" and i + 1 < len(args):
+            i += 1
+            json_path = args[i]
+        else:
+            PrintUsage()
+            return -1
+        i += 1
+
+    directory = work_dir if work_dir is not None else tempfile.mkdtemp(prefix="vuze_benchmark_")
+    os.makedirs(directory, exist_ok=True)
+    report = []
+    try:
+        for name, options in MakeScenarios(packets, huge):
+            movie = os.path.join(directory, name + ".mov")
+            movie_bytes, bmdt_bytes = GenerateMovie(movie, options)
+
+            parsers = BenchmarkParsers(extract_metadata, movie, iterations)
+            extractions = BenchmarkExtractions(extract_metadata, movie)
+            PrintResults(name, movie_bytes, bmdt_bytes, parsers, extractions)
+            report.append({"scenario": name, "movie_bytes": movie_bytes, "bmdt_bytes": bmdt_bytes,
+                           "parsers": parsers, "extractions": extractions})
+    finally:
+        if work_dir is None:
+            shutil.rmtree(directory, ignore_errors=True)
+
+    if json_path is not None:
+        with open(json_path, "w") as f:
+            json.dump(report, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,269 @@
+/**
+ * @file ColumnarWriter.c
+ * Fixed-width struct-of-arrays output files for metadata streams
+ */
+
+// Instruct GCC to use 64-bit off_t/fseeko/ftello, which is not the default on MinGW
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ColumnarWriter.h"
+#include "LargeFile.h"
+
+_Static_assert(sizeof(SColumnarFileHeader) == 64, "columnar file header must be 64 bytes");
+_Static_assert(sizeof(SColumnarColumnHeader) == 48, "columnar column header must be 48 bytes");
+
+static uint64_t AlignUp(uint64_t value)
+{
+    return (value + COLUMNAR_ALIGNMENT - 1) / COLUMNAR_ALIGNMENT * COLUMNAR_ALIGNMENT;
+}
+
+int ColumnarOpen(SColumnarWriter* writer, const char* path, const char* stream, SFraction fps,
+    uint32_t rollingShutterSkewTimeUs)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    memcpy(writer->header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+    writer->header.version = COLUMNAR_VERSION;
+    strncpy(writer->header.stream, stream, sizeof(writer->header.stream) - 1);
+    writer->header.fps = fps;
+    writer->header.rollingShutterSkewTimeUs = rollingShutterSkewTimeUs;
+    return 0;
+}
+
+int ColumnarAddColumn(SColumnarWriter* writer, const char* name, const char* dtype,
+    uint32_t itemSize, size_t rowOffset)
+{
+    if (writer->header.columnCount == COLUMNAR_MAX_COLUMNS || writer->header.rowCount != 0)
+    {
+        fprintf(stderr, "Cannot add column '%s'!\n", name);
+        return -1;
+    }
+
+    SColumn* column = &writer->columns[writer->header.columnCount];
+    column->data = malloc((size_t)COLUMNAR_CHUNK_ROWS * itemSize);
+    if (column->data == NULL)
+    {
+        perror("Failed to allocate column");
+        return -1;
+    }
+
+    writer->header.columnCount++;
+    strncpy(column->header.name, name, sizeof(column->header.name) - 1);
+    strncpy(column->header.dtype, dtype, sizeof(column->header.dtype) - 1);
+    column->header.itemSize = itemSize;
+    column->rowOffset = rowOffset;
+    column->chunkOffset = writer->chunkSize;
+    writer->chunkSize += (uint64_t)COLUMNAR_CHUNK_ROWS * itemSize;
+    return 0;
+}
+
+/* Write the full column buffers to the temporary file as the next chunk */
+static int WriteChunk(SColumnarWriter* writer)
+{
+    if (writer->chunks == NULL)
+    {
+        writer->chunks = tmpfile();
+        if (writer->chunks == NULL)
+        {
+            perror("Failed to create a temporary file for the columns");
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < writer->header.columnCount; i++)
+    {
+        size_t bytes = (size_t)COLUMNAR_CHUNK_ROWS * writer->columns[i].header.itemSize;
+        if (fwrite(writer->columns[i].data, 1, bytes, writer->chunks) != bytes)
+        {
+            perror("Failed to write the temporary file of the columns");
+            return -1;
+        }
+    }
+    writer->chunkCount++;
+    writer->bufferedRows = 0;
+    return 0;
+}
+
+int ColumnarAppendRow(SColumnarWriter* writer, const void* row)
+{
+    return ColumnarAppendRows(writer, row, 1, 0);
+}
+
+/* Scatter rows that fit into the column buffers */
+static void BufferRows(SColumnarWriter* writer, const void* rows, size_t count, size_t rowSize)
+{
+    for (uint32_t i = 0; i < writer->header.columnCount; i++)
+    {
+        SColumn* column = &writer->columns[i];
+        size_t itemSize = column->header.itemSize;
+
+        // one column at a time, the compiler turns the fixed-size copies into plain loads and stores
+        uint8_t* dst = column->data + writer->bufferedRows * itemSize;
+        const uint8_t* src = (const uint8_t*)rows + column->rowOffset;
+        switch (itemSize)
+        {
+        case 1:
+            for (size_t row = 0; row < count; row++)
+            {
+                dst[row] = src[row * rowSize];
+            }
+            break;
+        case 2:
+            for (size_t row = 0; row < count; row++)
+            {
+                memcpy(dst + row * 2, src + row * rowSize, 2);
+            }
+            break;
+        case 4:
+            for (size_t row = 0; row < count; row++)
+            {
+                memcpy(dst + row * 4, src + row * rowSize, 4);
+            }
+            break;
+        case 8:
+            for (size_t row = 0; row < count; row++)
+            {
+                memcpy(dst + row * 8, src + row * rowSize, 8);
+            }
+            break;
+        default:
+            for (size_t row = 0; row < count; row++)
+            {
+                memcpy(dst + row * itemSize, src + row * rowSize, itemSize);
+            }
+            break;
+        }
+    }
+    writer->bufferedRows += count;
+}
+
+int ColumnarAppendRows(SColumnarWriter* writer, const void* rows, size_t count, size_t rowSize)
+{
+    const uint8_t* next = rows;
+    while (count > 0)
+    {
+        size_t room = COLUMNAR_CHUNK_ROWS - writer->bufferedRows;
+        size_t part = count < room ? count : room;
+        BufferRows(writer, next, part, rowSize);
+        writer->header.rowCount += part;
+        next += part * rowSize;
+        count -= part;
+
+        if (writer->bufferedRows == COLUMNAR_CHUNK_ROWS && WriteChunk(writer) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Copy the chunks of 'column' from the temporary file to the output, then its buffered rows */
+static int WriteColumn(SColumnarWriter* writer, const SColumn* column, uint8_t* copy)
+{
+    size_t bytes = (size_t)COLUMNAR_CHUNK_ROWS * column->header.itemSize;
+    for (uint64_t chunk = 0; chunk < writer->chunkCount; chunk++)
+    {
+        if (fseeko(writer->chunks, (off_t)(chunk * writer->chunkSize + column->chunkOffset), SEEK_SET) != 0 ||
+            fread(copy, 1, bytes, writer->chunks) != bytes ||
+            fwrite(copy, 1, bytes, writer->file) != bytes)
+        {
+            return -1;
+        }
+    }
+
+    bytes = writer->bufferedRows * column->header.itemSize;
+    return fwrite(column->data, 1, bytes, writer->file) == bytes ? 0 : -1;
+}
+
+int ColumnarClose(SColumnarWriter* writer)
+{
+    int ret = 0;
+    SColumnarFileHeader* header = &writer->header;
+
+    uint64_t offset = AlignUp(sizeof(SColumnarFileHeader) +
+        header->columnCount * sizeof(SColumnarColumnHeader));
+    for (uint32_t i = 0; i < header->columnCount; i++)
+    {
+        writer->columns[i].header.offset = offset;
+        offset = AlignUp(offset + header->rowCount * writer->columns[i].header.itemSize);
+    }
+
+    if (fwrite(header, sizeof(*header), 1, writer->file) != 1)
+    {
+        ret = -1;
+    }
+
+    for (uint32_t i = 0; ret == 0 && i < header->columnCount; i++)
+    {
+        if (fwrite(&writer->columns[i].header, sizeof(SColumnarColumnHeader), 1, writer->file) != 1)
+        {
+            ret = -1;
+        }
+    }
+
+    // the chunks are copied through one buffer, as large as a chunk of the widest column
+    uint8_t* copy = NULL;
+    if (writer->chunkCount > 0)
+    {
+        uint32_t itemSize = 0;
+        for (uint32_t i = 0; i < header->columnCount; i++)
+        {
+            if (writer->columns[i].header.itemSize > itemSize)
+            {
+                itemSize = writer->columns[i].header.itemSize;
+            }
+        }
+        copy = malloc((size_t)COLUMNAR_CHUNK_ROWS * itemSize);
+        if (copy == NULL)
+        {
+            ret = -1;
+        }
+    }
+
+    static const uint8_t padding[COLUMNAR_ALIGNMENT] = { 0 };
+    uint64_t position = sizeof(SColumnarFileHeader) + header->columnCount * sizeof(SColumnarColumnHeader);
+    for (uint32_t i = 0; ret == 0 && i < header->columnCount; i++)
+    {
+        SColumn* column = &writer->columns[i];
+        size_t gap = (size_t)(column->header.offset - position);
+
+        if (fwrite(padding, 1, gap, writer->file) != gap || WriteColumn(writer, column, copy) != 0)
+        {
+            ret = -1;
+        }
+        position = column->header.offset + header->rowCount * column->header.itemSize;
+    }
+    free(copy);
+
+    if (ret != 0)
+    {
+        perror("Failed to write columnar file");
+    }
+
+    if (fclose(writer->file) != 0)
+    {
+        ret = -1;
+    }
+
+    if (writer->chunks != NULL)
+    {
+        fclose(writer->chunks);
+    }
+    for (uint32_t i = 0; i < header->columnCount; i++)
+    {
+        free(writer->columns[i].data);
+    }
+    memset(writer, 0, sizeof(*writer));
+
+    return ret;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file ColumnarWriter.h
+ * Fixed-width struct-of-arrays output files for metadata streams
+ *
+ * File layout, all little-endian:
+ *   SColumnarFileHeader                         (64 bytes)
+ *   SColumnarColumnHeader[columnCount]          (48 bytes each)
+ *   column data, each column 64-byte aligned, rowCount * itemSize bytes
+ *
+ * Every column is a plain array that can be opened with np.memmap using the
+ * numpy type string stored in its header, see VuzeColumnar.py.
+ *
+ * The row count is only known at the end, rows are buffered per column
+ * COLUMNAR_CHUNK_ROWS at a time and full chunks go to an anonymous temporary
+ * file, column after column. ColumnarClose() copies the chunks of each column
+ * into place. The memory used does not depend on the number of rows.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "MetadataFormat.h"
+
+#define COLUMNAR_MAGIC "VZCOLS1"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_MAX_COLUMNS 24
+#define COLUMNAR_ALIGNMENT 64
+
+/** Rows buffered per column before they are written to the temporary file */
+#define COLUMNAR_CHUNK_ROWS 8192
+
+#pragma pack(push, 1)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t rowCount;
+
+    /** Stream name, e.g. "imu" */
+    char stream[16];
+
+    /** Copied from SMetadataHeader */
+    SFraction fps;
+    uint32_t rollingShutterSkewTimeUs;
+
+    uint8_t reserved[12];
+} SColumnarFileHeader;
+
+typedef struct
+{
+    char name[24];
+
+    /** numpy array-protocol type string, e.g. "<f4" */
+    char dtype[8];
+
+    uint32_t itemSize;
+    uint32_t reserved;
+
+    /** Absolute file offset of the first value */
+    uint64_t offset;
+} SColumnarColumnHeader;
+
+#pragma pack(pop)
+
+typedef struct
+{
+    SColumnarColumnHeader header;
+
+    /** Offset of the value inside the row struct passed to ColumnarAppendRow() */
+    size_t rowOffset;
+
+    /** COLUMNAR_CHUNK_ROWS values, the first 'bufferedRows' of the writer are used */
+    uint8_t* data;
+
+    /** Offset of the column in a chunk of the temporary file, COLUMNAR_CHUNK_ROWS * item sizes before it */
+    uint64_t chunkOffset;
+} SColumn;
+
+typedef struct
+{
+    FILE* file;
+    SColumnarFileHeader header;
+    SColumn columns[COLUMNAR_MAX_COLUMNS];
+
+    /** Rows in the column buffers, the rows before them are in 'chunks' */
+    size_t bufferedRows;
+
+    /** Full chunks, one after the other, created with the first one */
+    FILE* chunks;
+    uint64_t chunkCount;
+    uint64_t chunkSize;
+} SColumnarWriter;
+
+/** Create the output file, columns are added before the first row */
+int ColumnarOpen(SColumnarWriter* writer, const char* path, const char* stream, SFraction fps,
+    uint32_t rollingShutterSkewTimeUs);
+
+/** Add a column fed from 'rowOffset' of the row struct */
+int ColumnarAddColumn(SColumnarWriter* writer, const char* name, const char* dtype,
+    uint32_t itemSize, size_t rowOffset);
+
+/** Scatter one row struct into the columns */
+int ColumnarAppendRow(SColumnarWriter* writer, const void* row);
+
+/** Scatter an array of 'count' row structs of 'rowSize' bytes each into the columns */
+int ColumnarAppendRows(SColumnarWriter* writer, const void* rows, size_t count, size_t rowSize);
+
+/** Write header and columns, close the file and release the buffers */
+int ColumnarClose(SColumnarWriter* writer);
@@ -13,443 +13,2102 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <time.h>
+
+#include "ColumnarWriter.h"
+#include "FrameAggregator.h"
+#include "GyroIntegrator.h"
+#include "MetadataFollower.h"
+#include "OrientationFilter.h"
+#include "Profiler.h"
+#include "QuaternionTrack.h"
+#include "SourceDemux.h"
+#include "TextWriter.h"
+#include "Threads.h"
+#include "VuzeMetadata.h"
 
-#include "MetadataFormat.h"
-
-_Static_assert(sizeof(off_t) > 4, "off_t must be greater than 32 bits to fseek over 2 GB");
-
-// MOV/MP4 uses big-endian a.k.a. network byte order.
-// This header provides htonl() and ntohl() for host<->network conversions.
 #if _WIN32
-#include <winsock2.h>
+#include <direct.h>
+#include <windows.h>
+#include <psapi.h>
+#define PATH_SEPARATOR '\\'
+#define MakeDirectory(path) _mkdir(path)
+#ifndef S_ISDIR
+#define S_ISDIR(mode) (((mode) & S_IFMT) == S_IFDIR)
+#endif
 #else
-#include <arpa/inet.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#define PATH_SEPARATOR '/'
+#define MakeDirectory(path) mkdir(path, 0777)
 #endif
 
-#define MAKE_TAG(c1, c2, c3, c4) htonl((c1) << 24 | (c2) << 16 | (c3) << 8 | (c4))
+#define MAX_PATH_LENGTH 1024
 
 typedef struct
 {
-    uint32_t size;
-    uint32_t type;
-} AtomHeader;
+    /** CSV file receiving IMU rows, NULL if not written, and its buffered writer */
+    FILE* csv_file;
+    STextWriter csv;
+
+    /** Buffered packet lines on stdout, flushed before anything else is printed */
+    STextWriter out;
+
+    /** Count packets only, without any formatting (--benchmark) */
+    bool quiet;
+
+    /** One of several movies extracted concurrently: packets go to the output files only, not to stdout */
+    bool batch;
+
+    /** Number of packets decoded so far */
+    uint64_t packetCount;
+
+    /** Write one columnar file per packet type instead of text (--format columnar) */
+    bool columnar;
+
+    /** Output directory and movie name the columnar files are named after */
+    const char* out_dir;
+    const char* name;
+
+    /** Columnar writers by packet type, opened once the bmdt header is known */
+    SColumnarWriter columns[PACKET_TYPE_COUNT];
+
+    /** Aggregate IMU packets per video frame into frames_<name>.csv/.vzc (--frames) */
+    bool frames;
+    SFrameAggregator aggregator;
+    FILE* frames_file;
+    SColumnarWriter frameColumns;
+
+    /** Integrate the gyro into one orientation per video frame, orientation_<name>.csv/.vzc (--orientation) */
+    bool orientation;
+    double gyroScale;
+    uint64_t gyroBiasUs;
+    SGyroIntegrator gyro;
+    FILE* orientation_file;
+    SColumnarWriter orientationColumns;
+
+    /** Fuse accel and gyro into orientations at 'fusionRateHz', fusion_<name>.vzq (--fusion) */
+    uint32_t fusionRateHz;
+    double fusionGain;
+    SOrientationFilter fusion;
+    SQuaternionTrackWriter fusionTrack;
+
+    /** Timers and counters of this movie (--profile), NULL if not profiled */
+    SProfile* profile;
+    uint32_t firstFrame;
+    uint32_t lastFrame;
+
+    /** Decode the movie while it is being written, until it stops growing for 'followTimeoutMs' (--follow) */
+    bool follow;
+    unsigned followTimeoutMs;
+
+    /** Corrupt packets are resynchronized, their length fields are not what is skipped (--resync) */
+    bool resync;
+
+    /**
+     * One CSV or columnar file per packet type and dataSourceId instead of imu_<name>.csv
+     * or <type>_<name>.vzc, opened with the bmdt header and 'floats' on the first packet (--split-sources)
+     */
+    bool splitSources;
+    SSourceDemux demux;
+    SMetadataHeader metaHeader;
+    ETextFloats floats;
+} SPrintContext;
+
+/** Rows of the columnar files: the packet as stored in bmdt plus its frame index, e.g. SImuRow */
+#define COLUMNAR_ROW(typeId, Name, title, stream) typedef struct { S##Name##Packet packet; uint32_t frame; } S##Name##Row;
+METADATA_PACKET_TYPES(COLUMNAR_ROW)
+#undef COLUMNAR_ROW
+
+#define COLUMNAR_STREAM_NAME(typeId, Name, title, stream) [typeId] = stream,
+static const char* const COLUMNAR_STREAM_NAMES[PACKET_TYPE_COUNT] = { METADATA_PACKET_TYPES(COLUMNAR_STREAM_NAME) };
+#undef COLUMNAR_STREAM_NAME
+
+void WriteToCSVFile(STextWriter* csv, uint32_t frame_number, const SImuPacket* imu_packet);
+
+static int OpenColumnarOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader);
+static int OpenFramesOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader);
+static int OpenOrientationOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader);
+static int OpenFusionOutput(SPrintContext* ctx);
+
+static void WriteCsvRow(SPrintContext* ctx, uint32_t encFrameIdx, const SImuPacket* packet)
+{
+    SProfileMark mark;
+    ProfileBegin(ctx->profile, PROFILE_WRITE_CSV, &mark);
+    WriteToCSVFile(&ctx->csv, encFrameIdx, packet);
+    ProfileEnd(ctx->profile, PROFILE_WRITE_CSV, &mark);
+}
+
+/** Header lines of the --split-sources CSV files, IMU as in InitCSVFile() */
+static const char* const SOURCE_CSV_HEADERS[PACKET_TYPE_COUNT] =
+{
+    [PACKET_TYPE_IMU] = "FrameNumber, Timestamp[s], Timestamp[s], xAccel, yAccel, zAccel, xGyro, yGyro, zGyro",
+    [PACKET_TYPE_GEO] = "FrameNumber, Timestamp[s], Timestamp[s], Latitude, Longitude, Altitude",
+    [PACKET_TYPE_IQ] = "FrameNumber, Timestamp[s], Timestamp[s], ISO, ShutterTime, MaxShutterTime, RedGain, GreenGain, BlueGain",
+    [PACKET_TYPE_TEMPERATURE] = "FrameNumber, Timestamp[s], Timestamp[s], Temperature",
+};
+
+/* Row start of the --split-sources CSV files, laid out like WriteToCSVFile() */
+static void WriteCsvTimestamps(STextWriter* csv, uint32_t frame, uint64_t relTsUs)
+{
+    TEXT_LITERAL(csv, "\n");
+    TextUInt(csv, frame);
+    TEXT_LITERAL(csv, ", ");
+    TextUInt(csv, relTsUs);
+    TEXT_LITERAL(csv, ", ");
+    TextFloat(csv, (float)relTsUs / 1000000.0f, 6);
+}
+
+static void WriteImuCsv(STextWriter* csv, uint32_t frame, const SImuPacket* packet)
+{
+    WriteToCSVFile(csv, frame, packet);
+}
+
+static void WriteGeoCsv(STextWriter* csv, uint32_t frame, const SGeoPacket* packet)
+{
+    WriteCsvTimestamps(csv, frame, packet->header.relTsUs);
+    TEXT_LITERAL(csv, ", ");
+    TextDouble(csv, packet->latitude, 6);
+    TEXT_LITERAL(csv, ", ");
+    TextDouble(csv, packet->longitude, 6);
+    TEXT_LITERAL(csv, ", ");
+    TextDouble(csv, packet->altitude, 3);
+}
+
+static void WriteIqCsv(STextWriter* csv, uint32_t frame, const SIqPacket* packet)
+{
+    WriteCsvTimestamps(csv, frame, packet->header.relTsUs);
+    TEXT_LITERAL(csv, ", ");
+    TextUInt(csv, packet->iso);
+    TEXT_LITERAL(csv, ", ");
+    TextFloat(csv, packet->shutterTime, 8);
+    TEXT_LITERAL(csv, ", ");
+    TextFloat(csv, packet->maxShutterTime, 8);
+    TEXT_LITERAL(csv, ", ");
+    TextUInt(csv, packet->redGain);
+    TEXT_LITERAL(csv, ", ");
+    TextUInt(csv, packet->greenGain);
+    TEXT_LITERAL(csv, ", ");
+    TextUInt(csv, packet->blueGain);
+}
+
+static void WriteTemperatureCsv(STextWriter* csv, uint32_t frame, const STemperaturePacket* packet)
+{
+    WriteCsvTimestamps(csv, frame, packet->header.relTsUs);
+    TEXT_LITERAL(csv, ", ");
+    TextFloat(csv, packet->temperature, 6);
+}
+
+/* Write<Name>Stream(): a packet to the file of its type and dataSourceId (--split-sources) */
+#define WRITE_SOURCE_STREAM(typeId, Name, title, stream) \
+    static int Write##Name##Stream(SPrintContext* ctx, const S##Name##Packet* packet, uint32_t encFrameIdx) \
+    { \
+        SDemuxStream* out = GetDemuxStream(&ctx->demux, typeId, packet->header.dataSourceId); \
+        if (out == NULL) \
+        { \
+            return -1; \
+        } \
+        out->rows++; \
+        if (ctx->columnar) \
+        { \
+            S##Name##Row row = { *packet, encFrameIdx }; \
+            return ColumnarAppendRow(&out->columns, &row); \
+        } \
+        SProfileMark mark; \
+        ProfileBegin(ctx->profile, PROFILE_WRITE_CSV, &mark); \
+        Write##Name##Csv(&out->text, encFrameIdx, packet); \
+        ProfileEnd(ctx->profile, PROFILE_WRITE_CSV, &mark); \
+        return 0; \
+    }
 
-static int ReadAtomHeader(FILE* mov, AtomHeader* out)
+METADATA_PACKET_TYPES(WRITE_SOURCE_STREAM)
+#undef WRITE_SOURCE_STREAM
+
+static int PrintMetadataHeader(void* context, const SMetadataHeader* metaHeader)
 {
-    if (fread(out, 1, sizeof(AtomHeader), mov) != sizeof(AtomHeader))
+    SPrintContext* ctx = context;
+    ctx->metaHeader = *metaHeader;
+    if (ctx->columnar && !ctx->splitSources && OpenColumnarOutput(ctx, metaHeader) != 0)
+    {
+        return -1;
+    }
+    if (ctx->frames && OpenFramesOutput(ctx, metaHeader) != 0)
+    {
+        return -1;
+    }
+    if (ctx->orientation && OpenOrientationOutput(ctx, metaHeader) != 0)
+    {
+        return -1;
+    }
+    if (ctx->fusionRateHz != 0 && OpenFusionOutput(ctx) != 0)
     {
         return -1;
     }
 
-    uint32_t fullSize = ntohl(out->size);
-    if (fullSize < sizeof(AtomHeader))
+    if (ctx->quiet || ctx->batch)
     {
-        return -2;
+        return 0;
     }
 
-    out->size = fullSize - sizeof(AtomHeader);
+    STextWriter* out = &ctx->out;
+    TEXT_LITERAL(out, "fps=");
+    TextUInt(out, metaHeader->fps.num);
+    TEXT_LITERAL(out, "/");
+    TextUInt(out, metaHeader->fps.den);
+    TEXT_LITERAL(out, ",formatVersion=");
+    TextUInt(out, metaHeader->formatVersion);
+    TEXT_LITERAL(out, ", skewTimeUs=");
+    TextUInt(out, metaHeader->rollingShutterSkewTimeUs);
+    TEXT_LITERAL(out, "\n");
+    return 0;
+}
+
+static int PrintImuPacket(void* context, const SImuPacket* packet, uint32_t encFrameIdx)
+{
+    SPrintContext* ctx = context;
+    ctx->packetCount++;
+    if (ctx->frames && AddImuSample(&ctx->aggregator, packet, encFrameIdx) != 0)
+    {
+        return -1;
+    }
+    if (ctx->orientation && AddGyroSample(&ctx->gyro, packet, encFrameIdx) != 0)
+    {
+        return -1;
+    }
+    if (ctx->fusionRateHz != 0 && AddFusionSample(&ctx->fusion, packet) != 0)
+    {
+        return -1;
+    }
+    if (ctx->splitSources)
+    {
+        int ret = WriteImuStream(ctx, packet, encFrameIdx);
+        if (ret != 0 || ctx->columnar || ctx->batch)
+        {
+            return ret;
+        }
+    }
+    else if (ctx->columnar)
+    {
+        SImuRow row = { *packet, encFrameIdx };
+        return ColumnarAppendRow(&ctx->columns[PACKET_TYPE_IMU], &row);
+    }
+    if (ctx->quiet)
+    {
+        return 0;
+    }
+    if (ctx->batch)
+    {
+        WriteCsvRow(ctx, encFrameIdx, packet);
+        return 0;
+    }
 
+    // "%" PRIu64 ",frm=%u,Imu%u,xAccel=%f,yAccel=%f,zAccel=%f,xGyro=%f,yGyro=%f,zGyro=%f\n"
+    STextWriter* out = &ctx->out;
+    TextUInt(out, packet->header.relTsUs);
+    TEXT_LITERAL(out, ",frm=");
+    TextUInt(out, encFrameIdx);
+    TEXT_LITERAL(out, ",Imu");
+    TextUInt(out, packet->header.dataSourceId);
+    TEXT_LITERAL(out, ",xAccel=");
+    TextFloat(out, packet->accel[0], 6);
+    TEXT_LITERAL(out, ",yAccel=");
+    TextFloat(out, packet->accel[1], 6);
+    TEXT_LITERAL(out, ",zAccel=");
+    TextFloat(out, packet->accel[2], 6);
+    TEXT_LITERAL(out, ",xGyro=");
+    TextFloat(out, packet->gyro[0], 6);
+    TEXT_LITERAL(out, ",yGyro=");
+    TextFloat(out, packet->gyro[1], 6);
+    TEXT_LITERAL(out, ",zGyro=");
+    TextFloat(out, packet->gyro[2], 6);
+    TEXT_LITERAL(out, "\n");
+
+    // write those data to csv file
+    if (!ctx->splitSources)
+    {
+        WriteCsvRow(ctx, encFrameIdx, packet);
+    }
     return 0;
 }
 
-static int Perror(FILE* mov, const char* str)
+static int PrintGeoPacket(void* context, const SGeoPacket* packet, uint32_t encFrameIdx)
 {
-    if (feof(mov))
+    SPrintContext* ctx = context;
+    ctx->packetCount++;
+    if (ctx->splitSources)
+    {
+        int ret = WriteGeoStream(ctx, packet, encFrameIdx);
+        if (ret != 0 || ctx->columnar)
+        {
+            return ret;
+        }
+    }
+    else if (ctx->columnar)
     {
-        fprintf(stderr, "%s: Unexpected end of file\n", str);
+        SGeoRow row = { *packet, encFrameIdx };
+        return ColumnarAppendRow(&ctx->columns[PACKET_TYPE_GEO], &row);
     }
-    else
+    if (ctx->quiet || ctx->batch)
     {
-        perror(str);
+        return 0;
     }
-    return -1;
+
+    // "%" PRIu64 ",frm=%u,lat=%.6f,lon=%.6f,alt=%.3f\n"
+    STextWriter* out = &ctx->out;
+    TextUInt(out, packet->header.relTsUs);
+    TEXT_LITERAL(out, ",frm=");
+    TextUInt(out, encFrameIdx);
+    TEXT_LITERAL(out, ",lat=");
+    TextDouble(out, packet->latitude, 6);
+    TEXT_LITERAL(out, ",lon=");
+    TextDouble(out, packet->longitude, 6);
+    TEXT_LITERAL(out, ",alt=");
+    TextDouble(out, packet->altitude, 3);
+    TEXT_LITERAL(out, "\n");
+    return 0;
 }
 
-static uint32_t GetFrameIndex(uint64_t pts, SFraction fps)
+static int PrintIqPacket(void* context, const SIqPacket* packet, uint32_t encFrameIdx)
 {
-    uint64_t frameIndex = 0ULL;
-    frameIndex = (pts * fps.num + fps.num - 1) / fps.den / 1000000ULL;
-    return (uint32_t)frameIndex;
+    SPrintContext* ctx = context;
+    ctx->packetCount++;
+    if (ctx->splitSources)
+    {
+        int ret = WriteIqStream(ctx, packet, encFrameIdx);
+        if (ret != 0 || ctx->columnar)
+        {
+            return ret;
+        }
+    }
+    else if (ctx->columnar)
+    {
+        SIqRow row = { *packet, encFrameIdx };
+        return ColumnarAppendRow(&ctx->columns[PACKET_TYPE_IQ], &row);
+    }
+    if (ctx->quiet || ctx->batch)
+    {
+        return 0;
+    }
+
+    // "%" PRIu64 ",frm=%u,sens=%i,iso=%hu,sht=%1.8f,sht_mx=%1.8f,r=%u,g=%u,b=%u\n"
+    STextWriter* out = &ctx->out;
+    TextUInt(out, packet->header.relTsUs);
+    TEXT_LITERAL(out, ",frm=");
+    TextUInt(out, encFrameIdx);
+    TEXT_LITERAL(out, ",sens=");
+    TextUInt(out, packet->header.dataSourceId);
+    TEXT_LITERAL(out, ",iso=");
+    TextUInt(out, packet->iso);
+    TEXT_LITERAL(out, ",sht=");
+    TextFloat(out, packet->shutterTime, 8);
+    TEXT_LITERAL(out, ",sht_mx=");
+    TextFloat(out, packet->maxShutterTime, 8);
+    TEXT_LITERAL(out, ",r=");
+    TextUInt(out, packet->redGain);
+    TEXT_LITERAL(out, ",g=");
+    TextUInt(out, packet->greenGain);
+    TEXT_LITERAL(out, ",b=");
+    TextUInt(out, packet->blueGain);
+    TEXT_LITERAL(out, "\n");
+    return 0;
 }
 
-static int PrintBmdt(FILE* mov, uint32_t size, FILE** csv_file)
+static int PrintTemperaturePacket(void* context, const STemperaturePacket* packet, uint32_t encFrameIdx)
 {
-    int ret = 0;
+    SPrintContext* ctx = context;
+    ctx->packetCount++;
+    if (ctx->splitSources)
+    {
+        int ret = WriteTemperatureStream(ctx, packet, encFrameIdx);
+        if (ret != 0 || ctx->columnar)
+        {
+            return ret;
+        }
+    }
+    else if (ctx->columnar)
+    {
+        STemperatureRow row = { *packet, encFrameIdx };
+        return ColumnarAppendRow(&ctx->columns[PACKET_TYPE_TEMPERATURE], &row);
+    }
+    if (ctx->quiet || ctx->batch)
+    {
+        return 0;
+    }
 
-    SMetadataHeader metaHeader = { 0 };
-    uint32_t readSize = 0;
+    // "%" PRIu64 ",frm=%u,temperature=%f\n"
+    STextWriter* out = &ctx->out;
+    TextUInt(out, packet->header.relTsUs);
+    TEXT_LITERAL(out, ",frm=");
+    TextUInt(out, encFrameIdx);
+    TEXT_LITERAL(out, ",temperature=");
+    TextFloat(out, packet->temperature, 6);
+    TEXT_LITERAL(out, "\n");
+    return 0;
+}
 
-    // Read header
-    ret = fread((uint8_t*)&metaHeader, sizeof(metaHeader), 1, mov);
+static void PrintCorruptPacket(void* context, const SMetadataPacketHeader* header, uint64_t offset)
+{
+    SPrintContext* ctx = context;
+    (void)offset;
 
-    if (ret > 0)
+    if (ctx->profile != NULL)
     {
-        printf("fps=%u/%u,formatVersion=%u, skewTimeUs=%u\n",
-            metaHeader.fps.num,
-            metaHeader.fps.den,
-            metaHeader.formatVersion,
-            metaHeader.rollingShutterSkewTimeUs);
+        ctx->profile->corruptPackets++;
+        if (!ctx->resync)
+        {
+            ctx->profile->corruptBytes += header->length + sizeof(uint16_t);
+        }
+    }
 
-        readSize += sizeof(SMetadataHeader);
+    // keep the message next to the packets around it on a terminal
+    if (ctx->out.data != NULL)
+    {
+        FlushTextWriter(&ctx->out);
+        fflush(stdout);
+    }
 
-        while (ret > 0 && readSize < size)
-        {
-            SMetadataPacketHeader header;
-            ret = fread((uint8_t*)&header, sizeof(header), 1, mov);
+    if (GetPacketSize(header->typeId) == 0)
+    {
+        fprintf(stderr, "Wrong packet type %u!\n", header->typeId);
+    }
+    else
+    {
+        fprintf(stderr, "Wrong format, or %s packet corrupted, skipping!\n",
+            GetPacketTypeName(header->typeId));
+    }
+}
 
-            uint16_t totalLength = header.length + sizeof(uint16_t);
+static void PrintResync(void* context, uint64_t offset, uint64_t skipped)
+{
+    SPrintContext* ctx = context;
 
-            if (ret > 0)
-            {
-                switch (header.typeId)
-                {
-                case PACKET_TYPE_IMU:
-                {
-                    if (totalLength != sizeof(SImuPacket))
-                    {
-                        fprintf(stderr, "Wrong format, or IMU packet corrupted, skipping!\n");
-                        fseeko(mov, totalLength - sizeof(header), SEEK_CUR);
-                    }
-                    else
-                    {
-                        SImuPacket packet = { 0 };
-                        packet.header = header;
-                        uint8_t* ptr = (uint8_t*)(&packet) + sizeof(header);
-                        uint16_t length = sizeof(packet) - sizeof(header);
-
-                        ret = fread(ptr, length, 1, mov);
-                        if (ret > 0)
-                        {
-                            uint32_t encFrameIdx =
-                                GetFrameIndex(packet.header.relTsUs, metaHeader.fps);
-                            printf("%" PRIu64 ",frm=%u,Imu%u,xAccel=%f,yAccel=%f,zAccel=%f,xGyro=%f,yGyro=%f,zGyro=%f\n",
-                                packet.header.relTsUs,
-                                encFrameIdx,
-                                packet.header.dataSourceId,
-                                packet.accel[0],
-                                packet.accel[1],
-                                packet.accel[2],
-                                packet.gyro[0],
-                                packet.gyro[1],
-                                packet.gyro[2]);
-
-                            // write those data to csv file
-                            WriteToCSVFile(csv_file, encFrameIdx, packet);
-                        }
-                        else
-                        {
-                            fprintf(stderr, "Error reading IMU packet!\n");
-                        }
-                    }
-                    break;
-                }
-
-                case PACKET_TYPE_GEO:
-                {
-                    if (totalLength != sizeof(SGeoPacket))
-                    {
-                        fprintf(stderr, "Wrong format, or GEO packet corrupted, skipping!\n");
-                        fseeko(mov, totalLength - sizeof(header), SEEK_CUR);
-                    }
-                    else
-                    {
-                        SGeoPacket packet = { 0 };
-                        packet.header = header;
-                        uint8_t* ptr = (uint8_t*)(&packet) + sizeof(header);
-                        uint16_t length = sizeof(packet) - sizeof(header);
-
-                        ret = fread(ptr, length, 1, mov);
-                        if (ret > 0)
-                        {
-                            uint32_t encFrameIdx =
-                                GetFrameIndex(packet.header.relTsUs, metaHeader.fps);
-                            printf("%" PRIu64 ",frm=%u,lat=%.6f,lon=%.6f,alt=%.3f\n",
-                                packet.header.relTsUs,
-                                encFrameIdx,
-                                packet.latitude,
-                                packet.longitude,
-                                packet.altitude);
-                        }
-                        else
-                        {
-                            fprintf(stderr, "Error reading GEO packet!\n");
-                        }
-                    }
-                    break;
-                }
-                case PACKET_TYPE_IQ:
-                {
-                    if (totalLength != sizeof(SIqPacket))
-                    {
-                        fprintf(stderr, "Wrong format, or IQ packet corrupted, skipping!\n");
-                        fseeko(mov, totalLength - sizeof(header), SEEK_CUR);
-                    }
-                    else
-                    {
-                        SIqPacket packet = { 0 };
-                        packet.header = header;
-                        uint8_t* ptr = (uint8_t*)(&packet) + sizeof(header);
-                        uint16_t length = sizeof(packet) - sizeof(header);
-
-                        ret = fread(ptr, length, 1, mov);
-
-                        if (ret > 0)
-                        {
-                            uint32_t encFrameIdx =
-                                GetFrameIndex(packet.header.relTsUs, metaHeader.fps);
-                            printf("%" PRIu64 ",frm=%u,sens=%i,iso=%hu,sht=%1.8f,sht_mx=%1.8f,r=%u,g=%u,b=%u\n",
-                                packet.header.relTsUs,
-                                encFrameIdx,
-                                packet.header.dataSourceId,
-                                packet.iso,
-                                packet.shutterTime,
-                                packet.maxShutterTime,
-                                packet.redGain,
-                                packet.greenGain,
-                                packet.blueGain);
-                        }
-                        else
-                        {
-                            fprintf(stderr, "Error reading IQ packet!\n");
-                        }
-                    }
-                    break;
-                }
-                case PACKET_TYPE_TEMPERATURE:
-                {
-                    if (totalLength != sizeof(STemperaturePacket))
-                    {
-                        fprintf(stderr,
-                            "Wrong format, or Temperature packet corrupted, skipping!\n");
-                        fseeko(mov, totalLength - sizeof(header), SEEK_CUR);
-                    }
-                    else
-                    {
-                        STemperaturePacket packet = { 0 };
-                        packet.header = header;
-                        uint8_t* ptr = (uint8_t*)(&packet) + sizeof(header);
-                        uint16_t length = sizeof(packet) - sizeof(header);
-
-                        ret = fread(ptr, length, 1, mov);
-
-                        if (ret > 0)
-                        {
-                            uint32_t encFrameIdx =
-                                GetFrameIndex(packet.header.relTsUs, metaHeader.fps);
-                            printf("%" PRIu64 ",frm=%u,temperature=%f\n",
-                                packet.header.relTsUs,
-                                encFrameIdx,
-                                packet.temperature);
-                        }
-                        else
-                        {
-                            fprintf(stderr, "Error reading Temperature packet!\n");
-                        }
-                    }
-                    break;
-                }
-                default:
-                {
-                    fprintf(stderr, "Wrong packet type %u!\n", header.typeId);
-                    break;
-                }
-                }
-            }
-        }
+    if (ctx->profile != NULL)
+    {
+        ctx->profile->corruptBytes += skipped;
+    }
+
+    if (ctx->out.data != NULL)
+    {
+        FlushTextWriter(&ctx->out);
+        fflush(stdout);
     }
+    fprintf(stderr, "Skipped %" PRIu64 " bytes from bmdt offset %" PRIu64 " to the next valid packet\n",
+        skipped, offset);
+}
+
+#define ADD_COLUMN(writer, Row, name, dtype, field) \
+    ColumnarAddColumn(writer, name, dtype, sizeof(((Row*)0)->field), offsetof(Row, field))
+
+static int AddHeaderColumns(SColumnarWriter* writer, size_t frameOffset)
+{
+    // the packet header sits at offset 0 of every row struct
+    int ret = 0;
+    ret |= ADD_COLUMN(writer, SImuRow, "timestamp_us", "<u8", packet.header.relTsUs);
+    ret |= ColumnarAddColumn(writer, "frame", "<u4", sizeof(uint32_t), frameOffset);
+    ret |= ADD_COLUMN(writer, SImuRow, "source", "|u1", packet.header.dataSourceId);
+    return ret;
 }
 
-static int PrintMetadata(FILE* mov, FILE** csv_file)
+/* Columns of the rows of one packet type */
+static int AddPacketColumns(SColumnarWriter* writer, int type)
 {
     int ret = 0;
-    AtomHeader header = { 0, 0 };
 
-    // Look for 'moov'
-    uint32_t MOOV = MAKE_TAG('m', 'o', 'o', 'v');
-    while (ret == 0 && header.type != MOOV)
+    switch (type)
     {
-        // skip contents of the current atom, which can be gigabytes
-        ret = fseeko(mov, header.size, SEEK_CUR);
-        if (ret == 0)
-        {
-            ret = ReadAtomHeader(mov, &header);
-        }
+    case PACKET_TYPE_IMU:
+        ret |= AddHeaderColumns(writer, offsetof(SImuRow, frame));
+        ret |= ADD_COLUMN(writer, SImuRow, "accel_x", "<f4", packet.accel[0]);
+        ret |= ADD_COLUMN(writer, SImuRow, "accel_y", "<f4", packet.accel[1]);
+        ret |= ADD_COLUMN(writer, SImuRow, "accel_z", "<f4", packet.accel[2]);
+        ret |= ADD_COLUMN(writer, SImuRow, "gyro_x", "<f4", packet.gyro[0]);
+        ret |= ADD_COLUMN(writer, SImuRow, "gyro_y", "<f4", packet.gyro[1]);
+        ret |= ADD_COLUMN(writer, SImuRow, "gyro_z", "<f4", packet.gyro[2]);
+        break;
+
+    case PACKET_TYPE_GEO:
+        ret |= AddHeaderColumns(writer, offsetof(SGeoRow, frame));
+        ret |= ADD_COLUMN(writer, SGeoRow, "latitude", "<f8", packet.latitude);
+        ret |= ADD_COLUMN(writer, SGeoRow, "longitude", "<f8", packet.longitude);
+        ret |= ADD_COLUMN(writer, SGeoRow, "altitude", "<f8", packet.altitude);
+        break;
+
+    case PACKET_TYPE_IQ:
+        ret |= AddHeaderColumns(writer, offsetof(SIqRow, frame));
+        ret |= ADD_COLUMN(writer, SIqRow, "shutter_time", "<f4", packet.shutterTime);
+        ret |= ADD_COLUMN(writer, SIqRow, "max_shutter_time", "<f4", packet.maxShutterTime);
+        ret |= ADD_COLUMN(writer, SIqRow, "red_gain", "<u4", packet.redGain);
+        ret |= ADD_COLUMN(writer, SIqRow, "green_gain", "<u4", packet.greenGain);
+        ret |= ADD_COLUMN(writer, SIqRow, "blue_gain", "<u4", packet.blueGain);
+        ret |= ADD_COLUMN(writer, SIqRow, "iso", "<u2", packet.iso);
+        break;
+
+    case PACKET_TYPE_TEMPERATURE:
+        ret |= AddHeaderColumns(writer, offsetof(STemperatureRow, frame));
+        ret |= ADD_COLUMN(writer, STemperatureRow, "temperature", "<f4", packet.temperature);
+        break;
     }
+    return ret;
+}
 
-    if (header.type != MOOV)
+/* Path of the output file <type>_<name>.<extension> in the output directory, -1 if it does not fit */
+static int MakeOutputPath(const SPrintContext* ctx, const char* type, const char* extension,
+    char path[MAX_PATH_LENGTH])
+{
+    int length = snprintf(path, MAX_PATH_LENGTH, "%s%s_%s.%s", ctx->out_dir, type, ctx->name, extension);
+    if (length < 0 || length >= MAX_PATH_LENGTH)
     {
-        return Perror(mov, "Failed to find 'moov'");
+        fprintf(stderr, "%s%s_%s.%s: Path is too long\n", ctx->out_dir, type, ctx->name, extension);
+        return -1;
     }
+    return 0;
+}
 
-    // Look for 'moov/udta'
-    off_t moovEnd = ftello(mov) + header.size;
-    header.type = header.size = 0;
-    uint32_t UDTA = MAKE_TAG('u', 'd', 't', 'a');
-
-    while (ret == 0 && ftello(mov) + header.size != moovEnd && header.type != UDTA)
+static int OpenColumnarOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader)
+{
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
     {
-        ret = fseeko(mov, header.size, SEEK_CUR);
-        if (ret == 0)
+        char path[MAX_PATH_LENGTH];
+        if (MakeOutputPath(ctx, COLUMNAR_STREAM_NAMES[type], "vzc", path) != 0 ||
+            ColumnarOpen(&ctx->columns[type], path, COLUMNAR_STREAM_NAMES[type],
+                metaHeader->fps, metaHeader->rollingShutterSkewTimeUs) != 0 ||
+            AddPacketColumns(&ctx->columns[type], type) != 0)
         {
-            ret = ReadAtomHeader(mov, &header);
+            return -1;
         }
     }
+    return 0;
+}
 
-    if (header.type != UDTA)
+/* Open the file of a (type, dataSourceId) pair, <type>_src<id>_<name>.csv or .vzc (--split-sources) */
+static int OpenSourceStream(void* context, SDemuxStream* stream)
+{
+    SPrintContext* ctx = context;
+    const char* type = COLUMNAR_STREAM_NAMES[stream->typeId];
+    char sourceType[64];
+    snprintf(sourceType, sizeof(sourceType), "%s_src%u", type, stream->sourceId);
+    char path[MAX_PATH_LENGTH];
+    if (MakeOutputPath(ctx, sourceType, ctx->columnar ? "vzc" : "csv", path) != 0)
     {
-        return Perror(mov, "Failed to find 'moov/udta'");
+        return -1;
     }
 
-    // Look for 'moov/udta/bmdt'
-    off_t udtaEnd = ftello(mov) + header.size;
-    header.type = header.size = 0;
-    uint32_t BMDT = MAKE_TAG('b', 'm', 'd', 't');
-
-    while (ret == 0 && ftello(mov) + header.size != udtaEnd && header.type != BMDT)
+    if (ctx->columnar)
     {
-        fseeko(mov, header.size, SEEK_CUR);
-        if (ret == 0)
+        if (ColumnarOpen(&stream->columns, path, type, ctx->metaHeader.fps,
+            ctx->metaHeader.rollingShutterSkewTimeUs) != 0)
         {
-            ret = ReadAtomHeader(mov, &header);
+            return -1;
         }
+        return AddPacketColumns(&stream->columns, stream->typeId);
     }
 
-    if (header.type == BMDT)
+    stream->file = fopen(path, "w");
+    if (stream->file == NULL || OpenTextWriter(&stream->text, stream->file, ctx->floats) != 0)
     {
-        PrintBmdt(mov, header.size, csv_file);
+        perror(path);
+        return -1;
     }
-    else
+    const char* header = SOURCE_CSV_HEADERS[stream->typeId];
+    TextWrite(&stream->text, header, strlen(header));
+    return 0;
+}
+
+static void PrintSourceStreamRows(void* context, const SDemuxStream* stream)
+{
+    const SPrintContext* ctx = context;
+    if (!ctx->batch)
     {
-        return Perror(mov, "Failed to find 'moov/udta/bmdt'");
+        printf("%s source %u: %" PRIu64 " rows\n", COLUMNAR_STREAM_NAMES[stream->typeId], stream->sourceId,
+            stream->rows);
     }
-    return ret;
 }
 
-void WriteToCSVFile(FILE** csv_file, uint32_t frame_number, SImuPacket imu_packet) {
-    
-    float MICRO_SEC_TO_SEC_CONV = 1000000;
-    float relTsUs = (float) imu_packet.header.relTsUs / MICRO_SEC_TO_SEC_CONV;
-
-    if (*csv_file != NULL) {
-        fprintf(*csv_file, "\n%u, %llu, %f, %f, %f, %f, %f, %f, %f, %f",
-            frame_number,
-            imu_packet.header.relTsUs,
-            relTsUs,
-            imu_packet.accel[0],
-            imu_packet.accel[1],
-            imu_packet.accel[2],
-            imu_packet.gyro[0],
-            imu_packet.gyro[1],
-            imu_packet.gyro[2]);
+static int CloseColumnarOutput(SPrintContext* ctx)
+{
+    int ret = 0;
+
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        if (ctx->columns[type].file != NULL)
+        {
+            if (!ctx->batch)
+            {
+                printf("%s: %" PRIu64 " rows\n", COLUMNAR_STREAM_NAMES[type], ctx->columns[type].header.rowCount);
+            }
+            ret |= ColumnarClose(&ctx->columns[type]);
+        }
     }
-    else {
-        perror("Failed to write IMU data into csv file");
+    return ret;
+}
+
+/** Column name, numpy type and field of the per-frame rows */
+#define FRAME_COLUMNS(X) \
+    X("frame", "<u4", frame) \
+    X("samples", "<u4", sampleCount) \
+    X("exposure_us", "<u8", exposureUs) \
+    X("mean_accel_x", "<f4", meanAccel[0]) X("mean_accel_y", "<f4", meanAccel[1]) X("mean_accel_z", "<f4", meanAccel[2]) \
+    X("mean_gyro_x", "<f4", meanGyro[0]) X("mean_gyro_y", "<f4", meanGyro[1]) X("mean_gyro_z", "<f4", meanGyro[2]) \
+    X("rotation_x", "<f4", rotation[0]) X("rotation_y", "<f4", rotation[1]) X("rotation_z", "<f4", rotation[2]) \
+    X("accel_x", "<f4", accel[0]) X("accel_y", "<f4", accel[1]) X("accel_z", "<f4", accel[2]) \
+    X("gyro_x", "<f4", gyro[0]) X("gyro_y", "<f4", gyro[1]) X("gyro_z", "<f4", gyro[2])
+
+static int WriteFrameRow(void* context, const SFrameImu* frame)
+{
+    SPrintContext* ctx = context;
+    if (ctx->columnar)
+    {
+        return ColumnarAppendRow(&ctx->frameColumns, frame);
     }
 
+    fprintf(ctx->frames_file, "\n%u, %u, %" PRIu64 ", %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f",
+        frame->frame,
+        frame->sampleCount,
+        frame->exposureUs,
+        frame->accel[0], frame->accel[1], frame->accel[2],
+        frame->gyro[0], frame->gyro[1], frame->gyro[2],
+        frame->rotation[0], frame->rotation[1], frame->rotation[2],
+        frame->meanAccel[0], frame->meanAccel[1], frame->meanAccel[2],
+        frame->meanGyro[0], frame->meanGyro[1], frame->meanGyro[2]);
+    return 0;
 }
 
-bool InitCSVFile(char* csv_file_path, FILE** csv_file) {
+static int OpenFramesOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader)
+{
+    InitFrameAggregator(&ctx->aggregator, metaHeader, WriteFrameRow, ctx);
 
-    // open or create file
-    *csv_file = fopen(csv_file_path, "w+");
+    char path[MAX_PATH_LENGTH];
+    if (MakeOutputPath(ctx, "frames", ctx->columnar ? "vzc" : "csv", path) != 0)
+    {
+        return -1;
+    }
 
-    if (csv_file == NULL) {
-        return false;
+    if (ctx->columnar)
+    {
+        if (ColumnarOpen(&ctx->frameColumns, path, "frames",
+            metaHeader->fps, metaHeader->rollingShutterSkewTimeUs) != 0)
+        {
+            return -1;
+        }
+        int ret = 0;
+#define ADD_FRAME_COLUMN(name, dtype, field) ret |= ADD_COLUMN(&ctx->frameColumns, SFrameImu, name, dtype, field);
+        FRAME_COLUMNS(ADD_FRAME_COLUMN)
+#undef ADD_FRAME_COLUMN
+        return ret;
     }
-    // write header line
-    fprintf(*csv_file, "FrameNumber, Timestamp[s], Timestamp[s], xAccel, yAccel, zAccel, xGyro, yGyro, zGyro");
-    
-    return true;
+
+    ctx->frames_file = fopen(path, "w");
+    if (ctx->frames_file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fprintf(ctx->frames_file, "FrameNumber, Samples, ExposureTimestamp[s], xAccel, yAccel, zAccel, xGyro, yGyro, zGyro, "
+        "xRotation, yRotation, zRotation, xAccelMean, yAccelMean, zAccelMean, xGyroMean, yGyroMean, zGyroMean");
+    return 0;
 }
 
-void CreateCSVFilePathFromMovie(const char* file, char* csv_file_path) {
+/* Emit the frames still held by the aggregator and close the output */
+static int CloseFramesOutput(SPrintContext* ctx)
+{
+    int ret = 0;
+    if (ctx->frames)
+    {
+        ret = FlushFrameAggregator(&ctx->aggregator);
+    }
 
-    struct stat attribut;
+    if (ctx->frameColumns.file != NULL)
+    {
+        if (!ctx->batch)
+        {
+            printf("frames: %" PRIu64 " rows\n", ctx->frameColumns.header.rowCount);
+        }
+        ret |= ColumnarClose(&ctx->frameColumns);
+    }
+    if (ctx->frames_file != NULL && fclose(ctx->frames_file) != 0)
+    {
+        ret = -1;
+    }
+    return ret;
+}
+
+/** Column name, numpy type and field of the per-frame orientations */
+#define ORIENTATION_COLUMNS(X) \
+    X("frame", "<u4", frame) \
+    X("exposure_us", "<u8", exposureUs) \
+    X("qw", "<f4", orientation[0]) X("qx", "<f4", orientation[1]) X("qy", "<f4", orientation[2]) \
+    X("qz", "<f4", orientation[3]) \
+    X("first_qw", "<f4", firstRow[0]) X("first_qx", "<f4", firstRow[1]) X("first_qy", "<f4", firstRow[2]) \
+    X("first_qz", "<f4", firstRow[3]) \
+    X("last_qw", "<f4", lastRow[0]) X("last_qx", "<f4", lastRow[1]) X("last_qy", "<f4", lastRow[2]) \
+    X("last_qz", "<f4", lastRow[3])
+
+static int WriteOrientationRow(void* context, const SFrameOrientation* frame)
+{
+    SPrintContext* ctx = context;
+    if (ctx->columnar)
+    {
+        return ColumnarAppendRow(&ctx->orientationColumns, frame);
+    }
 
-    // define expansion for .csv file
-    char csv_file_expansion[] = "imu_\0";
-    char csv_filename[100] = { 0 };
-    char csv_file_extension[] = ".csv";
+    fprintf(ctx->orientation_file, "\n%u, %" PRIu64 ", %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f",
+        frame->frame,
+        frame->exposureUs,
+        frame->orientation[0], frame->orientation[1], frame->orientation[2], frame->orientation[3],
+        frame->firstRow[0], frame->firstRow[1], frame->firstRow[2], frame->firstRow[3],
+        frame->lastRow[0], frame->lastRow[1], frame->lastRow[2], frame->lastRow[3]);
+    return 0;
+}
 
-    // extract path from filename
-    char drive[100] = { 0 };
-    char dir[100] = { 0 };
-    char filename[100] = { 0 };
+static int OpenOrientationOutput(SPrintContext* ctx, const SMetadataHeader* metaHeader)
+{
+    InitGyroIntegrator(&ctx->gyro, metaHeader, ctx->gyroScale, ctx->gyroBiasUs, WriteOrientationRow, ctx);
 
-    // split file into dir, drive and filename
-    _splitpath(file, drive, dir, filename, NULL);
+    char path[MAX_PATH_LENGTH];
+    if (MakeOutputPath(ctx, "orientation", ctx->columnar ? "vzc" : "csv", path) != 0)
+    {
+        return -1;
+    }
 
-    // concatenate strings to a path
-    strcat(drive, dir);
+    if (ctx->columnar)
+    {
+        if (ColumnarOpen(&ctx->orientationColumns, path, "orientation",
+            metaHeader->fps, metaHeader->rollingShutterSkewTimeUs) != 0)
+        {
+            return -1;
+        }
+        int ret = 0;
+#define ADD_ORIENTATION_COLUMN(name, dtype, field) \
+        ret |= ADD_COLUMN(&ctx->orientationColumns, SFrameOrientation, name, dtype, field);
+        ORIENTATION_COLUMNS(ADD_ORIENTATION_COLUMN)
+#undef ADD_ORIENTATION_COLUMN
+        return ret;
+    }
 
-    // create name for .csv file
-    strcat(csv_filename, csv_file_expansion);
-    strcat(csv_filename, filename);
-    strcat(csv_filename, csv_file_extension);
+    ctx->orientation_file = fopen(path, "w");
+    if (ctx->orientation_file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fprintf(ctx->orientation_file, "FrameNumber, ExposureTimestamp[s], qw, qx, qy, qz, "
+        "first_qw, first_qx, first_qy, first_qz, last_qw, last_qx, last_qy, last_qz");
+    return 0;
+}
 
-    // create .csv file with directory
-    strcat(csv_file_path, drive);
-    strcat(csv_file_path, filename);
-    strcat(csv_file_path, "\\");
-    
-    // check if directory exists, if not create it
-    if (stat(csv_file_path, &attribut) == -1) {
-        mkdir(csv_file_path);
+/* Emit the frames still held by the integrator and close the output */
+static int CloseOrientationOutput(SPrintContext* ctx)
+{
+    int ret = 0;
+    if (ctx->orientation)
+    {
+        ret = FlushGyroIntegrator(&ctx->gyro);
     }
-    strcat(csv_file_path, csv_filename);
 
-    printf("\n");
-    printf("-----\nCreate a .csv file with its directory according to the movie: ");
-    printf(file);
-    printf("\n");
-    printf("CSV-File: ");
-    printf(csv_file_path);
-    printf("\n-----\n");
+    if (ctx->orientationColumns.file != NULL)
+    {
+        if (!ctx->batch)
+        {
+            printf("orientation: %" PRIu64 " rows\n", ctx->orientationColumns.header.rowCount);
+        }
+        ret |= ColumnarClose(&ctx->orientationColumns);
+    }
+    if (ctx->orientation_file != NULL && fclose(ctx->orientation_file) != 0)
+    {
+        ret = -1;
+    }
+    return ret;
+}
 
+static int WriteFusedOrientation(void* context, const SFusedOrientation* orientation)
+{
+    SPrintContext* ctx = context;
+    return QuaternionTrackAppend(&ctx->fusionTrack, orientation->step, orientation->orientation);
 }
 
-int main(int argc, const char* argv[])
+static int OpenFusionOutput(SPrintContext* ctx)
 {
-    if (argc != 2)
+    InitOrientationFilter(&ctx->fusion, ctx->fusionRateHz, ctx->fusionGain, ctx->gyroScale, WriteFusedOrientation,
+        ctx);
+
+    char path[MAX_PATH_LENGTH];
+    if (MakeOutputPath(ctx, "fusion", "vzq", path) != 0)
     {
-        fprintf(stderr,
-            "Usage: %s FILE\nPrint metadata from moov/udta/bmdt atom from mov or mp4 FILE\n",
-            argv[0]);
         return -1;
     }
+    return QuaternionTrackOpen(&ctx->fusionTrack, path, ctx->fusionRateHz);
+}
 
-    // create .csv file name + path
-    const char* file = argv[1];
-    char csv_file_path[100] = { 0 };
-    CreateCSVFilePathFromMovie(file, csv_file_path);
-
-    // Init csv File 
-    FILE* csv_file;
-    bool is_open = InitCSVFile(csv_file_path, &csv_file);
+static int CloseFusionOutput(SPrintContext* ctx)
+{
+    if (ctx->fusionTrack.file == NULL)
+    {
+        return 0;
+    }
 
-    if (is_open) {
+    int ret = QuaternionTrackClose(&ctx->fusionTrack);
+    if (!ctx->batch)
+    {
+        printf("fusion: %" PRIu64 " steps at %u Hz\n", ctx->fusionTrack.header.stepCount, ctx->fusionRateHz);
+    }
+    return ret;
+}
 
-        FILE* mov = fopen(file, "rb");
-        if (!mov)
+static void CountProfiledPacket(SPrintContext* ctx, uint8_t typeId, uint32_t encFrameIdx)
+{
+    uint64_t* packets = ctx->profile->packets;
+    if (typeId == PACKET_TYPE_IMU)
+    {
+        if (packets[PACKET_TYPE_IMU] == 0 || encFrameIdx < ctx->firstFrame)
         {
-            perror(argv[1]);
-            return -1;
+            ctx->firstFrame = encFrameIdx;
         }
+        if (packets[PACKET_TYPE_IMU] == 0 || encFrameIdx > ctx->lastFrame)
+        {
+            ctx->lastFrame = encFrameIdx;
+        }
+    }
+    packets[typeId]++;
+}
 
-        int ret = PrintMetadata(mov, &csv_file);
+/*
+ * Print*Packet() behind a per-packet count and timer, installed only when
+ * profiling so that the unprofiled callbacks pay nothing for it
+ */
+#define PROFILED_PACKET_CALLBACK(typeId, Name, title, stream) \
+    static int Profiled##Name##Packet(void* context, const S##Name##Packet* packet, uint32_t encFrameIdx) \
+    { \
+        SPrintContext* ctx = context; \
+        CountProfiledPacket(ctx, typeId, encFrameIdx); \
+        SProfileMark mark; \
+        ProfileBegin(ctx->profile, PROFILE_FORMAT_PACKET, &mark); \
+        int ret = Print##Name##Packet(context, packet, encFrameIdx); \
+        ProfileEnd(ctx->profile, PROFILE_FORMAT_PACKET, &mark); \
+        return ret; \
+    }
 
-        fclose(mov);
-        fclose(csv_file);
+METADATA_PACKET_TYPES(PROFILED_PACKET_CALLBACK)
+#undef PROFILED_PACKET_CALLBACK
 
-        return ret;
+/*
+ * Runs of packets (see SPacketRun), installed for the columnar and the quiet
+ * output: the columns are filled one after the other for the whole run. IMU
+ * packets still go through PrintImuPacket() one by one while frames or
+ * orientation are computed from them, the fusion takes the run as it is.
+ */
+#define PRINT_PACKET_BATCH(typeId, Name, title, stream) \
+    static int Print##Name##Batch(void* context, const S##Name##Packet* packets, const uint32_t* frameIndices, \
+        size_t count) \
+    { \
+        SPrintContext* ctx = context; \
+        if (typeId == PACKET_TYPE_IMU && (ctx->frames || ctx->orientation)) \
+        { \
+            int ret = 0; \
+            for (size_t i = 0; ret == 0 && i < count; i++) \
+            { \
+                ret = Print##Name##Packet(context, &packets[i], frameIndices[i]); \
+            } \
+            return ret; \
+        } \
+        if (typeId == PACKET_TYPE_IMU && ctx->fusionRateHz != 0) \
+        { \
+            const SImuPacket* imu = (const SImuPacket*)packets; \
+            for (size_t i = 0; i < count; i++) \
+            { \
+                if (AddFusionSample(&ctx->fusion, &imu[i]) != 0) \
+                { \
+                    return -1; \
+                } \
+            } \
+        } \
+        ctx->packetCount += count; \
+        if (!ctx->columnar) \
+        { \
+            return 0; \
+        } \
+        S##Name##Row rows[PACKET_BATCH_SIZE]; \
+        for (size_t i = 0; i < count; i++) \
+        { \
+            rows[i].packet = packets[i]; \
+            rows[i].frame = frameIndices[i]; \
+        } \
+        return ColumnarAppendRows(&ctx->columns[typeId], rows, count, sizeof(rows[0])); \
+    }
+
+METADATA_PACKET_TYPES(PRINT_PACKET_BATCH)
+#undef PRINT_PACKET_BATCH
+
+/* Hand the packets of a follow poll to the reader right away instead of when the buffers fill up */
+static void FlushFollowedOutput(void* context)
+{
+    SPrintContext* ctx = context;
+    if (ctx->out.data != NULL)
+    {
+        FlushTextWriter(&ctx->out);
+        fflush(stdout);
+    }
+    if (ctx->csv.data != NULL)
+    {
+        FlushTextWriter(&ctx->csv);
+        fflush(ctx->csv_file);
+    }
+    if (ctx->frames_file != NULL)
+    {
+        fflush(ctx->frames_file);
+    }
+    if (ctx->orientation_file != NULL)
+    {
+        fflush(ctx->orientation_file);
+    }
+    if (ctx->fusionTrack.file != NULL)
+    {
+        QuaternionTrackFlush(&ctx->fusionTrack);
+        fflush(ctx->fusionTrack.file);
+    }
+    if (ctx->splitSources)
+    {
+        FlushSourceDemux(&ctx->demux);
+    }
+}
+
+/* Decode the whole movie at once, or follow it as it grows (--follow) */
+static int DecodeOrFollow(FILE* mov, SPrintContext* ctx, const SDecodeOptions* options,
+    const SMetadataCallbacks* callbacks)
+{
+    if (!ctx->follow)
+    {
+        return DecodeMetadata(mov, options, callbacks);
+    }
+
+    SFollowOptions follow = { 0 };
+    follow.pollIntervalMs = FOLLOW_POLL_MS;
+    follow.idleTimeoutMs = ctx->followTimeoutMs;
+    follow.onPoll = FlushFollowedOutput;
+    follow.profile = options->profile;
+    follow.resync = options->resync;
+    return FollowMetadata(mov, &follow, callbacks);
+}
+
+static int PrintMetadata(FILE* mov, SPrintContext* ctx, const SDecodeOptions* options)
+{
+    SMetadataCallbacks callbacks = { 0 };
+    callbacks.context = ctx;
+    callbacks.onHeader = PrintMetadataHeader;
+    callbacks.onCorrupt = PrintCorruptPacket;
+    callbacks.onResync = PrintResync;
+#define SET_PACKET_CALLBACK(typeId, Name, title, stream) callbacks.on##Name = Print##Name##Packet;
+    METADATA_PACKET_TYPES(SET_PACKET_CALLBACK)
+#undef SET_PACKET_CALLBACK
+
+    if (ctx->profile == NULL)
+    {
+        if ((ctx->columnar || ctx->quiet) && !ctx->splitSources)
+        {
+#define SET_BATCH_CALLBACK(typeId, Name, title, stream) callbacks.on##Name##Batch = Print##Name##Batch;
+            METADATA_PACKET_TYPES(SET_BATCH_CALLBACK)
+#undef SET_BATCH_CALLBACK
+        }
+        return DecodeOrFollow(mov, ctx, options, &callbacks);
+    }
+
+#define SET_PROFILED_CALLBACK(typeId, Name, title, stream) callbacks.on##Name = Profiled##Name##Packet;
+    METADATA_PACKET_TYPES(SET_PROFILED_CALLBACK)
+#undef SET_PROFILED_CALLBACK
+
+    SDecodeOptions profiledOptions = *options;
+    profiledOptions.profile = ctx->profile;
+
+    SProfileMark mark;
+    ProfileBegin(ctx->profile, PROFILE_PRINT_METADATA, &mark);
+    int ret = DecodeOrFollow(mov, ctx, &profiledOptions, &callbacks);
+    ProfileEnd(ctx->profile, PROFILE_PRINT_METADATA, &mark);
+
+    if (ctx->profile->packets[PACKET_TYPE_IMU] > 0)
+    {
+        ctx->profile->frames += (uint64_t)(ctx->lastFrame - ctx->firstFrame) + 1;
+    }
+    return ret;
+}
+
+void WriteToCSVFile(STextWriter* csv, uint32_t frame_number, const SImuPacket* imu_packet) {
+    
+    float MICRO_SEC_TO_SEC_CONV = 1000000;
+    float relTsUs = (float) imu_packet->header.relTsUs / MICRO_SEC_TO_SEC_CONV;
+
+    if (csv->file != NULL) {
+        // "\n%u, %" PRIu64 ", %f, %f, %f, %f, %f, %f, %f"
+        TEXT_LITERAL(csv, "\n");
+        TextUInt(csv, frame_number);
+        TEXT_LITERAL(csv, ", ");
+        TextUInt(csv, imu_packet->header.relTsUs);
+        TEXT_LITERAL(csv, ", ");
+        TextFloat(csv, relTsUs, 6);
+        for (int i = 0; i < 3; i++) {
+            TEXT_LITERAL(csv, ", ");
+            TextFloat(csv, imu_packet->accel[i], 6);
+        }
+        for (int i = 0; i < 3; i++) {
+            TEXT_LITERAL(csv, ", ");
+            TextFloat(csv, imu_packet->gyro[i], 6);
+        }
     }
     else {
-        perror(csv_file_path);
+        perror("Failed to write IMU data into csv file");
+    }
+
+}
+
+bool InitCSVFile(const char* csv_file_path, FILE** csv_file) {
+
+    // open or create file
+    *csv_file = fopen(csv_file_path, "w+");
+
+    if (*csv_file == NULL) {
+        return false;
+    }
+    // write header line
+    fprintf(*csv_file, "FrameNumber, Timestamp[s], Timestamp[s], xAccel, yAccel, zAccel, xGyro, yGyro, zGyro");
+    
+    return true;
+}
+
+/*
+ * Output files of a movie go to a directory named like the movie, next to it:
+ * "<dir>/<name>.MP4" -> "<dir>/<name>/". The directory is created if missing.
+ * Fails if the directory does not fit in MAX_PATH_LENGTH.
+ */
+static int CreateOutputDirFromMovie(const char* file, char* out_dir, char* name)
+{
+    struct stat attribut;
+
+    // split file into dir and filename without extension
+    const char* base = file;
+    for (const char* c = file; *c != '\0'; c++) {
+        if (*c == '/' || *c == PATH_SEPARATOR) {
+            base = c + 1;
+        }
+    }
+
+    size_t dir_length = (size_t)(base - file);
+    const char* extension = strrchr(base, '.');
+    size_t name_length = extension != NULL ? (size_t)(extension - base) : strlen(base);
+
+    int length = snprintf(out_dir, MAX_PATH_LENGTH, "%.*s%.*s%c", (int)dir_length, file, (int)name_length, base,
+        PATH_SEPARATOR);
+    if (length < 0 || length >= MAX_PATH_LENGTH) {
+        fprintf(stderr, "%s: Path of the output directory is too long\n", file);
+        return -1;
+    }
+    snprintf(name, MAX_PATH_LENGTH, "%.*s", (int)name_length, base);
+
+    // check if directory exists, if not create it
+    if (stat(out_dir, &attribut) == -1) {
+        MakeDirectory(out_dir);
+    }
+    return 0;
+}
+
+int CreateCSVFilePathFromMovie(const char* file, char* csv_file_path) {
+
+    char out_dir[MAX_PATH_LENGTH] = { 0 };
+    char filename[MAX_PATH_LENGTH] = { 0 };
+    if (CreateOutputDirFromMovie(file, out_dir, filename) != 0) {
+        return -1;
+    }
+
+    // create .csv file with directory
+    int length = snprintf(csv_file_path, MAX_PATH_LENGTH, "%simu_%s.csv", out_dir, filename);
+    if (length < 0 || length >= MAX_PATH_LENGTH) {
+        fprintf(stderr, "%simu_%s.csv: Path is too long\n", out_dir, filename);
         return -1;
     }
+    return 0;
+}
+
+static void PrintCSVFilePath(const char* file, const char* csv_file_path) {
+
+    printf("\n");
+    printf("-----\nCreate a .csv file with its directory according to the movie: ");
+    printf("%s", file);
+    printf("\n");
+    printf("CSV-File: ");
+    printf("%s", csv_file_path);
+    printf("\n-----\n");
+
+}
+
+static double GetTimeSeconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Resource use of this process so far, -1 where the platform does not report it */
+typedef struct
+{
+    int64_t peakRssKb;
+
+    /** read/write system calls (Linux /proc/self/io), I/O operations under Windows */
+    int64_t ioCalls;
+} SProcessStats;
+
+static void GetProcessStats(SProcessStats* stats)
+{
+    stats->peakRssKb = -1;
+    stats->ioCalls = -1;
+
+#if _WIN32
+    PROCESS_MEMORY_COUNTERS memory;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+    {
+        stats->peakRssKb = (int64_t)(memory.PeakWorkingSetSize / 1024);
+    }
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(GetCurrentProcess(), &io))
+    {
+        stats->ioCalls = (int64_t)(io.ReadOperationCount + io.WriteOperationCount + io.OtherOperationCount);
+    }
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        // kilobytes on Linux, bytes on macOS
+#if __APPLE__
+        stats->peakRssKb = usage.ru_maxrss / 1024;
+#else
+        stats->peakRssKb = usage.ru_maxrss;
+#endif
+    }
+
+    // ru_maxrss of a forked child starts at the parent's RSS, VmHWM is of this address space only
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status != NULL)
+    {
+        char line[128];
+        long long value;
+        while (fgets(line, sizeof(line), status) != NULL)
+        {
+            if (sscanf(line, "VmHWM: %lld", &value) == 1)
+            {
+                stats->peakRssKb = value;
+            }
+        }
+        fclose(status);
+    }
+
+    FILE* io = fopen("/proc/self/io", "r");
+    if (io != NULL)
+    {
+        char line[128];
+        long long value;
+        stats->ioCalls = 0;
+        while (fgets(line, sizeof(line), io) != NULL)
+        {
+            if (sscanf(line, "syscr: %lld", &value) == 1 || sscanf(line, "syscw: %lld", &value) == 1)
+            {
+                stats->ioCalls += value;
+            }
+        }
+        fclose(io);
+    }
+#endif
+}
+
+typedef struct
+{
+    const char* name;
+    bool useMmap;
+    bool useIndex;
+} SBenchmarkMode;
+
+static const SBenchmarkMode BENCHMARK_MODES[] =
+{
+    { "stdio", false, false },
+    { "mmap", true, false },
+    { "index", true, true },
+};
+
+#define BENCHMARK_MODE_COUNT (sizeof(BENCHMARK_MODES) / sizeof(BENCHMARK_MODES[0]))
+
+/*
+ * Decode the whole bmdt 'iterations' times through each parser, without
+ * formatting, and report packets/sec, MB/sec of bmdt, I/O calls per
+ * iteration and the peak RSS. 'modeName' restricts the run to one parser,
+ * so that the peak RSS is the one of that parser alone.
+ */
+static int BenchmarkMetadata(const char* file, int iterations, const char* modeName)
+{
+    FILE* mov = fopen(file, "rb");
+    if (!mov)
+    {
+        perror(file);
+        return -1;
+    }
+    off_t bmdtOffset = 0;
+    uint64_t bmdtSize = 0;
+    int ret = FindBmdt(mov, &bmdtOffset, &bmdtSize);
+    fclose(mov);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    for (size_t mode = 0; mode < BENCHMARK_MODE_COUNT; mode++)
+    {
+        if (modeName != NULL && strcmp(modeName, BENCHMARK_MODES[mode].name) != 0)
+        {
+            continue;
+        }
+
+        SPrintContext ctx = { 0 };
+        ctx.quiet = true;
+        SDecodeOptions options = { 0 };
+        options.useMmap = BENCHMARK_MODES[mode].useMmap;
+
+        // the index is built (or loaded) once, outside of the measurement
+        SMetadataIndex index = { 0 };
+        if (BENCHMARK_MODES[mode].useIndex)
+        {
+            mov = fopen(file, "rb");
+            ret = mov != NULL ? OpenMetadataIndex(file, mov, &index, NULL) : -1;
+            if (mov != NULL)
+            {
+                fclose(mov);
+            }
+            if (ret != 0)
+            {
+                fprintf(stderr, "%s: no index\n", file);
+                return -1;
+            }
+            options.index = &index;
+        }
+
+        SProcessStats before, after;
+        GetProcessStats(&before);
+        double start = GetTimeSeconds();
+
+        for (int i = 0; i < iterations && ret == 0; i++)
+        {
+            mov = fopen(file, "rb");
+            if (!mov)
+            {
+                perror(file);
+                ret = -1;
+                break;
+            }
+
+            ret = PrintMetadata(mov, &ctx, &options);
+            fclose(mov);
+        }
+
+        double elapsed = GetTimeSeconds() - start;
+        GetProcessStats(&after);
+        FreeMetadataIndex(&index);
+        if (ret != 0)
+        {
+            return ret;
+        }
+
+        printf("%-5s: %" PRIu64 " packets in %.3f s, %.0f packets/s, %.1f MB/s, %.1f I/O calls/iteration, "
+            "peak RSS %" PRId64 " kB\n",
+            BENCHMARK_MODES[mode].name,
+            ctx.packetCount,
+            elapsed,
+            elapsed > 0 ? ctx.packetCount / elapsed : 0.0,
+            elapsed > 0 ? (double)bmdtSize * iterations / elapsed / (1024.0 * 1024.0) : 0.0,
+            before.ioCalls >= 0 ? (double)(after.ioCalls - before.ioCalls) / iterations : -1.0,
+            after.peakRssKb);
+    }
+
+    return 0;
+}
+
+typedef enum
+{
+    OUTPUT_FORMAT_CSV,
+    OUTPUT_FORMAT_COLUMNAR,
+} EOutputFormat;
+
+typedef struct
+{
+    bool useMmap;
+    EOutputFormat format;
+
+    /** Use the sidecar index "<movie>.vzidx", built if missing or stale */
+    bool useIndex;
+
+    /** Also write one aggregated IMU row per video frame */
+    bool frames;
+
+    /** One output file per packet type and dataSourceId, see SourceDemux.h */
+    bool splitSources;
+
+    /** Also write the camera orientation per video frame, see GyroIntegrator.h */
+    bool orientation;
+    double gyroScale;
+    uint64_t gyroBiasUs;
+
+    /** Also write orientations fused from accel and gyro at a fixed rate, see OrientationFilter.h; 0: off */
+    uint32_t fusionRateHz;
+    double fusionGain;
+
+    /** Decode only packets in 'range' (--from-frame/--to-frame/--from-us/--to-us) */
+    bool hasRange;
+    SDecodeRange range;
+
+    /** Several movies are extracted concurrently by 'jobs' workers */
+    bool batch;
+    int jobs;
+
+    /** Time the stages and count packets of every movie (--profile) */
+    bool profile;
+
+    /** Print floats with the fixed printf precision of old versions instead of the shortest round-trip digits */
+    bool legacyPrecision;
+
+    /** Resynchronize on the next valid packet after a corrupt one (SDecodeOptions.resync) */
+    bool resync;
+
+    /** Follow a movie that is still being recorded or copied, see MetadataFollower.h */
+    bool follow;
+    unsigned followTimeoutMs;
+} SExtractOptions;
+
+/*
+ * Decode one movie into its output directory. 'profile' (may be NULL)
+ * receives the timers and counters of this movie only.
+ */
+static int ExtractMovie(const char* file, const SExtractOptions* options, uint64_t* packetCount, SProfile* profile)
+{
+    SProfileMark extractMark, closeMark;
+    ProfileBegin(profile, PROFILE_EXTRACT_MOVIE, &extractMark);
+
+    SPrintContext ctx = { 0 };
+    ctx.profile = profile;
+    ctx.batch = options->batch;
+    ctx.frames = options->frames;
+    ctx.orientation = options->orientation;
+    ctx.gyroScale = options->gyroScale;
+    ctx.gyroBiasUs = options->gyroBiasUs;
+    ctx.fusionRateHz = options->fusionRateHz;
+    ctx.fusionGain = options->fusionGain;
+    ctx.follow = options->follow;
+    ctx.followTimeoutMs = options->followTimeoutMs;
+    ctx.resync = options->resync;
+    ctx.splitSources = options->splitSources;
+    ETextFloats floats = options->legacyPrecision ? TEXT_FLOATS_LEGACY : TEXT_FLOATS_SHORTEST;
+    ctx.floats = floats;
+    char out_dir[MAX_PATH_LENGTH] = { 0 };
+    char name[MAX_PATH_LENGTH] = { 0 };
+
+    if (CreateOutputDirFromMovie(file, out_dir, name) != 0)
+    {
+        return -1;
+    }
+    ctx.out_dir = out_dir;
+    ctx.name = name;
+
+    if (options->splitSources)
+    {
+        InitSourceDemux(&ctx.demux, OpenSourceStream, &ctx);
+    }
+
+    if (options->format == OUTPUT_FORMAT_COLUMNAR)
+    {
+        ctx.columnar = true;
+    }
+    else if (!options->splitSources)
+    {
+        // create .csv file name + path
+        char csv_file_path[MAX_PATH_LENGTH] = { 0 };
+        if (CreateCSVFilePathFromMovie(file, csv_file_path) != 0)
+        {
+            return -1;
+        }
+
+        // workers of a batch print only their status line, see BatchWorker()
+        if (!options->batch)
+        {
+            PrintCSVFilePath(file, csv_file_path);
+        }
+
+        // Init csv File
+        if (!InitCSVFile(csv_file_path, &ctx.csv_file))
+        {
+            perror(csv_file_path);
+            return -1;
+        }
+        if (OpenTextWriter(&ctx.csv, ctx.csv_file, floats) != 0)
+        {
+            perror(csv_file_path);
+            CloseTextWriter(&ctx.csv);
+            fclose(ctx.csv_file);
+            return -1;
+        }
+    }
+
+    FILE* mov = fopen(file, "rb");
+    if (!mov)
+    {
+        perror(file);
+        if (ctx.csv_file != NULL)
+        {
+            CloseTextWriter(&ctx.csv);
+            fclose(ctx.csv_file);
+        }
+        return -1;
+    }
+
+    SDecodeOptions decodeOptions = { 0 };
+    decodeOptions.useMmap = options->useMmap;
+    decodeOptions.range = options->hasRange ? &options->range : NULL;
+    decodeOptions.resync = options->resync;
+
+    SMetadataIndex index = { 0 };
+    if (options->useIndex)
+    {
+        bool built = false;
+        if (OpenMetadataIndex(file, mov, &index, &built) == 0)
+        {
+            decodeOptions.index = &index;
+            if (!options->batch)
+            {
+                printf("Index: %s%s (%s)\n", file, INDEX_EXTENSION, built ? "built" : "loaded");
+            }
+        }
+    }
+    else if (options->hasRange)
+    {
+        // an existing, up to date index lets the range query seek instead of decoding from the start
+        char index_path[MAX_PATH_LENGTH];
+        int length = snprintf(index_path, sizeof(index_path), "%s%s", file, INDEX_EXTENSION);
+        if (length > 0 && length < MAX_PATH_LENGTH && LoadMetadataIndex(index_path, mov, &index) == 0)
+        {
+            decodeOptions.index = &index;
+        }
+    }
+
+    // the bmdt header line and the packets of a single movie go to stdout
+    int ret = 0;
+    if (!ctx.batch && OpenTextWriter(&ctx.out, stdout, floats) != 0)
+    {
+        perror("stdout");
+        ret = -1;
+    }
+    if (ret == 0)
+    {
+        ret = PrintMetadata(mov, &ctx, &decodeOptions);
+    }
+
+    ProfileBegin(profile, PROFILE_CLOSE_OUTPUT, &closeMark);
+    FreeMetadataIndex(&index);
+    fclose(mov);
+    if (CloseTextWriter(&ctx.out) != 0)
+    {
+        perror("stdout");
+        ret = -1;
+    }
+    if (ctx.csv_file != NULL)
+    {
+        if (CloseTextWriter(&ctx.csv) != 0)
+        {
+            perror("Failed to write IMU data into csv file");
+            ret = -1;
+        }
+        fclose(ctx.csv_file);
+    }
+    if (CloseColumnarOutput(&ctx) != 0)
+    {
+        ret = -1;
+    }
+    if (CloseSourceDemux(&ctx.demux, PrintSourceStreamRows, &ctx) != 0)
+    {
+        perror("Failed to write the files split by source");
+        ret = -1;
+    }
+    if (CloseFramesOutput(&ctx) != 0)
+    {
+        ret = -1;
+    }
+    if (CloseOrientationOutput(&ctx) != 0)
+    {
+        ret = -1;
+    }
+    if (CloseFusionOutput(&ctx) != 0)
+    {
+        ret = -1;
+    }
+    ProfileEnd(profile, PROFILE_CLOSE_OUTPUT, &closeMark);
+    ProfileEnd(profile, PROFILE_EXTRACT_MOVIE, &extractMark);
+
+    *packetCount = ctx.packetCount;
+    return ret;
+}
+
+typedef struct
+{
+    char** files;
+    size_t count;
+    size_t capacity;
+} SFileList;
+
+static void AddFile(SFileList* list, const char* file)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity != 0 ? list->capacity * 2 : 64;
+        list->files = realloc(list->files, list->capacity * sizeof(char*));
+        if (list->files == NULL)
+        {
+            perror("Failed to grow file list");
+            exit(-1);
+        }
+    }
+
+    list->files[list->count] = strdup(file);
+    if (list->files[list->count] == NULL)
+    {
+        perror("Failed to grow file list");
+        exit(-1);
+    }
+    list->count++;
+}
+
+static int CompareFiles(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool IsMovieFile(const char* name)
+{
+    const char* extension = strrchr(name, '.');
+    if (extension == NULL)
+    {
+        return false;
+    }
+
+    char lower[8] = { 0 };
+    for (size_t i = 0; i + 1 < sizeof(lower) && extension[i] != '\0'; i++)
+    {
+        lower[i] = (char)tolower((unsigned char)extension[i]);
+    }
+    return strcmp(lower, ".mov") == 0 || strcmp(lower, ".mp4") == 0;
+}
+
+static void AddDirectoryEntry(SFileList* list, const char* path, const char* name)
+{
+    if (IsMovieFile(name))
+    {
+        char file[MAX_PATH_LENGTH];
+        size_t length = strlen(path);
+        bool separator = length > 0 && (path[length - 1] == '/' || path[length - 1] == PATH_SEPARATOR);
+        int written = snprintf(file, sizeof(file), "%s%s%s", path, separator ? "" : "/", name);
+        if (written < 0 || written >= MAX_PATH_LENGTH)
+        {
+            fprintf(stderr, "%s/%s: Path is too long, skipped\n", path, name);
+            return;
+        }
+        AddFile(list, file);
+    }
+}
+
+/* A movie is added as is, a directory contributes all .mov/.mp4 files in it, sorted by name */
+static int CollectMovies(const char* path, SFileList* list, bool* isDirectory)
+{
+    struct stat attribut;
+    if (stat(path, &attribut) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    *isDirectory = S_ISDIR(attribut.st_mode);
+    if (!*isDirectory)
+    {
+        AddFile(list, path);
+        return 0;
+    }
+
+    size_t first = list->count;
+#if _WIN32
+    char pattern[MAX_PATH_LENGTH];
+    int length = snprintf(pattern, sizeof(pattern), "%s\\*", path);
+    if (length < 0 || length >= MAX_PATH_LENGTH)
+    {
+        fprintf(stderr, "%s: Path is too long\n", path);
+        return -1;
+    }
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "%s: Can not list the directory (error %lu)\n", path, (unsigned long)GetLastError());
+        return -1;
+    }
+    do
+    {
+        AddDirectoryEntry(list, path, entry.cFileName);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        AddDirectoryEntry(list, path, entry->d_name);
+    }
+    closedir(dir);
+#endif
+
+    // a directory without movies leaves 'files' NULL
+    if (list->count > first)
+    {
+        qsort(list->files + first, list->count - first, sizeof(char*), CompareFiles);
+    }
+    return 0;
+}
+
+static int GetProcessorCount(void)
+{
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+typedef struct
+{
+    const SFileList* list;
+    const SExtractOptions* options;
+
+    /** Guards everything below */
+    SMutex lock;
+    size_t next;
+    size_t failures;
+    uint64_t bytes;
+    uint64_t packets;
+    SProfile profile;
+} SBatch;
+
+static void* BatchWorker(void* arg)
+{
+    SBatch* batch = arg;
+
+    for (;;)
+    {
+        LockMutex(&batch->lock);
+        size_t index = batch->next++;
+        UnlockMutex(&batch->lock);
+
+        if (index >= batch->list->count)
+        {
+            break;
+        }
+
+        const char* file = batch->list->files[index];
+        struct stat attribut;
+        uint64_t bytes = stat(file, &attribut) == 0 ? (uint64_t)attribut.st_size : 0;
+
+        uint64_t packetCount = 0;
+        SProfile profile = { 0 };
+        double start = GetTimeSeconds();
+        int ret = ExtractMovie(file, batch->options, &packetCount, batch->options->profile ? &profile : NULL);
+        double elapsed = GetTimeSeconds() - start;
+        profile.movies = 1;
+        profile.failedMovies = ret != 0;
+
+        printf("%s: %s, %" PRIu64 " packets in %.3f s\n",
+            file, ret == 0 ? "done" : "FAILED", packetCount, elapsed);
+
+        LockMutex(&batch->lock);
+        batch->failures += ret != 0;
+        batch->bytes += bytes;
+        batch->packets += packetCount;
+        MergeProfile(&batch->profile, &profile);
+        UnlockMutex(&batch->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Extract all movies on a bounded pool of worker threads, every movie gets
+ * its own output set. Prints aggregate throughput at the end, the timers and
+ * counters of all movies are added to 'profile' with options->profile.
+ */
+static int ExtractBatch(const SFileList* list, const SExtractOptions* options, SProfile* profile)
+{
+    SBatch batch = { 0 };
+    batch.list = list;
+    batch.options = options;
+    InitMutex(&batch.lock);
+
+    int jobs = options->jobs > 0 ? options->jobs : GetProcessorCount();
+    if ((size_t)jobs > list->count)
+    {
+        jobs = (int)list->count;
+    }
+
+    SThread* workers = calloc(jobs, sizeof(SThread));
+    int started = 0;
+    double start = GetTimeSeconds();
+
+    for (int i = 0; i < jobs; i++)
+    {
+        if (StartThread(&workers[started], BatchWorker, &batch) == 0)
+        {
+            started++;
+        }
+    }
+    if (started == 0)
+    {
+        // no threads available, work through the list on this one
+        BatchWorker(&batch);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        JoinThread(&workers[i]);
+    }
+
+    double elapsed = GetTimeSeconds() - start;
+    free(workers);
+    DestroyMutex(&batch.lock);
+    MergeProfile(profile, &batch.profile);
+
+    printf("-----\nExtracted %zu movies (%zu failed) with %d workers in %.3f s\n"
+        "%.2f files/s, %.1f MB/s, %.0f packets/s\n-----\n",
+        list->count,
+        batch.failures,
+        started > 0 ? started : 1,
+        elapsed,
+        elapsed > 0 ? list->count / elapsed : 0.0,
+        elapsed > 0 ? batch.bytes / elapsed / (1024.0 * 1024.0) : 0.0,
+        elapsed > 0 ? batch.packets / elapsed : 0.0);
+
+    return batch.failures == 0 ? 0 : -1;
+}
+
+/* A whole decimal number up to 'max', a sign or trailing characters are rejected */
+static bool ParseUnsigned(const char* text, uint64_t max, uint64_t* value)
+{
+    // strtoull() would skip blanks and wrap a negative number around
+    if (!isdigit((unsigned char)text[0]))
+    {
+        return false;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed > max)
+    {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+/* A number of seconds from 0 to 'maxSeconds', converted to ms */
+static bool ParseSecondsMs(const char* text, double maxSeconds, unsigned* ms)
+{
+    char* end;
+    errno = 0;
+    double seconds = strtod(text, &end);
+    if (errno != 0 || end == text || *end != '\0' || !(seconds >= 0.0 && seconds <= maxSeconds))
+    {
+        return false;
+    }
+    *ms = (unsigned)(seconds * 1000.0);
+    return true;
+}
+
+int main(int argc, const char* argv[])
+{
+    SExtractOptions options = { 0 };
+    SDecodeRange allPackets = DECODE_RANGE_ALL;
+    options.range = allPackets;
+    options.gyroScale = 1.0;
+    options.gyroBiasUs = GYRO_BIAS_WINDOW_US;
+    options.fusionGain = ORIENTATION_FILTER_GAIN;
+    options.followTimeoutMs = FOLLOW_IDLE_TIMEOUT_MS;
+    int benchmarkIterations = 0;
+    const char* benchmarkMode = NULL;
+    const char* profilePath = NULL;
+    SFileList files = { 0 };
+    int pathCount = 0;
+    bool directory = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc && !usage; i++)
+    {
+        if (strcmp(argv[i], "--mmap") == 0)
+        {
+            options.useMmap = true;
+        }
+        else if (strcmp(argv[i], "--index") == 0)
+        {
+            options.useIndex = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0)
+        {
+            options.frames = true;
+        }
+        else if (strcmp(argv[i], "--split-sources") == 0)
+        {
+            options.splitSources = true;
+        }
+        else if (strcmp(argv[i], "--orientation") == 0)
+        {
+            options.orientation = true;
+        }
+        else if (strcmp(argv[i], "--gyro-scale") == 0 && i + 1 < argc)
+        {
+            options.gyroScale = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--gyro-bias-us") == 0 && i + 1 < argc)
+        {
+            usage = !ParseUnsigned(argv[++i], UINT64_MAX, &options.gyroBiasUs);
+        }
+        else if (strcmp(argv[i], "--fusion") == 0 && i + 1 < argc)
+        {
+            uint64_t rateHz = 0;
+            if (!ParseUnsigned(argv[++i], 1000000, &rateHz) || rateHz == 0)
+            {
+                usage = true;
+            }
+            options.fusionRateHz = (uint32_t)rateHz;
+        }
+        else if (strcmp(argv[i], "--fusion-gain") == 0 && i + 1 < argc)
+        {
+            options.fusionGain = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--from-us") == 0 && i + 1 < argc)
+        {
+            usage = !ParseUnsigned(argv[++i], UINT64_MAX, &options.range.fromUs);
+            options.hasRange = true;
+        }
+        else if (strcmp(argv[i], "--to-us") == 0 && i + 1 < argc)
+        {
+            usage = !ParseUnsigned(argv[++i], UINT64_MAX, &options.range.toUs);
+            options.hasRange = true;
+        }
+        else if (strcmp(argv[i], "--from-frame") == 0 && i + 1 < argc)
+        {
+            uint64_t frame = 0;
+            usage = !ParseUnsigned(argv[++i], UINT32_MAX, &frame);
+            options.range.fromFrame = (uint32_t)frame;
+            options.hasRange = true;
+        }
+        else if (strcmp(argv[i], "--to-frame") == 0 && i + 1 < argc)
+        {
+            uint64_t frame = 0;
+            usage = !ParseUnsigned(argv[++i], UINT32_MAX, &frame);
+            options.range.toFrame = (uint32_t)frame;
+            options.hasRange = true;
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+        {
+            benchmarkIterations = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--benchmark-mode") == 0 && i + 1 < argc)
+        {
+            benchmarkMode = argv[++i];
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+        {
+            options.jobs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--follow") == 0)
+        {
+            options.follow = true;
+        }
+        else if (strcmp(argv[i], "--follow-timeout") == 0 && i + 1 < argc)
+        {
+            usage = !ParseSecondsMs(argv[++i], UINT_MAX / 1000.0, &options.followTimeoutMs);
+        }
+        else if (strcmp(argv[i], "--legacy-precision") == 0)
+        {
+            options.legacyPrecision = true;
+        }
+        else if (strcmp(argv[i], "--resync") == 0)
+        {
+            options.resync = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profilePath = argv[++i];
+            options.profile = true;
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "csv") == 0)
+            {
+                options.format = OUTPUT_FORMAT_CSV;
+            }
+            else if (strcmp(argv[i], "columnar") == 0)
+            {
+                options.format = OUTPUT_FORMAT_COLUMNAR;
+            }
+            else
+            {
+                usage = true;
+            }
+        }
+        else if (argv[i][0] != '-')
+        {
+            bool isDirectory = false;
+            usage = CollectMovies(argv[i], &files, &isDirectory) != 0;
+            directory |= isDirectory;
+            pathCount++;
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+
+    // an empty range is a mistake, not a request for no packets
+    if (options.range.fromUs > options.range.toUs || options.range.fromFrame > options.range.toFrame)
+    {
+        usage = true;
+    }
+
+    // a followed movie is decoded in file order as it arrives, there is no index and nothing to seek to
+    if (options.follow && (pathCount != 1 || directory || options.useMmap || options.useIndex ||
+        options.hasRange || benchmarkIterations > 0))
+    {
+        usage = true;
+    }
+
+    // the benchmark decodes one movie with each parser, a batch would only time the first
+    if (benchmarkIterations > 0 && (pathCount != 1 || directory))
+    {
+        usage = true;
+    }
+
+    if (files.count == 0 || usage)
+    {
+        fprintf(stderr,
+            "Usage: %s [--mmap] [--index] [--frames] [--from-frame N] [--to-frame N] [--from-us T] [--to-us T]\n"
+            "       [--orientation] [--gyro-scale S] [--gyro-bias-us T] [--fusion HZ [--fusion-gain K]]\n"
+            "       [--format csv|columnar] [--split-sources] [--legacy-precision] [--resync] [--jobs N] [--profile JSON]\n"
+            "       [--follow [--follow-timeout S]]\n"
+            "       [--benchmark N [--benchmark-mode stdio|mmap|index]] FILE|DIR...\n"
+            "Print metadata from moov/udta/bmdt atom from mov or mp4 FILE\n"
+            "  --mmap         map the bmdt atom into memory instead of reading packet by packet\n"
+            "  --index        keep an index of bmdt in FILE.vzidx and use it instead of walking\n"
+            "                 the atoms, rebuilt whenever FILE changes size or modification time\n"
+            "  --frames       also write one row per video frame to frames_<name>.csv/.vzc: IMU sample count,\n"
+            "                 mean, gyro integrated over the frame and samples interpolated to the exposure\n"
+            "                 time of the middle scanline (frame start + rollingShutterSkewTimeUs / 2)\n"
+            "  --orientation  also write the camera orientation at that exposure time to orientation_<name>.csv/.vzc:\n"
+            "                 gyro integrated from the first sample as quaternion qw, qx, qy, qz, and at the\n"
+            "                 first and last scanline for the rolling shutter (first_qw.., last_qw..)\n"
+            "  --gyro-scale S gyro unit in rad/s (default 1, 0.0174533 for deg/s)\n"
+            "  --gyro-bias-us T\n"
+            "                 gyro bias is the mean of the first T us, the camera resting (default 1000000, 0: none)\n"
+            "  --fusion HZ    also write the orientation fused from accel and gyro by a complementary filter, resampled\n"
+            "                 to HZ steps per second, as a compact quaternion track to fusion_<name>.vzq\n"
+            "  --fusion-gain K\n"
+            "                 how fast the accel corrects the tilt, in 1/s (default 0.5, 0: gyro only)\n"
+            "  --from-frame N, --to-frame M\n"
+            "                 only packets of video frames N to M (inclusive, see GetFrameIndex)\n"
+            "  --from-us T1, --to-us T2\n"
+            "                 only packets with T1 <= relTsUs <= T2, decoding stops once the range is\n"
+            "                 passed and starts at the range if FILE.vzidx exists\n"
+            "  --format       csv: IMU rows to imu_<name>.csv, all packets to stdout (default)\n"
+            "                 columnar: one binary struct-of-arrays file per packet type,\n"
+            "                 <type>_<name>.vzc, readable with VuzeColumnar.py\n"
+            "  --split-sources\n"
+            "                 one file per packet type and dataSourceId instead: <type>_src<id>_<name>.csv\n"
+            "                 (all packet types) or .vzc, a reader takes only the sensors it needs\n"
+            "  --legacy-precision\n"
+            "                 print floats of the csv format with the fixed %%f/%%1.8f/%%.6f precision of\n"
+            "                 earlier versions, byte for byte; by default every float is printed with the\n"
+            "                 fewest digits that read back as the same value (0.1, 9.80665, 1e-05)\n"
+            "  --resync       after a corrupt or truncated packet, go on at the next packet of known type\n"
+            "                 and length that is followed by more such packets and continues the timestamps,\n"
+            "                 instead of trusting its length field; the bytes skipped are reported\n"
+            "  --follow       decode FILE while it is still being recorded or copied, also fragmented (moof)\n"
+            "                 files: new packets are printed within 0.1 s, every byte is read once\n"
+            "  --follow-timeout S\n"
+            "                 stop once FILE has not grown for S seconds (default 10, 0: at its current end)\n"
+            "  --jobs N       extract up to N movies concurrently (default: number of CPUs)\n"
+            "  --profile JSON write a summary of the run to JSON (\"-\": stderr): wall and CPU time per stage,\n"
+            "                 bmdt bytes read, packets by type, corrupt packets skipped and frames\n"
+            "  --benchmark N  decode N times with each parser (stdio, mmap, mmap with FILE.vzidx) and report\n"
+            "                 packets/sec, MB/sec, I/O calls per decode and peak RSS\n"
+            "  --benchmark-mode M\n"
+            "                 only benchmark parser M, the peak RSS is then the one of M alone\n"
+            "Several FILEs or a DIR (all .mov/.mp4 in it) are extracted as a batch, one output\n"
+            "directory per movie, packets are then not printed to stdout\n",
+            argv[0]);
+        return -1;
+    }
+
+    int ret = 0;
+    SProfile profile = { 0 };
+    double start = GetProfileWallSeconds();
+    if (benchmarkIterations > 0)
+    {
+        ret = BenchmarkMetadata(files.files[0], benchmarkIterations, benchmarkMode);
+    }
+    else if (pathCount == 1 && !directory)
+    {
+        uint64_t packetCount = 0;
+        ret = ExtractMovie(files.files[0], &options, &packetCount, options.profile ? &profile : NULL);
+        profile.movies = 1;
+        profile.failedMovies = ret != 0;
+    }
+    else
+    {
+        options.batch = true;
+        ret = ExtractBatch(&files, &options, &profile);
+    }
+
+    if (profilePath != NULL && benchmarkIterations == 0)
+    {
+        FILE* json = strcmp(profilePath, "-") == 0 ? stderr : fopen(profilePath, "w");
+        if (json == NULL || WriteProfileJson(json, &profile, GetProfileWallSeconds() - start) != 0)
+        {
+            perror(profilePath);
+            ret = -1;
+        }
+        if (json != NULL && json != stderr && fclose(json) != 0)
+        {
+            perror(profilePath);
+            ret = -1;
+        }
+    }
+
+    for (size_t i = 0; i < files.count; i++)
+    {
+        free(files.files[i]);
+    }
+    free(files.files);
+
+    return ret;
 }
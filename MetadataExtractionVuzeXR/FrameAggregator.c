@@ -0,0 +1,225 @@
+/**
+ * @file FrameAggregator.c
+ * Per video frame aggregation of IMU packets
+ */
+
+#include <string.h>
+
+#include "FrameAggregator.h"
+#include "VuzeMetadata.h"
+
+static void StartBucket(SFrameAggregator* aggregator, uint32_t frame)
+{
+    SFrameBucket* bucket = &aggregator->current;
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->row.frame = frame;
+    bucket->row.exposureUs = GetFrameStartUs(frame, aggregator->fps) + aggregator->rollingShutterSkewTimeUs / 2;
+}
+
+/* Linear interpolation to the exposure time of 'bucket', without 'from' the 'to' sample is held */
+static void Interpolate(SFrameBucket* bucket, const SImuPacket* from, const SImuPacket* to)
+{
+    double weight = 1.0;
+
+    if (from == NULL)
+    {
+        from = to;
+    }
+    else if (to->header.relTsUs > from->header.relTsUs)
+    {
+        weight = ((double)bucket->row.exposureUs - (double)from->header.relTsUs) /
+            (double)(to->header.relTsUs - from->header.relTsUs);
+        weight = weight < 0.0 ? 0.0 : weight > 1.0 ? 1.0 : weight;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        bucket->row.accel[i] = (float)(from->accel[i] + (to->accel[i] - from->accel[i]) * weight);
+        bucket->row.gyro[i] = (float)(from->gyro[i] + (to->gyro[i] - from->gyro[i]) * weight);
+    }
+    bucket->interpolated = true;
+}
+
+/* Gyro of the line between two samples at 'relTsUs' */
+static void GyroAt(const SImuPacket* from, const SImuPacket* to, uint64_t relTsUs, double gyro[3])
+{
+    double weight = to->header.relTsUs > from->header.relTsUs ?
+        (double)(relTsUs - from->header.relTsUs) / (double)(to->header.relTsUs - from->header.relTsUs) : 1.0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        gyro[i] = from->gyro[i] + (to->gyro[i] - from->gyro[i]) * weight;
+    }
+}
+
+static void Integrate(SFrameBucket* bucket, uint64_t fromUs, const double fromGyro[3], uint64_t toUs,
+    const double toGyro[3])
+{
+    double seconds = (double)(toUs - fromUs) * 1e-6;
+    for (int i = 0; i < 3; i++)
+    {
+        bucket->rotation[i] += 0.5 * (fromGyro[i] + toGyro[i]) * seconds;
+    }
+}
+
+/* Hand completed frames to the callback, in frame order */
+static int EmitReady(SFrameAggregator* aggregator)
+{
+    int ret = 0;
+
+    while (ret == 0 && aggregator->pendingCount > 0 &&
+        aggregator->pending[aggregator->pendingFirst].interpolated)
+    {
+        ret = aggregator->onFrame(aggregator->context, &aggregator->pending[aggregator->pendingFirst].row);
+        aggregator->pendingFirst = (aggregator->pendingFirst + 1) % FRAME_AGGREGATOR_MAX_PENDING;
+        aggregator->pendingCount--;
+    }
+    return ret;
+}
+
+/* Finish the current frame and queue it until its exposure time is interpolated */
+static int CloseBucket(SFrameAggregator* aggregator)
+{
+    SFrameBucket* bucket = &aggregator->current;
+    uint32_t count = bucket->row.sampleCount;
+
+    for (int i = 0; i < 3; i++)
+    {
+        bucket->row.meanAccel[i] = count > 0 ? (float)(bucket->sum[i] / count) : 0.0f;
+        bucket->row.meanGyro[i] = count > 0 ? (float)(bucket->sum[3 + i] / count) : 0.0f;
+        bucket->row.rotation[i] = (float)bucket->rotation[i];
+    }
+
+    if (aggregator->pendingCount == FRAME_AGGREGATOR_MAX_PENDING)
+    {
+        // samples are too sparse to reach the oldest exposure time, hold the last one
+        Interpolate(&aggregator->pending[aggregator->pendingFirst], NULL, &aggregator->previous);
+        int ret = EmitReady(aggregator);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    size_t last = (aggregator->pendingFirst + aggregator->pendingCount++) % FRAME_AGGREGATOR_MAX_PENDING;
+    aggregator->pending[last] = *bucket;
+    return 0;
+}
+
+/*
+ * Integrate the gyro from the previous sample to 'packet'. An interval
+ * spanning a frame start is split there, the current frame is closed and
+ * the frame of 'packet' started.
+ */
+static int IntegrateInterval(SFrameAggregator* aggregator, const SImuPacket* packet, uint32_t frameIndex)
+{
+    const SImuPacket* previous = &aggregator->previous;
+    SFrameBucket* bucket = &aggregator->current;
+    uint64_t fromUs = previous->header.relTsUs;
+    uint64_t toUs = packet->header.relTsUs;
+    double fromGyro[3] = { previous->gyro[0], previous->gyro[1], previous->gyro[2] };
+    double toGyro[3] = { packet->gyro[0], packet->gyro[1], packet->gyro[2] };
+
+    if (frameIndex == bucket->row.frame)
+    {
+        Integrate(bucket, fromUs, fromGyro, toUs, toGyro);
+        return 0;
+    }
+
+    // frames without samples in between get no share of the interval
+    uint64_t endUs = GetFrameStartUs(bucket->row.frame + 1, aggregator->fps);
+    uint64_t startUs = GetFrameStartUs(frameIndex, aggregator->fps);
+    endUs = endUs < fromUs ? fromUs : endUs > toUs ? toUs : endUs;
+    startUs = startUs < endUs ? endUs : startUs > toUs ? toUs : startUs;
+
+    double gyro[3];
+    GyroAt(previous, packet, endUs, gyro);
+    Integrate(bucket, fromUs, fromGyro, endUs, gyro);
+
+    int ret = CloseBucket(aggregator);
+    StartBucket(aggregator, frameIndex);
+
+    GyroAt(previous, packet, startUs, gyro);
+    Integrate(&aggregator->current, startUs, gyro, toUs, toGyro);
+    return ret;
+}
+
+void InitFrameAggregator(SFrameAggregator* aggregator, const SMetadataHeader* metaHeader,
+    FrameImuCallback onFrame, void* context)
+{
+    memset(aggregator, 0, sizeof(*aggregator));
+    aggregator->fps = metaHeader->fps;
+    aggregator->rollingShutterSkewTimeUs = metaHeader->rollingShutterSkewTimeUs;
+    aggregator->onFrame = onFrame;
+    aggregator->context = context;
+}
+
+int AddImuSample(SFrameAggregator* aggregator, const SImuPacket* packet, uint32_t frameIndex)
+{
+    const SImuPacket* previous = NULL;
+    int ret = 0;
+
+    if (!aggregator->started)
+    {
+        aggregator->started = true;
+        aggregator->dataSourceId = packet->header.dataSourceId;
+        StartBucket(aggregator, frameIndex);
+    }
+    else if (packet->header.dataSourceId != aggregator->dataSourceId ||
+        packet->header.relTsUs < aggregator->previous.header.relTsUs)
+    {
+        aggregator->ignored++;
+        return 0;
+    }
+    else
+    {
+        previous = &aggregator->previous;
+        ret = IntegrateInterval(aggregator, packet, frameIndex);
+    }
+
+    // every frame whose exposure time is passed now lies between the previous sample and this one
+    for (size_t i = 0; i < aggregator->pendingCount; i++)
+    {
+        SFrameBucket* bucket = &aggregator->pending[(aggregator->pendingFirst + i) % FRAME_AGGREGATOR_MAX_PENDING];
+        if (!bucket->interpolated && bucket->row.exposureUs <= packet->header.relTsUs)
+        {
+            Interpolate(bucket, previous, packet);
+        }
+    }
+    if (aggregator->current.row.exposureUs <= packet->header.relTsUs && !aggregator->current.interpolated)
+    {
+        Interpolate(&aggregator->current, previous, packet);
+    }
+
+    SFrameBucket* bucket = &aggregator->current;
+    for (int i = 0; i < 3; i++)
+    {
+        bucket->sum[i] += packet->accel[i];
+        bucket->sum[3 + i] += packet->gyro[i];
+    }
+    bucket->row.sampleCount++;
+    aggregator->previous = *packet;
+
+    return ret != 0 ? ret : EmitReady(aggregator);
+}
+
+int FlushFrameAggregator(SFrameAggregator* aggregator)
+{
+    if (!aggregator->started)
+    {
+        return 0;
+    }
+
+    int ret = CloseBucket(aggregator);
+    for (size_t i = 0; i < aggregator->pendingCount; i++)
+    {
+        SFrameBucket* bucket = &aggregator->pending[(aggregator->pendingFirst + i) % FRAME_AGGREGATOR_MAX_PENDING];
+        if (!bucket->interpolated)
+        {
+            Interpolate(bucket, NULL, &aggregator->previous);
+        }
+    }
+
+    aggregator->started = false;
+    return ret != 0 ? ret : EmitReady(aggregator);
+}
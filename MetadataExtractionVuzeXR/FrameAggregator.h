@@ -0,0 +1,81 @@
+/**
+ * @file FrameAggregator.h
+ * Per video frame aggregation of IMU packets
+ *
+ * Frame f covers the packets GetFrameIndex() maps to it, that is
+ * [GetFrameStartUs(f), GetFrameStartUs(f + 1)). Its exposure time is taken
+ * as the frame start plus half the rolling shutter skew: the moment the
+ * middle scanline starts exposing.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MetadataFormat.h"
+
+/** One row per video frame with at least one IMU sample */
+typedef struct
+{
+    uint32_t frame;
+    uint32_t sampleCount;
+
+    /** Exposure time of the middle scanline, microseconds like relTsUs */
+    uint64_t exposureUs;
+
+    float meanAccel[3];
+    float meanGyro[3];
+
+    /** Gyro integrated over the frame interval (trapezoidal), gyro unit times seconds */
+    float rotation[3];
+
+    /** Samples linearly interpolated to 'exposureUs' */
+    float accel[3];
+    float gyro[3];
+} SFrameImu;
+
+/** Receives the rows in frame order, a non-zero return value is passed on by the aggregator */
+typedef int (*FrameImuCallback)(void* context, const SFrameImu* frame);
+
+/** Frames whose exposure time is not reached by the samples yet */
+#define FRAME_AGGREGATOR_MAX_PENDING 32
+
+typedef struct
+{
+    SFrameImu row;
+    double sum[6];
+    double rotation[3];
+    bool interpolated;
+} SFrameBucket;
+
+typedef struct
+{
+    SFraction fps;
+    uint16_t rollingShutterSkewTimeUs;
+    FrameImuCallback onFrame;
+    void* context;
+
+    /** Set by the first sample, only packets of its dataSourceId are aggregated */
+    bool started;
+    uint8_t dataSourceId;
+    SImuPacket previous;
+
+    SFrameBucket current;
+    SFrameBucket pending[FRAME_AGGREGATOR_MAX_PENDING];
+    size_t pendingFirst;
+    size_t pendingCount;
+
+    /** Packets of other sources or with a timestamp going backwards */
+    uint64_t ignored;
+} SFrameAggregator;
+
+void InitFrameAggregator(SFrameAggregator* aggregator, const SMetadataHeader* metaHeader,
+    FrameImuCallback onFrame, void* context);
+
+/** Add the next IMU packet, packets must come in bmdt order */
+int AddImuSample(SFrameAggregator* aggregator, const SImuPacket* packet, uint32_t frameIndex);
+
+/** Emit the remaining frames, the last sample is held for frames exposed after it */
+int FlushFrameAggregator(SFrameAggregator* aggregator);
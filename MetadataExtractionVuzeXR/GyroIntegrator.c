@@ -0,0 +1,204 @@
+/**
+ * @file GyroIntegrator.c
+ * Camera orientation per video frame from the gyro
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "GyroIntegrator.h"
+#include "VuzeMetadata.h"
+
+/* Time of orientation 'key' of the next frame: 0 first row, 1 exposure time, 2 last row */
+static void SetNextKey(SGyroIntegrator* integrator, int key)
+{
+    integrator->nextKey = key;
+    integrator->nextKeyUs = GetFrameStartUs(integrator->next.frame, integrator->fps) +
+        (uint64_t)integrator->rollingShutterSkewTimeUs * key / 2;
+}
+
+static void SetNextFrame(SGyroIntegrator* integrator, uint32_t frame)
+{
+    memset(&integrator->next, 0, sizeof(integrator->next));
+    integrator->next.frame = frame;
+    integrator->next.exposureUs = GetFrameStartUs(frame, integrator->fps) + integrator->rollingShutterSkewTimeUs / 2;
+    SetNextKey(integrator, 0);
+}
+
+/* q * exp(rate * seconds / 2), normalized */
+static void Rotate(const double q[4], const double rate[3], double seconds, double rotated[4])
+{
+    double angle = sqrt(rate[0] * rate[0] + rate[1] * rate[1] + rate[2] * rate[2]) * seconds;
+
+    // below that sin(a/2)/a is 1/2 in double precision
+    double s = angle > 1e-8 ? sin(0.5 * angle) / angle * seconds : 0.5 * seconds;
+    double d[4] = { angle > 1e-8 ? cos(0.5 * angle) : 1.0, rate[0] * s, rate[1] * s, rate[2] * s };
+
+    double r[4] =
+    {
+        q[0] * d[0] - q[1] * d[1] - q[2] * d[2] - q[3] * d[3],
+        q[0] * d[1] + q[1] * d[0] + q[2] * d[3] - q[3] * d[2],
+        q[0] * d[2] - q[1] * d[3] + q[2] * d[0] + q[3] * d[1],
+        q[0] * d[3] + q[1] * d[2] - q[2] * d[1] + q[3] * d[0],
+    };
+
+    double norm = 1.0 / sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3]);
+    for (int i = 0; i < 4; i++)
+    {
+        rotated[i] = r[i] * norm;
+    }
+}
+
+/* Set the next orientation of the next frame, the last one emits the frame */
+static int SetKeyOrientation(SGyroIntegrator* integrator, const double orientation[4])
+{
+    float* keys[3] = { integrator->next.firstRow, integrator->next.orientation, integrator->next.lastRow };
+    for (int i = 0; i < 4; i++)
+    {
+        keys[integrator->nextKey][i] = (float)orientation[i];
+    }
+
+    if (integrator->nextKey < 2)
+    {
+        SetNextKey(integrator, integrator->nextKey + 1);
+        return 0;
+    }
+
+    SFrameOrientation row = integrator->next;
+    SetNextFrame(integrator, row.frame + 1);
+    return integrator->onFrame(integrator->context, &row);
+}
+
+/*
+ * Integrate from the previous sample to 'sample'. Key times of frames in
+ * between get the orientation at that time, with the rate of the interval.
+ */
+static int Step(SGyroIntegrator* integrator, const SGyroSample* sample)
+{
+    const SGyroSample* previous = &integrator->previous;
+    double rate[3];
+    for (int i = 0; i < 3; i++)
+    {
+        double gyro = 0.5 * ((double)previous->gyro[i] + (double)sample->gyro[i]);
+        rate[i] = (gyro - integrator->bias[i]) * integrator->gyroScale;
+    }
+
+    int ret = 0;
+    while (ret == 0 && integrator->nextKeyUs <= sample->relTsUs)
+    {
+        // frames exposed before the first sample hold its orientation
+        uint64_t fromUs = previous->relTsUs;
+        double seconds = integrator->nextKeyUs > fromUs ? (double)(integrator->nextKeyUs - fromUs) * 1e-6 : 0.0;
+
+        double orientation[4];
+        Rotate(integrator->orientation, rate, seconds, orientation);
+        ret = SetKeyOrientation(integrator, orientation);
+    }
+
+    Rotate(integrator->orientation, rate, (double)(sample->relTsUs - previous->relTsUs) * 1e-6, integrator->orientation);
+    integrator->previous = *sample;
+    return ret;
+}
+
+/* Bias from the held samples, then integrate them */
+static int EndBiasWindow(SGyroIntegrator* integrator)
+{
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    for (size_t i = 0; i < integrator->windowCount; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            sum[j] += integrator->window[i].gyro[j];
+        }
+    }
+    for (int j = 0; j < 3; j++)
+    {
+        integrator->bias[j] = sum[j] / (double)integrator->windowCount;
+    }
+    integrator->biasKnown = true;
+
+    int ret = 0;
+    integrator->previous = integrator->window[0];
+    for (size_t i = 1; i < integrator->windowCount && ret == 0; i++)
+    {
+        ret = Step(integrator, &integrator->window[i]);
+    }
+    integrator->windowCount = 0;
+    return ret;
+}
+
+void InitGyroIntegrator(SGyroIntegrator* integrator, const SMetadataHeader* metaHeader, double gyroScale,
+    uint64_t biasWindowUs, FrameOrientationCallback onFrame, void* context)
+{
+    memset(integrator, 0, sizeof(*integrator));
+    integrator->fps = metaHeader->fps;
+    integrator->rollingShutterSkewTimeUs = metaHeader->rollingShutterSkewTimeUs;
+
+    // keys of one frame must come before those of the next one
+    uint64_t frameUs = GetFrameStartUs(1, metaHeader->fps);
+    if (frameUs > 0 && integrator->rollingShutterSkewTimeUs > frameUs)
+    {
+        integrator->rollingShutterSkewTimeUs = (uint16_t)(frameUs < UINT16_MAX ? frameUs : UINT16_MAX);
+    }
+    integrator->gyroScale = gyroScale != 0.0 ? gyroScale : 1.0;
+    integrator->biasWindowUs = biasWindowUs;
+    integrator->onFrame = onFrame;
+    integrator->context = context;
+}
+
+int AddGyroSample(SGyroIntegrator* integrator, const SImuPacket* packet, uint32_t frameIndex)
+{
+    SGyroSample sample = { packet->header.relTsUs, { packet->gyro[0], packet->gyro[1], packet->gyro[2] } };
+
+    if (!integrator->started)
+    {
+        integrator->started = true;
+        integrator->dataSourceId = packet->header.dataSourceId;
+        integrator->biasKnown = integrator->biasWindowUs == 0;
+        integrator->orientation[0] = 1.0;
+        integrator->previous = sample;
+        integrator->lastFrame = frameIndex;
+        SetNextFrame(integrator, frameIndex);
+    }
+    else
+    {
+        uint64_t lastUs = integrator->biasKnown ? integrator->previous.relTsUs :
+            integrator->window[integrator->windowCount - 1].relTsUs;
+        if (packet->header.dataSourceId != integrator->dataSourceId || sample.relTsUs < lastUs)
+        {
+            integrator->ignored++;
+            return 0;
+        }
+        integrator->lastFrame = frameIndex > integrator->lastFrame ? frameIndex : integrator->lastFrame;
+    }
+
+    if (integrator->biasKnown)
+    {
+        return Step(integrator, &sample);
+    }
+
+    integrator->window[integrator->windowCount++] = sample;
+    if (sample.relTsUs - integrator->window[0].relTsUs >= integrator->biasWindowUs ||
+        integrator->windowCount == GYRO_BIAS_MAX_SAMPLES)
+    {
+        return EndBiasWindow(integrator);
+    }
+    return 0;
+}
+
+int FlushGyroIntegrator(SGyroIntegrator* integrator)
+{
+    if (!integrator->started)
+    {
+        return 0;
+    }
+
+    int ret = integrator->biasKnown ? 0 : EndBiasWindow(integrator);
+    while (ret == 0 && integrator->next.frame <= integrator->lastFrame)
+    {
+        ret = SetKeyOrientation(integrator, integrator->orientation);
+    }
+
+    integrator->started = false;
+    return ret;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file GyroIntegrator.h
+ * Camera orientation per video frame from the gyro
+ *
+ * The orientation is integrated sample by sample as a quaternion,
+ * q <- q * exp(w * dt / 2), with w the mean rate of the two samples minus the
+ * gyro bias. The bias is the mean rate over the first 'biasWindowUs' of the
+ * recording, the camera is expected to rest there; the samples of that
+ * window are held back and integrated once the bias is known. Orientations
+ * are sampled at the exposure time of each frame, like SFrameImu, and at
+ * the exposure of its first and last scanline for the rolling shutter.
+ *
+ * The gyro axes are taken as the image axes: x right, y up, z forward.
+ * The unit is rad/s times 'gyroScale' (pi / 180 for deg/s).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MetadataFormat.h"
+
+/** One row per video frame from the frame of the first IMU sample to the one of the last */
+typedef struct
+{
+    uint32_t frame;
+
+    /** Exposure time of the middle scanline, microseconds like relTsUs */
+    uint64_t exposureUs;
+
+    /** Camera to reference orientation (w, x, y, z), the reference being the camera at the first sample */
+    float orientation[4];
+
+    /** The same at the first and the last scanline: frame start and frame start + rollingShutterSkewTimeUs */
+    float firstRow[4];
+    float lastRow[4];
+} SFrameOrientation;
+
+/** Receives the rows in frame order, a non-zero return value is passed on by the integrator */
+typedef int (*FrameOrientationCallback)(void* context, const SFrameOrientation* frame);
+
+/** Default of 'biasWindowUs' */
+#define GYRO_BIAS_WINDOW_US 1000000
+
+/** Samples held for the bias, a longer window ends here */
+#define GYRO_BIAS_MAX_SAMPLES 2048
+
+typedef struct
+{
+    uint64_t relTsUs;
+    float gyro[3];
+} SGyroSample;
+
+typedef struct
+{
+    SFraction fps;
+    uint16_t rollingShutterSkewTimeUs;
+    double gyroScale;
+    uint64_t biasWindowUs;
+    FrameOrientationCallback onFrame;
+    void* context;
+
+    /** Set by the first sample, only packets of its dataSourceId are integrated */
+    bool started;
+    uint8_t dataSourceId;
+
+    /** Samples of the bias window, integrated once 'biasKnown' */
+    SGyroSample window[GYRO_BIAS_MAX_SAMPLES];
+    size_t windowCount;
+    bool biasKnown;
+    double bias[3];
+
+    /** Orientation at 'previous' */
+    SGyroSample previous;
+    double orientation[4];
+
+    /** Next frame to emit, its orientations up to 'nextKey' (first row, exposure, last row) are set */
+    SFrameOrientation next;
+    int nextKey;
+    uint64_t nextKeyUs;
+    uint32_t lastFrame;
+
+    /** Packets of other sources or with a timestamp going backwards */
+    uint64_t ignored;
+} SGyroIntegrator;
+
+/** 'gyroScale' 0 is 1 (rad/s), 'biasWindowUs' 0 integrates without bias removal */
+void InitGyroIntegrator(SGyroIntegrator* integrator, const SMetadataHeader* metaHeader, double gyroScale,
+    uint64_t biasWindowUs, FrameOrientationCallback onFrame, void* context);
+
+/** Add the next IMU packet, packets must come in bmdt order */
+int AddGyroSample(SGyroIntegrator* integrator, const SImuPacket* packet, uint32_t frameIndex);
+
+/** Emit the remaining frames, the orientation of the last sample is held for frames exposed after it */
+int FlushGyroIntegrator(SGyroIntegrator* integrator);
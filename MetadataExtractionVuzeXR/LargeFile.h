@@ -0,0 +1,20 @@
+/**
+ * @file LargeFile.h
+ * 64-bit off_t, fseeko() and ftello() under MSVC
+ *
+ * GCC and MinGW get them with _FILE_OFFSET_BITS 64, defined by each source
+ * file before its first include. The off_t of MSVC is 32 bits and it has no
+ * fseeko(), the 64-bit __int64, _fseeki64() and _ftelli64() replace them.
+ * sys/types.h is included first so that its own off_t is left alone.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#if defined(_MSC_VER)
+#define off_t __int64
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
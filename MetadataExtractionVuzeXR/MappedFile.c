@@ -0,0 +1,105 @@
+/**
+ * @file MappedFile.c
+ * Read-only memory mapping of a byte range of an open file
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <string.h>
+
+#include "MappedFile.h"
+
+#if _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static uint64_t GetMapGranularity(void)
+{
+#if _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int MapFileRange(FILE* file, off_t offset, size_t size, SMappedRange* out)
+{
+    memset(out, 0, sizeof(*out));
+
+    if (offset < 0 || size == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Mapping offset has to be aligned, the slack is hidden behind 'data'
+    uint64_t granularity = GetMapGranularity();
+    uint64_t alignedOffset = (uint64_t)offset / granularity * granularity;
+    size_t slack = (size_t)((uint64_t)offset - alignedOffset);
+    size_t baseSize = size + slack;
+
+#if _WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_READ,
+        (DWORD)(alignedOffset >> 32), (DWORD)alignedOffset, baseSize);
+    if (base == NULL)
+    {
+        CloseHandle(mapping);
+        errno = EIO;
+        return -1;
+    }
+    out->mapping = mapping;
+#else
+    void* base = mmap(NULL, baseSize, PROT_READ, MAP_PRIVATE, fileno(file), (off_t)alignedOffset);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // Packets are walked strictly front to back
+    madvise(base, baseSize, MADV_SEQUENTIAL);
+#endif
+
+    out->base = base;
+    out->baseSize = baseSize;
+    out->data = (const uint8_t*)base + slack;
+    out->size = size;
+    return 0;
+}
+
+void UnmapFileRange(SMappedRange* range)
+{
+    if (range->base == NULL)
+    {
+        return;
+    }
+
+#if _WIN32
+    UnmapViewOfFile(range->base);
+    CloseHandle(range->mapping);
+#else
+    munmap(range->base, range->baseSize);
+#endif
+
+    memset(range, 0, sizeof(*range));
+}
@@ -0,0 +1,43 @@
+/**
+ * @file MappedFile.h
+ * Read-only memory mapping of a byte range of an open file
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "LargeFile.h"
+
+typedef struct
+{
+    /** First byte of the requested range */
+    const uint8_t* data;
+
+    /** Size of the requested range in bytes */
+    size_t size;
+
+    /** Start of the whole mapping, aligned down to the mapping granularity */
+    void* base;
+
+    /** Size of the whole mapping */
+    size_t baseSize;
+
+#if _WIN32
+    /** File mapping object handle */
+    void* mapping;
+#endif
+} SMappedRange;
+
+/**
+ * Map [offset, offset + size) of an open file read-only.
+ * The file may be closed after mapping, the mapping stays valid until UnmapFileRange().
+ * @return 0 on success, -1 on failure (errno is set)
+ */
+int MapFileRange(FILE* file, off_t offset, size_t size, SMappedRange* out);
+
+/** Release a mapping created by MapFileRange(), safe to call on a zeroed struct */
+void UnmapFileRange(SMappedRange* range);
@@ -0,0 +1,427 @@
+/**
+ * @file MetadataFollower.c
+ * Decoding the metadata of a MOV/MP4 file that is still growing
+ */
+
+// Instruct GCC to use 64-bit off_t/fseeko/ftello, which is not the default on MinGW
+#define _FILE_OFFSET_BITS 64
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "AtomLocator.h"
+#include "MetadataFollower.h"
+
+#if _WIN32
+#include <windows.h>
+#endif
+
+static void SleepMs(unsigned ms)
+{
+#if _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+int OpenMetadataFollower(SMetadataFollower* follower, FILE* mov)
+{
+    memset(follower, 0, sizeof(*follower));
+    follower->pending = malloc(FOLLOW_CHUNK_SIZE);
+    if (follower->pending == NULL)
+    {
+        return -1;
+    }
+
+    // reads go straight to the file, a stdio buffer would read ahead past the end and again later
+    setvbuf(mov, NULL, _IONBF, 0);
+    follower->mov = mov;
+    return 0;
+}
+
+void CloseMetadataFollower(SMetadataFollower* follower)
+{
+    free(follower->pending);
+    follower->pending = NULL;
+}
+
+/* Atoms that can hold a udta with a bmdt, below 'parent' (0 for the top level) */
+static bool IsBmdtContainer(uint32_t parent, uint32_t type)
+{
+    switch (parent)
+    {
+    case 0:
+        return type == ATOM_TAG('m', 'o', 'o', 'v') || type == ATOM_TAG('m', 'o', 'o', 'f');
+    case ATOM_TAG('m', 'o', 'o', 'v'):
+    case ATOM_TAG('t', 'r', 'a', 'f'):
+        return type == ATOM_TAG('u', 'd', 't', 'a');
+    case ATOM_TAG('m', 'o', 'o', 'f'):
+        return type == ATOM_TAG('u', 'd', 't', 'a') || type == ATOM_TAG('t', 'r', 'a', 'f');
+    default:
+        return false;
+    }
+}
+
+/*
+ * Read the next atom header and step into it or over it, 'moved' stays
+ * false if the header is not written yet
+ */
+static int ReadNextAtom(SMetadataFollower* follower, bool* moved)
+{
+    *moved = true;
+    while (follower->depth > 0 && follower->position >= follower->containerEnds[follower->depth - 1])
+    {
+        follower->depth--;
+    }
+
+    // the top level ends wherever the writer stops
+    uint64_t end = follower->depth > 0 ? follower->containerEnds[follower->depth - 1] : UINT64_MAX;
+    uint64_t left = end - follower->position;
+    if (left < 8 && follower->depth == 0)
+    {
+        // nothing can follow at the top level, wait for the timeout
+        *moved = false;
+        return 0;
+    }
+    if (left < 8)
+    {
+        // padding at the end of a container
+        follower->position = end;
+        return 0;
+    }
+
+    if (follower->depth == 0 && follower->openAtomFileSize == follower->fileSize)
+    {
+        *moved = false;
+        return 0;
+    }
+
+    // wait for the 64-bit largesize too, if it fits into the container
+    if (follower->fileSize < follower->position + (left < 16 ? left : 16))
+    {
+        *moved = false;
+        return 0;
+    }
+
+    SAtom atom;
+    clearerr(follower->mov);
+    int ret = ReadAtomHeader(follower->mov, follower->position, end, &atom);
+    if (ret == -1)
+    {
+        perror("Failed to read atom header");
+        return -1;
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "Invalid atom at offset %" PRIu64 "!\n", follower->position);
+        return -1;
+    }
+    follower->bytesRead += atom.offset - atom.start;
+
+    uint32_t parent = follower->depth > 0 ? follower->containerTypes[follower->depth - 1] : 0;
+    if (follower->depth < FOLLOW_MAX_DEPTH && IsBmdtContainer(parent, atom.type))
+    {
+        follower->containerEnds[follower->depth] = atom.offset + atom.size;
+        follower->containerTypes[follower->depth] = atom.type;
+        follower->depth++;
+        follower->position = atom.offset;
+    }
+    else if (atom.type == ATOM_TAG('b', 'm', 'd', 't') && (parent == 0 || parent == ATOM_TAG('u', 'd', 't', 'a')))
+    {
+        follower->inBmdt = true;
+        follower->bmdtOffset = atom.offset;
+        follower->bmdtEnd = atom.offset + atom.size;
+        follower->pendingOffset = atom.offset;
+        follower->pendingSize = 0;
+        follower->position = atom.offset;
+    }
+    else if (follower->depth == 0 && atom.offset + atom.size == end)
+    {
+        // size 0 at the top level, an mdat still being recorded: its size is written when it is
+        // complete, read the header again after the file grew
+        follower->openAtomFileSize = follower->fileSize;
+        *moved = false;
+    }
+    else
+    {
+        // mdat and everything else is skipped unread, also while it is still being written
+        follower->position = atom.offset + atom.size;
+        follower->openAtomFileSize = 0;
+    }
+    return 0;
+}
+
+/* Report the bytes skipped since the corrupt packet at 'resyncOffset', up to bmdt offset 'offset' */
+static void EndResync(SMetadataFollower* follower, const SMetadataCallbacks* callbacks, uint64_t offset)
+{
+    follower->resyncing = false;
+    if (callbacks->onResync != NULL)
+    {
+        callbacks->onResync(callbacks->context, follower->resyncOffset, offset - follower->resyncOffset);
+    }
+}
+
+/* Decode the complete packets of the pending bytes, keep a partial one */
+static int DecodePending(SMetadataFollower* follower, const SMetadataCallbacks* callbacks, uint64_t* delivered)
+{
+    int ret = 0;
+    size_t used = 0;
+
+    // the whole bmdt is read, a partial packet will not be completed
+    bool atEnd = follower->position == follower->bmdtEnd;
+
+    // runs of packets are passed on in place, before the pending bytes move
+    SPacketRun run;
+    InitPacketRun(&run, callbacks, follower->header.fps);
+
+    while (ret == 0 && follower->pendingSize - used >= sizeof(uint16_t))
+    {
+        const uint8_t* ptr = follower->pending + used;
+        size_t left = follower->pendingSize - used;
+        uint64_t offset = follower->pendingOffset - follower->bmdtOffset;
+
+        if (follower->resyncing)
+        {
+            bool found;
+            size_t next = FindResyncPoint(ptr, left, follower->lastTsUs, atEnd, &found);
+            used += next;
+            follower->pendingOffset += next;
+            if (!found && !atEnd)
+            {
+                break;
+            }
+            EndResync(follower, callbacks, offset + next);
+            continue;
+        }
+
+        uint16_t length;
+        memcpy(&length, ptr, sizeof(length));
+        size_t totalLength = length + sizeof(uint16_t);
+
+        if (offset == 0 && totalLength == sizeof(SMetadataHeader))
+        {
+            // no packet has the size of the header, a bmdt of a fragment may start with one or not
+            if (left < totalLength)
+            {
+                break;
+            }
+            ret = FlushPacketRun(&run);
+            memcpy(&follower->header, ptr, sizeof(follower->header));
+            run.fps = follower->header.fps;
+            if (ret == 0 && !follower->hasHeader && callbacks->onHeader != NULL)
+            {
+                ret = callbacks->onHeader(callbacks->context, &follower->header);
+            }
+            follower->hasHeader = true;
+        }
+        else if (!follower->hasHeader)
+        {
+            fprintf(stderr, "bmdt does not start with a metadata header!\n");
+            return -1;
+        }
+        else if (follower->resync && left < sizeof(SMetadataPacketHeader))
+        {
+            // a packet is told from garbage by its header
+            break;
+        }
+        else if (totalLength < sizeof(SMetadataPacketHeader) && !follower->resync)
+        {
+            FlushPacketRun(&run);
+            fprintf(stderr, "Truncated packet at bmdt offset %" PRIu64 "!\n", offset);
+            return -1;
+        }
+        else if (left < totalLength && !follower->resync)
+        {
+            break;
+        }
+        else
+        {
+            // with resync a corrupt length is not waited for, only the rest of a valid packet
+            const SMetadataPacketHeader* header = (const SMetadataPacketHeader*)ptr;
+            bool valid = totalLength == GetPacketSize(header->typeId);
+            if (valid && left < totalLength && !atEnd)
+            {
+                break;
+            }
+
+            if (valid && left >= totalLength)
+            {
+                follower->lastTsUs = ContinueTimestamp(follower->lastTsUs, follower->hasLastTs, header->relTsUs);
+                follower->hasLastTs = true;
+                ret = AddPacketToRun(&run, header);
+                (*delivered)++;
+            }
+            else
+            {
+                ret = FlushPacketRun(&run);
+                if (callbacks->onCorrupt != NULL)
+                {
+                    callbacks->onCorrupt(callbacks->context, header, offset);
+                }
+                if (follower->resync)
+                {
+                    // search from the next byte on
+                    follower->resyncing = true;
+                    follower->resyncOffset = offset;
+                    totalLength = 1;
+                }
+            }
+        }
+
+        used += totalLength;
+        follower->pendingOffset += totalLength;
+    }
+
+    if (ret == 0)
+    {
+        ret = FlushPacketRun(&run);
+    }
+    memmove(follower->pending, follower->pending + used, follower->pendingSize - used);
+    follower->pendingSize -= used;
+    return ret;
+}
+
+/*
+ * Read and decode the next chunk of the bmdt written so far, 'moved' stays
+ * false if nothing new is written yet
+ */
+static int ReadBmdt(SMetadataFollower* follower, const SMetadataCallbacks* callbacks, uint64_t* delivered,
+    bool* moved)
+{
+    uint64_t end = follower->bmdtEnd < follower->fileSize ? follower->bmdtEnd : follower->fileSize;
+    *moved = false;
+
+    if (follower->position < end)
+    {
+        // at most one partial packet is pending, far less than a chunk
+        size_t length = FOLLOW_CHUNK_SIZE - follower->pendingSize;
+        if (end - follower->position < length)
+        {
+            length = (size_t)(end - follower->position);
+        }
+
+        clearerr(follower->mov);
+        if (fseeko(follower->mov, (off_t)follower->position, SEEK_SET) != 0 ||
+            fread(follower->pending + follower->pendingSize, 1, length, follower->mov) != length)
+        {
+            perror("Failed to read 'bmdt'");
+            return -1;
+        }
+        follower->position += length;
+        follower->pendingSize += length;
+        follower->bytesRead += length;
+        *moved = true;
+
+        int ret = DecodePending(follower, callbacks, delivered);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (follower->position == follower->bmdtEnd)
+    {
+        if (follower->resyncing)
+        {
+            EndResync(follower, callbacks, follower->bmdtEnd - follower->bmdtOffset);
+        }
+        else if (follower->pendingSize > 0)
+        {
+            fprintf(stderr, "Truncated packet at bmdt offset %" PRIu64 "!\n",
+                follower->pendingOffset - follower->bmdtOffset);
+        }
+        follower->inBmdt = false;
+        follower->pendingSize = 0;
+        *moved = true;
+    }
+    return 0;
+}
+
+int PollMetadataFollower(SMetadataFollower* follower, const SMetadataCallbacks* callbacks, uint64_t* delivered)
+{
+    SFileIdentity identity;
+    if (GetFileIdentity(follower->mov, &identity) != 0)
+    {
+        perror("Failed to get the file size");
+        return -1;
+    }
+    follower->fileSize = identity.size;
+
+    bool moved = true;
+    int ret = 0;
+    while (ret == 0 && moved)
+    {
+        ret = follower->inBmdt ? ReadBmdt(follower, callbacks, delivered, &moved) : ReadNextAtom(follower, &moved);
+    }
+    return ret;
+}
+
+int FollowMetadata(FILE* mov, const SFollowOptions* options, const SMetadataCallbacks* callbacks)
+{
+    static const SFollowOptions defaults = { FOLLOW_POLL_MS, FOLLOW_IDLE_TIMEOUT_MS, NULL, NULL, false };
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+
+    SMetadataFollower follower;
+    if (OpenMetadataFollower(&follower, mov) != 0)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    follower.resync = options->resync;
+
+    SFileIdentity identity;
+    uint64_t lastSize = GetFileIdentity(mov, &identity) == 0 ? identity.size : 0;
+    double lastGrowth = GetProfileWallSeconds();
+    int ret = 0;
+
+    for (;;)
+    {
+        uint64_t delivered = 0;
+        ret = PollMetadataFollower(&follower, callbacks, &delivered);
+        if (delivered > 0 && options->onPoll != NULL)
+        {
+            options->onPoll(callbacks->context);
+        }
+        if (ret != 0)
+        {
+            break;
+        }
+
+        double now = GetProfileWallSeconds();
+        if (follower.fileSize != lastSize)
+        {
+            lastSize = follower.fileSize;
+            lastGrowth = now;
+        }
+        else if (options->idleTimeoutMs == 0 || (now - lastGrowth) * 1000.0 >= options->idleTimeoutMs)
+        {
+            break;
+        }
+        SleepMs(options->pollIntervalMs);
+    }
+
+    if (ret == 0 && !follower.hasHeader)
+    {
+        fprintf(stderr, "No 'bmdt' with a metadata header found\n");
+        ret = -1;
+    }
+    else if (ret == 0 && follower.inBmdt && follower.bmdtEnd != UINT64_MAX)
+    {
+        fprintf(stderr, "File stopped growing %" PRIu64 " bytes before the end of 'bmdt'\n",
+            follower.bmdtEnd - follower.position);
+    }
+
+    if (options->profile != NULL)
+    {
+        options->profile->bytesRead += follower.bytesRead;
+    }
+    CloseMetadataFollower(&follower);
+    return ret;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file MetadataFollower.h
+ * Decoding the metadata of a MOV/MP4 file that is still growing
+ *
+ * The follower walks the atoms of the file as far as it has been written
+ * and remembers where it stopped, a later poll continues from there. Every
+ * byte is read once: atom headers when they are complete, bmdt payload in
+ * chunks whose trailing partial packet is kept until the rest arrives, all
+ * other atoms (mdat) are skipped by their size without being read.
+ *
+ * Metadata is taken from every bmdt atom in the top level or in a udta of
+ * moov, moof or moof/traf, in file order. This covers
+ *   - a finished recording being copied, moov/udta/bmdt arrives last
+ *   - fragmented recordings, one moof/udta/bmdt per fragment
+ *   - a bmdt that is still being appended to, with its final size or size 0
+ *     ("up to the end of the file")
+ *   - an mdat with size 0 while it is recorded, its size written and moov
+ *     appended at the end; the follower waits at its header until then
+ * A bmdt may start with the SMetadataHeader (required for the first one);
+ * onHeader is called once, later headers only update the frame rate.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "MetadataFormat.h"
+#include "Profiler.h"
+#include "VuzeMetadata.h"
+
+/** Bytes of bmdt read at once */
+#define FOLLOW_CHUNK_SIZE (256 * 1024)
+
+/** Containers of bmdt: moov/udta, moof/udta, moof/traf/udta */
+#define FOLLOW_MAX_DEPTH 3
+
+#define FOLLOW_POLL_MS 100
+#define FOLLOW_IDLE_TIMEOUT_MS 10000
+
+typedef struct
+{
+    FILE* mov;
+
+    /** Next atom header to read, or next bmdt byte to read */
+    uint64_t position;
+
+    /** Ends of the containers 'position' is in, innermost last */
+    uint64_t containerEnds[FOLLOW_MAX_DEPTH];
+    uint32_t containerTypes[FOLLOW_MAX_DEPTH];
+    int depth;
+
+    /** Inside a bmdt payload starting at 'bmdtOffset' and ending at 'bmdtEnd' (UINT64_MAX if growing) */
+    bool inBmdt;
+    uint64_t bmdtOffset;
+    uint64_t bmdtEnd;
+
+    /** bmdt bytes read but not decoded yet, a packet still being written, starting at 'pendingOffset' */
+    uint8_t* pending;
+    size_t pendingSize;
+    uint64_t pendingOffset;
+
+    SMetadataHeader header;
+    bool hasHeader;
+
+    /** Search for the next packet after a corrupt one (SFollowOptions.resync), since 'resyncOffset' if 'resyncing' */
+    bool resync;
+    bool resyncing;
+    uint64_t resyncOffset;
+    uint64_t lastTsUs;
+    bool hasLastTs;
+
+    /** File size at the last poll */
+    uint64_t fileSize;
+
+    /** File size when the top-level atom at 'position' had size 0, its header is read again once the file grows */
+    uint64_t openAtomFileSize;
+
+    /** Atom headers and bmdt bytes read so far */
+    uint64_t bytesRead;
+} SMetadataFollower;
+
+typedef struct
+{
+    /** Pause between polls once the end of the file is reached, bounds the latency of new packets */
+    unsigned pollIntervalMs;
+
+    /** Stop once the file has not grown for this long, 0: stop at the first poll without new data */
+    unsigned idleTimeoutMs;
+
+    /** Called after every poll that delivered packets, to flush buffered output; may be NULL */
+    void (*onPoll)(void* context);
+
+    /** Receives the bytes read, may be NULL (see Profiler.h) */
+    SProfile* profile;
+
+    /** See SDecodeOptions.resync */
+    bool resync;
+} SFollowOptions;
+
+/**
+ * Start following 'mov' from its first atom. The file is switched to
+ * unbuffered stdio, reads are done in FOLLOW_CHUNK_SIZE chunks by the follower.
+ * @return 0 on success, -1 if out of memory
+ */
+int OpenMetadataFollower(SMetadataFollower* follower, FILE* mov);
+
+void CloseMetadataFollower(SMetadataFollower* follower);
+
+/**
+ * Decode everything that was appended since the last poll.
+ * @param delivered increased by the number of packets passed to the callbacks
+ * @return 0 on success, the non-zero return of a callback, -1 on a read error
+ *         or a packet that can not be skipped
+ */
+int PollMetadataFollower(SMetadataFollower* follower, const SMetadataCallbacks* callbacks, uint64_t* delivered);
+
+/**
+ * Poll 'mov' until it stops growing for options->idleTimeoutMs, pausing
+ * options->pollIntervalMs whenever the end of the file is reached.
+ * @param options may be NULL for FOLLOW_POLL_MS and FOLLOW_IDLE_TIMEOUT_MS
+ */
+int FollowMetadata(FILE* mov, const SFollowOptions* options, const SMetadataCallbacks* callbacks);
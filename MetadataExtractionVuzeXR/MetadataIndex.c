@@ -0,0 +1,308 @@
+/**
+ * @file MetadataIndex.c
+ * Persistent index of the bmdt atom
+ */
+
+// Instruct GCC to use 64-bit off_t/fseeko/ftello, which is not the default on MinGW
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "MappedFile.h"
+#include "MetadataIndex.h"
+#include "VuzeMetadata.h"
+
+_Static_assert(sizeof(SMetadataIndexHeader) == 128, "index header must be 128 bytes");
+_Static_assert(sizeof(SIndexEntry) == 16, "index entry must be 16 bytes");
+
+typedef struct
+{
+    SIndexEntry* entries;
+    size_t capacity;
+} SEntryBuffer;
+
+static int AppendEntry(SMetadataIndex* index, SEntryBuffer* buffer, uint8_t typeId, uint64_t relTsUs,
+    uint64_t offset)
+{
+    uint32_t count = index->header.entryCount[typeId];
+    if (count == buffer->capacity)
+    {
+        size_t capacity = buffer->capacity != 0 ? buffer->capacity * 2 : 256;
+        SIndexEntry* entries = realloc(buffer->entries, capacity * sizeof(SIndexEntry));
+        if (entries == NULL)
+        {
+            perror("Failed to grow index");
+            return -1;
+        }
+        buffer->entries = entries;
+        buffer->capacity = capacity;
+    }
+
+    buffer->entries[count].relTsUs = relTsUs;
+    buffer->entries[count].offset = offset;
+    index->header.entryCount[typeId] = count + 1;
+    return 0;
+}
+
+int BuildMetadataIndex(FILE* mov, SMetadataIndex* index)
+{
+    memset(index, 0, sizeof(*index));
+
+    SAtomLocation location;
+    if (LocateBmdt(mov, &location) != 0)
+    {
+        return -1;
+    }
+
+    SMappedRange bmdt;
+    if ((size_t)location.bmdt.size != location.bmdt.size ||
+        MapFileRange(mov, (off_t)location.bmdt.offset, (size_t)location.bmdt.size, &bmdt) != 0)
+    {
+        perror("Failed to map 'moov/udta/bmdt'");
+        return -1;
+    }
+
+    if (bmdt.size < sizeof(SMetadataHeader))
+    {
+        fprintf(stderr, "bmdt too short for metadata header!\n");
+        UnmapFileRange(&bmdt);
+        return -1;
+    }
+
+    SMetadataIndexHeader* header = &index->header;
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->version = INDEX_VERSION;
+    header->stride = INDEX_STRIDE;
+    header->fileSize = location.file.size;
+    header->fileMtime = location.file.mtime;
+    header->bmdtOffset = location.bmdt.offset;
+    header->bmdtSize = location.bmdt.size;
+    memcpy(&header->metaHeader, bmdt.data, sizeof(SMetadataHeader));
+    header->monotonic = (1u << PACKET_TYPE_COUNT) - 1;
+
+    SEntryBuffer buffers[PACKET_TYPE_COUNT] = { { 0 } };
+    uint64_t lastTsUs[PACKET_TYPE_COUNT] = { 0 };
+    uint64_t offset = sizeof(SMetadataHeader);
+    int ret = 0;
+
+    // only the packet headers are touched, corrupt packets are skipped by length like the decoder does
+    while (ret == 0 && bmdt.size - offset >= sizeof(SMetadataPacketHeader))
+    {
+        const SMetadataPacketHeader* packet = (const SMetadataPacketHeader*)(bmdt.data + offset);
+        size_t totalLength = packet->length + sizeof(uint16_t);
+
+        if (totalLength < sizeof(SMetadataPacketHeader) || totalLength > bmdt.size - offset)
+        {
+            break;
+        }
+
+        uint8_t typeId = packet->typeId;
+        if (totalLength == GetPacketSize(typeId))
+        {
+            uint64_t packetIndex = header->packetCount[typeId]++;
+            if (packetIndex > 0 && packet->relTsUs < lastTsUs[typeId])
+            {
+                header->monotonic &= ~(1u << typeId);
+            }
+            lastTsUs[typeId] = packet->relTsUs;
+
+            if (packetIndex % INDEX_STRIDE == 0)
+            {
+                ret = AppendEntry(index, &buffers[typeId], typeId, packet->relTsUs, offset);
+            }
+        }
+
+        offset += totalLength;
+    }
+
+    UnmapFileRange(&bmdt);
+
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        index->entries[type] = buffers[type].entries;
+    }
+    if (ret != 0)
+    {
+        FreeMetadataIndex(index);
+    }
+    return ret;
+}
+
+int LoadMetadataIndex(const char* path, FILE* mov, SMetadataIndex* index)
+{
+    memset(index, 0, sizeof(*index));
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    SMetadataIndexHeader* header = &index->header;
+    SFileIdentity identity;
+    int ret = 0;
+
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        header->version != INDEX_VERSION ||
+        GetFileIdentity(mov, &identity) != 0 ||
+        header->fileSize != identity.size ||
+        header->fileMtime != identity.mtime ||
+        header->bmdtOffset > header->fileSize ||
+        header->bmdtSize > header->fileSize - header->bmdtOffset)
+    {
+        ret = -2;
+    }
+
+    for (int type = 0; ret == 0 && type < PACKET_TYPE_COUNT; type++)
+    {
+        uint32_t count = header->entryCount[type];
+        if (count == 0)
+        {
+            continue;
+        }
+
+        index->entries[type] = malloc(count * sizeof(SIndexEntry));
+        if (index->entries[type] == NULL ||
+            fread(index->entries[type], sizeof(SIndexEntry), count, file) != count)
+        {
+            ret = -2;
+        }
+
+        // a seek must land on a packet inside the bmdt, in the order the packets were indexed
+        for (uint32_t i = 0; ret == 0 && i < count; i++)
+        {
+            uint64_t offset = index->entries[type][i].offset;
+            if (offset < sizeof(SMetadataHeader) || offset >= header->bmdtSize ||
+                (i > 0 && offset <= index->entries[type][i - 1].offset))
+            {
+                ret = -2;
+            }
+        }
+    }
+
+    fclose(file);
+    if (ret != 0)
+    {
+        FreeMetadataIndex(index);
+    }
+    return ret;
+}
+
+int SaveMetadataIndex(const char* path, const SMetadataIndex* index)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    int ret = 0;
+    if (fwrite(&index->header, sizeof(index->header), 1, file) != 1)
+    {
+        ret = -1;
+    }
+
+    for (int type = 0; ret == 0 && type < PACKET_TYPE_COUNT; type++)
+    {
+        uint32_t count = index->header.entryCount[type];
+        if (count > 0 && fwrite(index->entries[type], sizeof(SIndexEntry), count, file) != count)
+        {
+            ret = -1;
+        }
+    }
+
+    if (fclose(file) != 0 || ret != 0)
+    {
+        perror(path);
+        // a partial index would be rejected on load anyway, but do not leave it around
+        remove(path);
+        return -1;
+    }
+    return 0;
+}
+
+int OpenMetadataIndex(const char* moviePath, FILE* mov, SMetadataIndex* index, bool* built)
+{
+    char path[1024];
+    int length = snprintf(path, sizeof(path), "%s%s", moviePath, INDEX_EXTENSION);
+    if (length < 0 || (size_t)length >= sizeof(path))
+    {
+        fprintf(stderr, "%s%s: Path is too long\n", moviePath, INDEX_EXTENSION);
+        return -1;
+    }
+
+    if (built != NULL)
+    {
+        *built = false;
+    }
+
+    if (LoadMetadataIndex(path, mov, index) == 0)
+    {
+        return 0;
+    }
+
+    if (BuildMetadataIndex(mov, index) != 0)
+    {
+        return -1;
+    }
+
+    if (built != NULL)
+    {
+        *built = true;
+    }
+    SaveMetadataIndex(path, index);
+    return 0;
+}
+
+void FreeMetadataIndex(SMetadataIndex* index)
+{
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        free(index->entries[type]);
+        index->entries[type] = NULL;
+    }
+}
+
+uint64_t FindIndexedOffset(const SMetadataIndex* index, uint64_t relTsUs)
+{
+    uint64_t start = UINT64_MAX;
+
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        const SIndexEntry* entries = index->entries[type];
+        uint32_t count = index->header.entryCount[type];
+        if (count == 0)
+        {
+            continue;
+        }
+
+        if ((index->header.monotonic & (1u << type)) == 0)
+        {
+            start = entries[0].offset < start ? entries[0].offset : start;
+            continue;
+        }
+
+        // last entry before relTsUs: the packets up to the next entry may still be in range
+        uint32_t low = 0;
+        uint32_t high = count;
+        while (high - low > 1)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            if (entries[middle].relTsUs < relTsUs)
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        start = entries[low].offset < start ? entries[low].offset : start;
+    }
+
+    return start != UINT64_MAX ? start : sizeof(SMetadataHeader);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file MetadataIndex.h
+ * Persistent index of the bmdt atom, stored next to the movie as "<movie>.vzidx"
+ *
+ * File layout, all little-endian:
+ *   SMetadataIndexHeader                                  (128 bytes)
+ *   SIndexEntry[entryCount[type]] for every packet type   (16 bytes each)
+ *
+ * The index is valid for one version of the movie, identified by its size
+ * and modification time (see SFileIdentity). It holds everything needed to
+ * decode without walking the atoms: bmdt location, the metadata header and,
+ * per packet type, the timestamp and bmdt offset of every INDEX_STRIDE-th
+ * packet.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "AtomLocator.h"
+#include "MetadataFormat.h"
+
+#define INDEX_MAGIC "VZIDX1"
+#define INDEX_VERSION 2
+#define INDEX_EXTENSION ".vzidx"
+
+/** Every n-th packet of a type gets an index entry, the first one always */
+#define INDEX_STRIDE 64
+
+#pragma pack(push, 1)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t stride;
+
+    /** Movie the index belongs to, 'fileMtime' is SFileIdentity.mtime (version 2, seconds before) */
+    uint64_t fileSize;
+    int64_t fileMtime;
+
+    /** Absolute offset and size of the bmdt payload */
+    uint64_t bmdtOffset;
+    uint64_t bmdtSize;
+
+    SMetadataHeader metaHeader;
+    uint16_t padding;
+
+    /** Bit per packet type, set if relTsUs never decreases within that type */
+    uint32_t monotonic;
+
+    uint32_t entryCount[PACKET_TYPE_COUNT];
+    uint64_t packetCount[PACKET_TYPE_COUNT];
+
+    uint8_t reserved[12];
+} SMetadataIndexHeader;
+
+typedef struct
+{
+    uint64_t relTsUs;
+
+    /** Offset of the packet relative to the bmdt payload */
+    uint64_t offset;
+} SIndexEntry;
+
+#pragma pack(pop)
+
+typedef struct
+{
+    SMetadataIndexHeader header;
+    SIndexEntry* entries[PACKET_TYPE_COUNT];
+} SMetadataIndex;
+
+/** Index the bmdt atom of an open movie, one pass over the packet headers */
+int BuildMetadataIndex(FILE* mov, SMetadataIndex* index);
+
+/**
+ * Load an index file and check it against the open movie.
+ * @return 0 on success, -1 if it cannot be read, -2 if it is invalid or stale
+ */
+int LoadMetadataIndex(const char* path, FILE* mov, SMetadataIndex* index);
+
+int SaveMetadataIndex(const char* path, const SMetadataIndex* index);
+
+/**
+ * Load the sidecar index of 'moviePath', build and save it if it is missing
+ * or stale. Failing to save is reported, the built index is usable anyway.
+ * @param built set to true if the index was rebuilt, may be NULL
+ */
+int OpenMetadataIndex(const char* moviePath, FILE* mov, SMetadataIndex* index, bool* built);
+
+void FreeMetadataIndex(SMetadataIndex* index);
+
+/**
+ * Offset relative to the bmdt payload to start decoding from, so that every
+ * packet with a timestamp of at least 'relTsUs' is decoded. Binary search
+ * per packet type, types without monotonic timestamps start at the first packet.
+ */
+uint64_t FindIndexedOffset(const SMetadataIndex* index, uint64_t relTsUs);
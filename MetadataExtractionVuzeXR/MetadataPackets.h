@@ -0,0 +1,28 @@
+/**
+ * @file MetadataPackets.h
+ * The packet types of MetadataFormat.h, described once for code generated per type
+ *
+ * X(typeId, Name, title, stream) for every packet type, where
+ *   Name    derives the struct S<Name>Packet and the callbacks on<Name> and
+ *           on<Name>Batch of SMetadataCallbacks
+ *   title   names the type in messages
+ *   stream  names the type in file names and JSON keys
+ *
+ * Adding a packet type to MetadataFormat.h takes one line here; the size
+ * check, the frame index and the dispatch of the decoders follow from it.
+ */
+
+#pragma once
+
+#include "MetadataFormat.h"
+
+#define METADATA_PACKET_TYPES(X) \
+    X(PACKET_TYPE_IMU, Imu, "IMU", "imu") \
+    X(PACKET_TYPE_GEO, Geo, "GEO", "geo") \
+    X(PACKET_TYPE_IQ, Iq, "IQ", "iq") \
+    X(PACKET_TYPE_TEMPERATURE, Temperature, "Temperature", "temperature")
+
+#define METADATA_PACKET_COUNT_ONE(typeId, Name, title, stream) +1
+_Static_assert(0 METADATA_PACKET_TYPES(METADATA_PACKET_COUNT_ONE) == PACKET_TYPE_COUNT,
+    "METADATA_PACKET_TYPES must list every packet type of MetadataFormat.h");
+#undef METADATA_PACKET_COUNT_ONE
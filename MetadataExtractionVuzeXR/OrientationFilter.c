@@ -0,0 +1,171 @@
+/**
+ * @file OrientationFilter.c
+ * Camera orientation at a fixed rate, fused from accel and gyro
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "OrientationFilter.h"
+
+static uint64_t GetStepUs(uint64_t step, uint32_t rateHz)
+{
+    return step * 1000000 / rateHz;
+}
+
+/* Advance to the next step, its time step * 1000000 / rateHz without a division */
+static void NextStep(SOrientationFilter* filter)
+{
+    filter->nextStep++;
+    filter->nextStepUs += filter->stepUs;
+    filter->stepRemainder += filter->stepUsRemainder;
+    if (filter->stepRemainder >= filter->rateHz)
+    {
+        filter->stepRemainder -= filter->rateHz;
+        filter->nextStepUs++;
+    }
+}
+
+/* Level orientation that turns the measured 'up' into y, yaw as little as possible */
+static void InitialOrientation(const float accel[3], double orientation[4])
+{
+    double norm = sqrt((double)accel[0] * accel[0] + (double)accel[1] * accel[1] + (double)accel[2] * accel[2]);
+    orientation[0] = 1.0;
+    orientation[1] = orientation[2] = orientation[3] = 0.0;
+    if (norm == 0.0)
+    {
+        return;
+    }
+
+    // the rotation of a onto y, (1 + a.y, a x y) normalized; upside down it is half a turn about x
+    double a[3] = { accel[0] / norm, accel[1] / norm, accel[2] / norm };
+    double q[4] = { 1.0 + a[1], -a[2], 0.0, a[0] };
+    double length = sqrt(q[0] * q[0] + q[1] * q[1] + q[3] * q[3]);
+    if (length < 1e-6)
+    {
+        orientation[0] = 0.0;
+        orientation[1] = 1.0;
+        return;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        orientation[i] = q[i] / length;
+    }
+}
+
+/*
+ * One step of 'seconds' with the rate 'gyro' (rad/s) and the measured
+ * 'accel'. The rate is corrected by gain * (a x v), a the normalized accel
+ * and v the 'up' the orientation predicts in camera axes, R(q)^T y, which
+ * turns v towards a. Only the accel is normalized with a division, it does
+ * not depend on the previous step.
+ */
+static void Update(double q[4], const double gyro[3], const double accel[3], double gain, double seconds)
+{
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+    double rate[3] = { gyro[0], gyro[1], gyro[2] };
+
+    double norm = accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2];
+    if (norm > 0.0)
+    {
+        norm = gain / sqrt(norm);
+        double up[3] = { 2.0 * (x * y + w * z), w * w - x * x + y * y - z * z, 2.0 * (y * z - w * x) };
+        rate[0] += (accel[1] * up[2] - accel[2] * up[1]) * norm;
+        rate[1] += (accel[2] * up[0] - accel[0] * up[2]) * norm;
+        rate[2] += (accel[0] * up[1] - accel[1] * up[0]) * norm;
+    }
+
+    // q + q * (0, rate) * seconds / 2
+    double half = 0.5 * seconds;
+    q[0] = w + (-x * rate[0] - y * rate[1] - z * rate[2]) * half;
+    q[1] = x + (w * rate[0] + y * rate[2] - z * rate[1]) * half;
+    q[2] = y + (w * rate[1] - x * rate[2] + z * rate[0]) * half;
+    q[3] = z + (w * rate[2] + x * rate[1] - y * rate[0]) * half;
+
+    // |q| is 1 + O(seconds^2) after a step, one Newton step of 1 / sqrt(|q|^2) near 1 renormalizes it
+    // as well as sqrt() and keeps the division off the chain of steps
+    norm = 0.5 * (3.0 - (q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]));
+    for (int i = 0; i < 4; i++)
+    {
+        q[i] *= norm;
+    }
+}
+
+/* Steps up to 'sample', with accel and gyro interpolated between the previous sample and it */
+static int Resample(SOrientationFilter* filter, const SFusionSample* sample)
+{
+    const SFusionSample* previous = &filter->previous;
+    uint64_t intervalUs = sample->relTsUs - previous->relTsUs;
+    double perUs = intervalUs > 0 ? 1.0 / (double)intervalUs : 0.0;
+
+    int ret = 0;
+    while (ret == 0 && filter->nextStepUs <= sample->relTsUs)
+    {
+        double t = intervalUs > 0 ? (double)(filter->nextStepUs - previous->relTsUs) * perUs : 1.0;
+        double accel[3];
+        double gyro[3];
+        for (int i = 0; i < 3; i++)
+        {
+            accel[i] = previous->accel[i] + t * ((double)sample->accel[i] - previous->accel[i]);
+            gyro[i] = (previous->gyro[i] + t * ((double)sample->gyro[i] - previous->gyro[i])) * filter->gyroScale;
+        }
+        Update(filter->orientation, gyro, accel, filter->gain, filter->stepSeconds);
+
+        SFusedOrientation step = { filter->nextStep, filter->nextStepUs, { 0 } };
+        for (int i = 0; i < 4; i++)
+        {
+            step.orientation[i] = (float)filter->orientation[i];
+        }
+        ret = filter->onStep(filter->context, &step);
+        NextStep(filter);
+    }
+    return ret;
+}
+
+void InitOrientationFilter(SOrientationFilter* filter, uint32_t rateHz, double gain, double gyroScale,
+    FusedOrientationCallback onStep, void* context)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->rateHz = rateHz != 0 ? rateHz : 1;
+    filter->stepUs = 1000000 / filter->rateHz;
+    filter->stepUsRemainder = 1000000 % filter->rateHz;
+    filter->stepSeconds = 1.0 / filter->rateHz;
+    filter->gain = gain;
+    filter->gyroScale = gyroScale != 0.0 ? gyroScale : 1.0;
+    filter->onStep = onStep;
+    filter->context = context;
+}
+
+int AddFusionSample(SOrientationFilter* filter, const SImuPacket* packet)
+{
+    SFusionSample sample =
+    {
+        packet->header.relTsUs,
+        { packet->accel[0], packet->accel[1], packet->accel[2] },
+        { packet->gyro[0], packet->gyro[1], packet->gyro[2] },
+    };
+
+    if (!filter->started)
+    {
+        filter->started = true;
+        filter->dataSourceId = packet->header.dataSourceId;
+        filter->previous = sample;
+        InitialOrientation(sample.accel, filter->orientation);
+
+        // the first step at or after the first sample
+        filter->nextStep = (sample.relTsUs * filter->rateHz + 999999) / 1000000;
+        filter->nextStepUs = GetStepUs(filter->nextStep, filter->rateHz);
+        filter->stepRemainder = (uint32_t)(filter->nextStep * 1000000 % filter->rateHz);
+        return 0;
+    }
+
+    if (packet->header.dataSourceId != filter->dataSourceId || sample.relTsUs < filter->previous.relTsUs)
+    {
+        filter->ignored++;
+        return 0;
+    }
+
+    int ret = Resample(filter, &sample);
+    filter->previous = sample;
+    return ret;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file OrientationFilter.h
+ * Camera orientation at a fixed rate, fused from accel and gyro
+ *
+ * The IMU samples arrive at irregular relTsUs. Accel and gyro are linearly
+ * interpolated to the steps k / rateHz seconds of relTsUs, and a
+ * complementary filter (Mahony, proportional) advances the orientation by
+ * one step at each of them: q <- q + q * (0, w + gain * (a x v)) / (2 rateHz),
+ * the gyro rate w corrected by the cross product of the measured 'up' a and
+ * the 'up' v the orientation predicts. The gyro carries the fast motion, the
+ * accel removes the drift of pitch and roll over about 1 / gain seconds. Yaw
+ * is not observed by the accel and drifts with the gyro bias.
+ *
+ * A step is a few dozen multiplications: an hour at 1 kHz is 3.6 million of
+ * them, a fraction of the time it takes to decode the packets.
+ *
+ * The axes are those of GyroIntegrator.h: x right, y up, z forward. The
+ * reference is level with y up and yaw of the camera at the first sample,
+ * which starts from its accel. The gyro unit is rad/s times 'gyroScale', the
+ * accel unit does not matter, it is normalized.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "MetadataFormat.h"
+
+/** Default of 'gain' in 1/s: a tilt error of e radians turns the orientation by gain * e rad/s */
+#define ORIENTATION_FILTER_GAIN 0.5
+
+/** Orientation at step 'step', at relTsUs step * 1000000 / rateHz (rounded down) */
+typedef struct
+{
+    uint64_t step;
+    uint64_t relTsUs;
+
+    /** Camera to reference orientation (w, x, y, z) */
+    float orientation[4];
+} SFusedOrientation;
+
+/** Receives the steps in order without gaps, a non-zero return value is passed on by the filter */
+typedef int (*FusedOrientationCallback)(void* context, const SFusedOrientation* orientation);
+
+typedef struct
+{
+    uint64_t relTsUs;
+    float accel[3];
+    float gyro[3];
+} SFusionSample;
+
+typedef struct
+{
+    uint32_t rateHz;
+    double gain;
+    double gyroScale;
+    FusedOrientationCallback onStep;
+    void* context;
+
+    /** Set by the first sample, only packets of its dataSourceId are fused */
+    bool started;
+    uint8_t dataSourceId;
+
+    SFusionSample previous;
+    double orientation[4];
+
+    /** Step length, 1000000 / rateHz us as 'stepUs' + 'stepUsRemainder' / rateHz */
+    uint32_t stepUs;
+    uint32_t stepUsRemainder;
+    double stepSeconds;
+
+    /** Next step to emit, at 'nextStepUs' + 'stepRemainder' / rateHz */
+    uint64_t nextStep;
+    uint64_t nextStepUs;
+    uint32_t stepRemainder;
+
+    /** Packets of other sources or with a timestamp going backwards */
+    uint64_t ignored;
+} SOrientationFilter;
+
+/** 'gain' 0 integrates the gyro only, 'gyroScale' 0 is 1 (rad/s) */
+void InitOrientationFilter(SOrientationFilter* filter, uint32_t rateHz, double gain, double gyroScale,
+    FusedOrientationCallback onStep, void* context);
+
+/** Add the next IMU packet, packets must come in bmdt order; emits the steps up to its timestamp */
+int AddFusionSample(SOrientationFilter* filter, const SImuPacket* packet);
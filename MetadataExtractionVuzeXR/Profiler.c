@@ -0,0 +1,133 @@
+/**
+ * @file Profiler.c
+ * Scoped timers and counters of an extraction, summarized as JSON
+ */
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "MetadataPackets.h"
+#include "Profiler.h"
+
+#if _WIN32
+#include <windows.h>
+#endif
+
+#define PROFILE_STAGE_NAME(id, name, perPacket) name,
+static const char* const STAGE_NAMES[PROFILE_STAGE_COUNT] = { PROFILE_STAGES(PROFILE_STAGE_NAME) };
+#undef PROFILE_STAGE_NAME
+
+/* Keys of the packet counts, as in the columnar file names */
+#define PACKET_STREAM_NAME(typeId, Name, title, stream) [typeId] = stream,
+static const char* const PACKET_NAMES[PACKET_TYPE_COUNT] = { METADATA_PACKET_TYPES(PACKET_STREAM_NAME) };
+#undef PACKET_STREAM_NAME
+
+#define PROFILE_STAGE_PER_PACKET(id, name, perPacket) perPacket,
+static const bool PER_PACKET_STAGES[PROFILE_STAGE_COUNT] = { PROFILE_STAGES(PROFILE_STAGE_PER_PACKET) };
+#undef PROFILE_STAGE_PER_PACKET
+
+double GetProfileWallSeconds(void)
+{
+#if _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+double GetProfileCpuSeconds(void)
+{
+#if _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    {
+        return 0.0;
+    }
+    // 100 ns units
+    uint64_t kernelTime = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t userTime = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (double)(kernelTime + userTime) * 1e-7;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+void ProfileEnd(SProfile* profile, EProfileStage stage, const SProfileMark* mark)
+{
+    if (profile == NULL)
+    {
+        return;
+    }
+
+    SProfileStage* timer = &profile->stages[stage];
+    timer->wallSeconds += GetProfileWallSeconds() - mark->wall;
+    if (!PER_PACKET_STAGES[stage])
+    {
+        timer->cpuSeconds += GetProfileCpuSeconds() - mark->cpu;
+    }
+    timer->calls++;
+}
+
+void MergeProfile(SProfile* into, const SProfile* from)
+{
+    for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+    {
+        into->stages[i].calls += from->stages[i].calls;
+        into->stages[i].wallSeconds += from->stages[i].wallSeconds;
+        into->stages[i].cpuSeconds += from->stages[i].cpuSeconds;
+    }
+    for (int i = 0; i < PACKET_TYPE_COUNT; i++)
+    {
+        into->packets[i] += from->packets[i];
+    }
+    into->bytesRead += from->bytesRead;
+    into->corruptPackets += from->corruptPackets;
+    into->corruptBytes += from->corruptBytes;
+    into->frames += from->frames;
+    into->movies += from->movies;
+    into->failedMovies += from->failedMovies;
+}
+
+int WriteProfileJson(FILE* file, const SProfile* profile, double wallSeconds)
+{
+    fprintf(file, "{\n  \"wall_s\": %.6f,\n  \"movies\": %" PRIu64 ",\n  \"failed_movies\": %" PRIu64 ",\n",
+        wallSeconds, profile->movies, profile->failedMovies);
+    fprintf(file, "  \"bytes_read\": %" PRIu64 ",\n  \"packets\": {", profile->bytesRead);
+    for (int i = 0; i < PACKET_TYPE_COUNT; i++)
+    {
+        fprintf(file, "%s\"%s\": %" PRIu64, i > 0 ? ", " : "", PACKET_NAMES[i], profile->packets[i]);
+    }
+    fprintf(file, "},\n  \"corrupt_packets\": %" PRIu64 ",\n  \"corrupt_bytes\": %" PRIu64 ",\n"
+        "  \"frames\": %" PRIu64 ",\n  \"stages\": {\n",
+        profile->corruptPackets, profile->corruptBytes, profile->frames);
+
+    for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+    {
+        const SProfileStage* stage = &profile->stages[i];
+        fprintf(file, "    \"%s\": {\"calls\": %" PRIu64 ", \"wall_s\": %.6f, ", STAGE_NAMES[i], stage->calls,
+            stage->wallSeconds);
+        if (PER_PACKET_STAGES[i])
+        {
+            fprintf(file, "\"cpu_s\": null}");
+        }
+        else
+        {
+            fprintf(file, "\"cpu_s\": %.6f}", stage->cpuSeconds);
+        }
+        fprintf(file, "%s\n", i + 1 < PROFILE_STAGE_COUNT ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+
+    return ferror(file) ? -1 : 0;
+}
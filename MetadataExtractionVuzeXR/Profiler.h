@@ -0,0 +1,104 @@
+/**
+ * @file Profiler.h
+ * Scoped timers and counters of an extraction, summarized as JSON
+ *
+ * Profiling is off unless an SProfile is passed in: every timer and counter
+ * takes a possibly NULL profile and does nothing for NULL, so the disabled
+ * cost is one pointer test per scope or packet. Coarse stages sample the wall
+ * clock and the CPU time of the calling thread. Per-packet stages sample the
+ * wall clock only, a CPU clock read costs about as much as formatting a
+ * packet and would mostly measure itself; their "cpu_s" is null.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "MetadataFormat.h"
+
+/** Stage, name in the JSON summary, timed per packet (wall clock only) */
+#define PROFILE_STAGES(X) \
+    X(PROFILE_EXTRACT_MOVIE, "extract_movie", false) \
+    X(PROFILE_PRINT_METADATA, "print_metadata", false) \
+    X(PROFILE_LOCATE_BMDT, "locate_bmdt", false) \
+    X(PROFILE_DECODE_BMDT, "decode_bmdt", false) \
+    X(PROFILE_FORMAT_PACKET, "format_packet", true) \
+    X(PROFILE_WRITE_CSV, "write_csv", true) \
+    X(PROFILE_CLOSE_OUTPUT, "close_output", false)
+
+typedef enum
+{
+#define PROFILE_STAGE_ENUM(id, name, perPacket) id,
+    PROFILE_STAGES(PROFILE_STAGE_ENUM)
+#undef PROFILE_STAGE_ENUM
+    PROFILE_STAGE_COUNT
+} EProfileStage;
+
+typedef struct
+{
+    uint64_t calls;
+    double wallSeconds;
+    double cpuSeconds;
+} SProfileStage;
+
+typedef struct
+{
+    SProfileStage stages[PROFILE_STAGE_COUNT];
+
+    /** Bytes of bmdt walked by the decoder, headers and skipped packets included */
+    uint64_t bytesRead;
+
+    /**
+     * Packets handed to the callbacks by type, and packets skipped as corrupt
+     * with the bytes skipped: their lengths, or up to the next valid packet with --resync
+     */
+    uint64_t packets[PACKET_TYPE_COUNT];
+    uint64_t corruptPackets;
+    uint64_t corruptBytes;
+
+    /** Video frames spanned by the decoded IMU packets */
+    uint64_t frames;
+
+    uint64_t movies;
+    uint64_t failedMovies;
+} SProfile;
+
+/** Start of a timed scope */
+typedef struct
+{
+    double wall;
+    double cpu;
+} SProfileMark;
+
+/** Monotonic wall clock in seconds */
+double GetProfileWallSeconds(void);
+
+/** CPU time of the calling thread in seconds */
+double GetProfileCpuSeconds(void);
+
+/** Start a scope of 'stage', nothing if 'profile' is NULL */
+static inline void ProfileBegin(const SProfile* profile, EProfileStage stage, SProfileMark* mark)
+{
+    if (profile != NULL)
+    {
+#define PROFILE_STAGE_PER_PACKET(id, name, perPacket) perPacket,
+        static const bool perPacketStages[PROFILE_STAGE_COUNT] = { PROFILE_STAGES(PROFILE_STAGE_PER_PACKET) };
+#undef PROFILE_STAGE_PER_PACKET
+        mark->cpu = perPacketStages[stage] ? 0.0 : GetProfileCpuSeconds();
+        mark->wall = GetProfileWallSeconds();
+    }
+}
+
+/** End the scope started with 'mark' and add it to 'stage' */
+void ProfileEnd(SProfile* profile, EProfileStage stage, const SProfileMark* mark);
+
+/** Add the stages and counters of 'from' to 'into' */
+void MergeProfile(SProfile* into, const SProfile* from);
+
+/**
+ * Write the summary as one JSON object, 'wallSeconds' is the run time
+ * @return 0 on success, -1 on a write error
+ */
+int WriteProfileJson(FILE* file, const SProfile* profile, double wallSeconds);
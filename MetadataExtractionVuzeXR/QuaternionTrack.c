@@ -0,0 +1,93 @@
+/**
+ * @file QuaternionTrack.c
+ * Compact binary files of orientations at a fixed rate
+ */
+
+#include <string.h>
+
+#include "QuaternionTrack.h"
+
+_Static_assert(sizeof(SQuaternionTrackHeader) == 32, "quaternion track header must be 32 bytes");
+
+static int WriteHeader(SQuaternionTrackWriter* writer)
+{
+    if (fseek(writer->file, 0, SEEK_SET) != 0 ||
+        fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int QuaternionTrackOpen(SQuaternionTrackWriter* writer, const char* path, uint32_t rateHz)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    memcpy(writer->header.magic, QUATERNION_TRACK_MAGIC, sizeof(QUATERNION_TRACK_MAGIC));
+    writer->header.version = QUATERNION_TRACK_VERSION;
+    writer->header.rateHz = rateHz;
+    return WriteHeader(writer);
+}
+
+int QuaternionTrackAppend(SQuaternionTrackWriter* writer, uint64_t step, const float orientation[4])
+{
+    if (writer->header.stepCount == 0 && writer->buffered == 0)
+    {
+        writer->header.firstStep = step;
+    }
+    else if (step != writer->header.firstStep + writer->header.stepCount + writer->buffered)
+    {
+        fprintf(stderr, "Quaternion track step %llu does not follow the previous one!\n", (unsigned long long)step);
+        return -1;
+    }
+
+    // q and -q are the same orientation, w >= 0 keeps the track free of sign flips
+    float sign = orientation[0] < 0.0f ? -(float)QUATERNION_TRACK_SCALE : (float)QUATERNION_TRACK_SCALE;
+    int16_t* item = writer->buffer[writer->buffered++];
+    for (int i = 0; i < 4; i++)
+    {
+        // rounded half away from zero, a conversion instruction where lrintf() is a call
+        float value = orientation[i] * sign;
+        item[i] = (int16_t)(value + (value < 0.0f ? -0.5f : 0.5f));
+    }
+
+    return writer->buffered == QUATERNION_TRACK_BUFFER ? QuaternionTrackFlush(writer) : 0;
+}
+
+int QuaternionTrackFlush(SQuaternionTrackWriter* writer)
+{
+    if (writer->buffered == 0)
+    {
+        return 0;
+    }
+    if (fwrite(writer->buffer, sizeof(writer->buffer[0]), writer->buffered, writer->file) != writer->buffered)
+    {
+        perror("Failed to write quaternion track");
+        return -1;
+    }
+    writer->header.stepCount += writer->buffered;
+    writer->buffered = 0;
+    return 0;
+}
+
+int QuaternionTrackClose(SQuaternionTrackWriter* writer)
+{
+    int ret = QuaternionTrackFlush(writer);
+    if (ret == 0 && WriteHeader(writer) != 0)
+    {
+        ret = -1;
+    }
+    if (fclose(writer->file) != 0)
+    {
+        ret = -1;
+    }
+    writer->file = NULL;
+    return ret;
+}
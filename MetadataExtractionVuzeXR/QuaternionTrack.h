@@ -0,0 +1,61 @@
+/**
+ * @file QuaternionTrack.h
+ * Compact binary files of orientations at a fixed rate
+ *
+ * File layout, all little-endian:
+ *   SQuaternionTrackHeader                      (32 bytes)
+ *   int16_t[4] per step: w, x, y, z times QUATERNION_TRACK_SCALE, w >= 0
+ *
+ * Step k of the file is at relTsUs (firstStep + k) * 1000000 / rateHz
+ * (rounded down), there are no timestamps in the file. 8 bytes a step keep an
+ * hour at 1 kHz under 30 MB, rounding to 1/32767 costs less than 0.01 degrees.
+ * 'stepCount' is written when the file is closed, a reader of a file still
+ * being written (--follow) takes the count from the file size. See
+ * VuzeColumnar.LoadQuaternionTrack().
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define QUATERNION_TRACK_MAGIC "VZQUAT1"
+#define QUATERNION_TRACK_VERSION 1
+#define QUATERNION_TRACK_SCALE 32767
+
+/** Steps buffered before they are written */
+#define QUATERNION_TRACK_BUFFER 4096
+
+#pragma pack(push, 1)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t rateHz;
+    uint64_t firstStep;
+    uint64_t stepCount;
+} SQuaternionTrackHeader;
+
+#pragma pack(pop)
+
+typedef struct
+{
+    FILE* file;
+    SQuaternionTrackHeader header;
+    int16_t buffer[QUATERNION_TRACK_BUFFER][4];
+    size_t buffered;
+} SQuaternionTrackWriter;
+
+/** Create the output file */
+int QuaternionTrackOpen(SQuaternionTrackWriter* writer, const char* path, uint32_t rateHz);
+
+/** Append the orientation (w, x, y, z) of 'step', steps must follow each other without gaps */
+int QuaternionTrackAppend(SQuaternionTrackWriter* writer, uint64_t step, const float orientation[4]);
+
+/** Write the buffered steps, for readers of a file still being written */
+int QuaternionTrackFlush(SQuaternionTrackWriter* writer);
+
+/** Write the remaining steps and the header with the step count, close the file */
+int QuaternionTrackClose(SQuaternionTrackWriter* writer);
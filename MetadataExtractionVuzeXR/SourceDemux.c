@@ -0,0 +1,97 @@
+/**
+ * @file SourceDemux.c
+ * Output split by packet type and dataSourceId
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SourceDemux.h"
+
+void InitSourceDemux(SSourceDemux* demux, DemuxOpenCallback open, void* context)
+{
+    memset(demux, 0, sizeof(*demux));
+    demux->open = open;
+    demux->context = context;
+}
+
+static int CloseDemuxStream(SDemuxStream* stream)
+{
+    int ret = 0;
+    if (stream->file != NULL)
+    {
+        ret |= CloseTextWriter(&stream->text);
+        ret |= fclose(stream->file) != 0 ? -1 : 0;
+        stream->file = NULL;
+    }
+    if (stream->columns.file != NULL)
+    {
+        ret |= ColumnarClose(&stream->columns);
+    }
+    return ret;
+}
+
+SDemuxStream* OpenDemuxStream(SSourceDemux* demux, uint8_t typeId, uint8_t sourceId)
+{
+    SDemuxStream* stream = calloc(1, sizeof(*stream));
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+
+    stream->typeId = typeId;
+    stream->sourceId = sourceId;
+    if (demux->open(demux->context, stream) != 0)
+    {
+        CloseDemuxStream(stream);
+        free(stream);
+        return NULL;
+    }
+
+    demux->streams[typeId][sourceId] = stream;
+    return stream;
+}
+
+int FlushSourceDemux(SSourceDemux* demux)
+{
+    int ret = 0;
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        for (int source = 0; source < DEMUX_SOURCE_COUNT; source++)
+        {
+            SDemuxStream* stream = demux->streams[type][source];
+            if (stream != NULL && stream->file != NULL)
+            {
+                ret |= FlushTextWriter(&stream->text);
+                ret |= fflush(stream->file) != 0 ? -1 : 0;
+            }
+        }
+    }
+    return ret;
+}
+
+int CloseSourceDemux(SSourceDemux* demux, DemuxCloseCallback onClose, void* context)
+{
+    int ret = 0;
+    for (int type = 0; type < PACKET_TYPE_COUNT; type++)
+    {
+        for (int source = 0; source < DEMUX_SOURCE_COUNT; source++)
+        {
+            SDemuxStream* stream = demux->streams[type][source];
+            if (stream == NULL)
+            {
+                continue;
+            }
+
+            if (onClose != NULL)
+            {
+                onClose(context, stream);
+            }
+            ret |= CloseDemuxStream(stream);
+            free(stream);
+            demux->streams[type][source] = NULL;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file SourceDemux.h
+ * Output split by packet type and dataSourceId
+ *
+ * Every (packet type, dataSourceId) pair that occurs gets a stream of its
+ * own, opened by a callback on the first packet of the pair: a CSV file
+ * behind a buffered STextWriter or a columnar file. Streams are found by
+ * indexing with the pair, there is no search per packet, and pairs that do
+ * not occur cost a NULL pointer.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ColumnarWriter.h"
+#include "MetadataFormat.h"
+#include "TextWriter.h"
+
+/** dataSourceId is a byte */
+#define DEMUX_SOURCE_COUNT 256
+
+typedef struct
+{
+    uint8_t typeId;
+    uint8_t sourceId;
+
+    /** Text stream, 'file' stays NULL for a columnar stream */
+    FILE* file;
+    STextWriter text;
+
+    /** Columnar stream, 'columns.file' stays NULL for a text stream */
+    SColumnarWriter columns;
+
+    /** Packets written to the stream */
+    uint64_t rows;
+} SDemuxStream;
+
+/**
+ * Open 'stream' for its typeId and sourceId: either 'file' and 'text' or
+ * 'columns'. On failure the parts opened so far are closed by the demux.
+ * @return 0 on success, -1 on failure (reported to stderr)
+ */
+typedef int (*DemuxOpenCallback)(void* context, SDemuxStream* stream);
+
+/** Called for every stream before it is closed, e.g. to print a summary */
+typedef void (*DemuxCloseCallback)(void* context, const SDemuxStream* stream);
+
+typedef struct
+{
+    SDemuxStream* streams[PACKET_TYPE_COUNT][DEMUX_SOURCE_COUNT];
+
+    DemuxOpenCallback open;
+    void* context;
+} SSourceDemux;
+
+void InitSourceDemux(SSourceDemux* demux, DemuxOpenCallback open, void* context);
+
+/** Create and open the stream of a pair, see GetDemuxStream() */
+SDemuxStream* OpenDemuxStream(SSourceDemux* demux, uint8_t typeId, uint8_t sourceId);
+
+/**
+ * The stream of a pair, opened on first use. 'typeId' must be a known packet
+ * type (checked against GetPacketSize() by the decoder).
+ * @return NULL if the stream can not be opened
+ */
+static inline SDemuxStream* GetDemuxStream(SSourceDemux* demux, uint8_t typeId, uint8_t sourceId)
+{
+    SDemuxStream* stream = demux->streams[typeId][sourceId];
+    return stream != NULL ? stream : OpenDemuxStream(demux, typeId, sourceId);
+}
+
+/** Hand the buffered rows of the text streams to their files, for readers of files still being written */
+int FlushSourceDemux(SSourceDemux* demux);
+
+/**
+ * Close all streams in (type, source) order, calling 'onClose' (may be NULL)
+ * for each first.
+ * @return 0 if every stream was written completely, else -1
+ */
+int CloseSourceDemux(SSourceDemux* demux, DemuxCloseCallback onClose, void* context);
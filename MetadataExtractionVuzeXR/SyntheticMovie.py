@@ -0,0 +1,322 @@
+import os
+import struct
+import sys
+import time
+import numpy as np
+
+# Synthetic MOV containers with a moov/udta/bmdt payload laid out like MetadataFormat.h,
+# or fragmented with moof/udta/bmdt, for reproducible ExtractMetadata runs (see BenchmarkExtraction.py)
+# and files that grow while ExtractMetadata --follow reads them
+
+PACKET_TYPE_IMU = 0
+PACKET_TYPE_GEO = 1
+PACKET_TYPE_IQ = 2
+PACKET_TYPE_TEMPERATURE = 3
+PACKET_TYPE_NAMES = {"imu": PACKET_TYPE_IMU, "geo": PACKET_TYPE_GEO, "iq": PACKET_TYPE_IQ,
+                     "temperature": PACKET_TYPE_TEMPERATURE}
+
+# packed (#pragma pack 1) records, SMetadataPacketHeader first
+PACKET_HEADER = [("length", "<u2"), ("typeId", "u1"), ("dataSourceId", "u1"), ("relTsUs", "<u8")]
+PACKET_DTYPES = {
+    PACKET_TYPE_IMU: np.dtype(PACKET_HEADER + [("accel", "<f4", 3), ("gyro", "<f4", 3)]),
+    PACKET_TYPE_GEO: np.dtype(PACKET_HEADER + [("latitude", "<f8"), ("longitude", "<f8"), ("altitude", "<f8")]),
+    PACKET_TYPE_IQ: np.dtype(PACKET_HEADER + [("shutterTime", "<f4"), ("maxShutterTime", "<f4"), ("redGain", "<u4"),
+                                              ("greenGain", "<u4"), ("blueGain", "<u4"), ("iso", "<u2")]),
+    PACKET_TYPE_TEMPERATURE: np.dtype(PACKET_HEADER + [("temperature", "<f4")]),
+}
+
+# a packet whose length does not match its type, the decoders report and skip it
+CORRUPT_DTYPE = np.dtype(PACKET_HEADER + [("payload", "u1", 10)])
+
+METADATA_HEADER = struct.Struct("<HHIIH")
+ATOM_HEADER = struct.Struct(">I4s")
+LARGE_ATOM_HEADER = struct.Struct(">I4sQ")
+
+DEFAULT_ATOM_ORDER = ("ftyp", "mdat", "moov")
+
+def MakeBmdt(counts, duration_us, corrupt=0, fps=(30000, 1001), skew_us=12000, sources=1, seed=0):
+    """
+    bmdt payload: SMetadataHeader and counts[type] packets of each type, spread
+    evenly over 'duration_us' and interleaved in timestamp order, IMU packets
+    alternating over 'sources' data sources. 'corrupt' packets with a length
+    that matches no type are mixed in at random positions.
+    """
+
+    rng = np.random.default_rng(seed)
+    blocks = []
+    for type_id, count in sorted(counts.items()):
+        if count <= 0:
+            continue
+        packets = np.zeros(count, PACKET_DTYPES[type_id])
+        packets["length"] = PACKET_DTYPES[type_id].itemsize - 2
+        packets["typeId"] = type_id
+        packets["relTsUs"] = np.arange(count, dtype=np.uint64) * duration_us // count
+
+        if type_id == PACKET_TYPE_IMU:
+            packets["dataSourceId"] = np.arange(count) % sources
+            packets["accel"] = rng.normal(0.0, 0.1, (count, 3))
+            packets["gyro"] = rng.normal(0.0, 0.05, (count, 3))
+        elif type_id == PACKET_TYPE_GEO:
+            packets["latitude"] = 48.1 + np.cumsum(rng.normal(0.0, 1e-5, count))
+            packets["longitude"] = 11.5 + np.cumsum(rng.normal(0.0, 1e-5, count))
+            packets["altitude"] = 520.0 + rng.normal(0.0, 1.0, count)
+        elif type_id == PACKET_TYPE_IQ:
+            packets["shutterTime"] = 1 / 120.0
+            packets["maxShutterTime"] = 1 / 30.0
+            packets["redGain"], packets["greenGain"], packets["blueGain"] = 256, 200, 300
+            packets["iso"] = 100
+        else:
+            packets["temperature"] = 40.0 + rng.normal(0.0, 0.5, count)
+        blocks.append(packets)
+
+    if corrupt > 0:
+        packets = np.zeros(corrupt, CORRUPT_DTYPE)
+        packets["length"] = CORRUPT_DTYPE.itemsize - 2
+        packets["typeId"] = np.arange(corrupt) % len(PACKET_DTYPES)
+        packets["relTsUs"] = np.sort(rng.integers(0, max(duration_us, 1), corrupt)).astype(np.uint64)
+        packets["payload"] = rng.integers(0, 256, (corrupt, CORRUPT_DTYPE["payload"].shape[0]))
+        blocks.append(packets)
+
+    # scatter the records of all types into one buffer in timestamp order
+    timestamps = np.concatenate([block["relTsUs"] for block in blocks]) if blocks else np.empty(0, np.uint64)
+    sizes = np.concatenate([np.full(len(block), block.dtype.itemsize) for block in blocks]) if blocks else \
+        np.empty(0, np.int64)
+    order = np.argsort(timestamps, kind="stable")
+    offsets = np.empty(len(order), np.int64)
+    offsets[order] = np.concatenate(([0], np.cumsum(sizes[order])[:-1])) if len(order) else []
+
+    payload = np.empty(int(sizes.sum()), np.uint8)
+    first = 0
+    for block in blocks:
+        block_offsets = offsets[first:first + len(block)]
+        record = block.dtype.itemsize
+        payload[block_offsets[:, None] + np.arange(record)] = block.view(np.uint8).reshape(-1, record)
+        first += len(block)
+
+    header = METADATA_HEADER.pack(METADATA_HEADER.size - 2, 1, fps[0], fps[1], skew_us)
+    return header + payload.tobytes()
+
+def DamageBmdt(bmdt, count, max_length=256, seed=0):
+    """
+    Overwrite 'count' stretches of 1 to 'max_length' bytes at random positions
+    after the metadata header with random bytes, like a damaged recording:
+    packets with garbage lengths, types and timestamps, cut off in the middle.
+    """
+
+    if count <= 0:
+        return bmdt
+    rng = np.random.default_rng(seed + 1)
+    data = np.frombuffer(bmdt, np.uint8).copy()
+    starts = rng.integers(METADATA_HEADER.size, len(data), count)
+    lengths = rng.integers(1, max_length + 1, count)
+    for start, length in zip(starts, lengths):
+        end = min(start + length, len(data))
+        data[start:end] = rng.integers(0, 256, end - start)
+    return data.tobytes()
+
+def Atom(atom_type, payload):
+    return ATOM_HEADER.pack(ATOM_HEADER.size + len(payload), atom_type.encode()) + payload
+
+def MdatPieces(mdat_size, large_mdat=False):
+    """mdat header and its payload as a count of zero bytes, see WritePieces()"""
+
+    if large_mdat or mdat_size + ATOM_HEADER.size > 0xFFFFFFFF:
+        return [LARGE_ATOM_HEADER.pack(1, b"mdat", LARGE_ATOM_HEADER.size + mdat_size), mdat_size]
+    return [ATOM_HEADER.pack(ATOM_HEADER.size + mdat_size, b"mdat"), mdat_size]
+
+def MoviePieces(bmdt, mdat_size=1 << 20, atom_order=DEFAULT_ATOM_ORDER, large_mdat=False):
+
+    moov = Atom("moov", Atom("mvhd", bytes(100)) + Atom("udta", Atom("abcd", b"xx") + Atom("bmdt", bmdt)))
+    ftyp = Atom("ftyp", b"isom\0\0\2\0isommp41")
+
+    pieces = []
+    for name in atom_order:
+        if name == "ftyp":
+            pieces.append(ftyp)
+        elif name == "moov":
+            pieces.append(moov)
+        elif name == "mdat":
+            pieces += MdatPieces(mdat_size, large_mdat)
+        else:
+            raise ValueError("Unknown atom %s" %name)
+    return pieces
+
+def SplitPackets(bmdt, parts):
+    """The SMetadataHeader of a bmdt payload and its packets in 'parts' runs of whole packets"""
+
+    header_size = METADATA_HEADER.size
+    offsets = []
+    offset = header_size
+    while offset < len(bmdt):
+        offsets.append(offset)
+        offset += struct.unpack_from("<H", bmdt, offset)[0] + 2
+    offsets.append(len(bmdt))
+
+    bounds = [offsets[len(offsets) * i // parts] for i in range(parts)] + [len(bmdt)]
+    return bmdt[:header_size], [bmdt[bounds[i]:bounds[i + 1]] for i in range(parts)]
+
+def FragmentedPieces(bmdt, fragments, mdat_size=1 << 20):
+    """
+    ftyp and a moov whose udta/bmdt holds the SMetadataHeader only, then
+    'fragments' times a moof/udta/bmdt with the next run of packets followed
+    by an mdat of 'mdat_size' / 'fragments' bytes, like a fragmented recording
+    """
+
+    header, runs = SplitPackets(bmdt, fragments)
+    pieces = [Atom("ftyp", b"iso6\0\0\2\0iso6mp41"),
+              Atom("moov", Atom("mvhd", bytes(100)) + Atom("mvex", Atom("trex", bytes(24))) +
+                   Atom("udta", Atom("bmdt", header)))]
+    for number, run in enumerate(runs):
+        mfhd = Atom("mfhd", struct.pack(">II", 0, number + 1))
+        pieces.append(Atom("moof", mfhd + Atom("traf", Atom("tfhd", bytes(8))) + Atom("udta", Atom("bmdt", run))))
+        pieces += MdatPieces(mdat_size // fragments)
+    return pieces
+
+def LiveWrites(pieces, steps):
+    """
+    The pieces regrouped into the writes of a growing file: a fragment (moof
+    and its mdat) at a time if there are fragments, else 'steps' writes of
+    equal size that cut through atoms and packets, like a copy
+    """
+
+    if any(not isinstance(piece, int) and piece[4:8] == b"moof" for piece in pieces):
+        writes = [[]]
+        for piece in pieces:
+            if not isinstance(piece, int) and piece[4:8] == b"moof":
+                writes.append([])
+            writes[-1].append(piece)
+        return writes
+
+    total = sum(piece if isinstance(piece, int) else len(piece) for piece in pieces)
+    step = max(total // steps, 1)
+    writes = [[]]
+    size = 0
+    for piece in pieces:
+        length = piece if isinstance(piece, int) else len(piece)
+        position = 0
+        while position < length:
+            count = min(step - size, length - position)
+            writes[-1].append(count if isinstance(piece, int) else piece[position:position + count])
+            position += count
+            size += count
+            if size == step:
+                writes.append([])
+                size = 0
+    return writes
+
+def OpenMdat(pieces):
+    """
+    The pieces with the first mdat header at size 0 ("up to the end of the
+    file"), its offset and end and the header with the real size
+    """
+
+    offset = 0
+    for number, piece in enumerate(pieces):
+        if not isinstance(piece, int) and piece[4:8] == b"mdat":
+            end = offset + len(piece) + pieces[number + 1]
+            opened = pieces[:number] + [bytes(4) + piece[4:]] + pieces[number + 1:]
+            return opened, (offset, end, piece)
+        offset += piece if isinstance(piece, int) else len(piece)
+    raise ValueError("No mdat to open")
+
+def WritePieces(path, pieces, live_s=0.0, steps=100, open_mdat=False):
+    """
+    Writes the pieces in order, bytes as they are and an int as that many zero
+    bytes, sparse where the file system allows. With 'live_s' the file grows
+    over that many seconds, see LiveWrites(), for ExtractMetadata --follow.
+    With 'open_mdat' the mdat has size 0 until the first byte after it is
+    written, then its size is patched in, like a recorder that appends moov
+    when it stops. An mdat at the end keeps size 0.
+    """
+
+    mdat = None
+    if open_mdat:
+        pieces, mdat = OpenMdat(pieces)
+
+    writes = LiveWrites(pieces, steps) if live_s > 0 else [pieces]
+    with open(path, "wb") as f:
+        for number, write in enumerate(writes):
+            if number > 0:
+                time.sleep(live_s / (len(writes) - 1))
+            for piece in write:
+                if mdat is not None and f.tell() >= mdat[1]:
+                    f.seek(mdat[0])
+                    f.write(mdat[2])
+                    f.seek(0, os.SEEK_END)
+                    mdat = None
+                if isinstance(piece, int):
+                    f.truncate(f.tell() + piece)
+                    f.seek(piece, os.SEEK_CUR)
+                else:
+                    f.write(piece)
+            f.flush()
+    return os.path.getsize(path)
+
+def WriteSyntheticMovie(path, bmdt, mdat_size=1 << 20, atom_order=DEFAULT_ATOM_ORDER, large_mdat=False):
+    """
+    Writes ftyp, mdat and moov/udta/bmdt in 'atom_order'. The mdat holds
+    'mdat_size' zero bytes, written as a sparse region where the file system
+    allows, with a 64-bit size if 'large_mdat' or if it needs one.
+    """
+
+    return WritePieces(path, MoviePieces(bmdt, mdat_size, atom_order, large_mdat))
+
+
+if __name__ == "__main__":
+
+    def PrintUsage():
+        print("Usage: python SyntheticMovie.py OUT.mov [--imu N] [--geo N] [--iq N] [--temperature N] [--corrupt N]")
+        print("       [--duration-s S] [--sources N] [--mdat-size BYTES] [--order ftyp,mdat,moov] [--large-mdat]")
+        print("       [--seed N] [--fragments N] [--live-s S] [--damage N] [--open-mdat]")
+        print("  --fragments N  fragmented layout: the packets in N moof/udta/bmdt atoms, each followed by its mdat")
+        print("  --live-s S     let the file grow over S seconds like a recording (a fragment at a time) or a copy,")
+        print("                 to try ExtractMetadata --follow on")
+        print("  --damage N     overwrite N stretches of up to 256 bytes with random bytes, to try ExtractMetadata --resync on")
+        print("  --open-mdat    mdat with size 0 until the atoms after it are written, e.g. --order ftyp,mdat,moov")
+        print("                 --live-s 5 like a camera recording; as the last atom it keeps size 0")
+
+    args = sys.argv[1:]
+    if not args or args[0].startswith("-"):
+        PrintUsage()
+        sys.exit(-1)
+
+    path = args[0]
+    counts = {PACKET_TYPE_IMU: 100000, PACKET_TYPE_GEO: 100, PACKET_TYPE_IQ: 3000, PACKET_TYPE_TEMPERATURE: 100}
+    options = {"corrupt": 0, "duration_s": 100.0, "sources": 1, "mdat_size": 1 << 20, "seed": 0, "fragments": 0,
+               "live_s": 0.0, "damage": 0}
+    atom_order = DEFAULT_ATOM_ORDER
+    large_mdat = False
+    open_mdat = False
+
+    i = 1
+    while i < len(args):
+        name = args[i][2:]
+        if name in PACKET_TYPE_NAMES and i + 1 < len(args):
+            i += 1
+            counts[PACKET_TYPE_NAMES[name]] = int(args[i])
+        elif name.replace("-", "_") in options and i + 1 < len(args):
+            i += 1
+            key = name.replace("-", "_")
+            options[key] = type(options[key])(float(args[i]))
+        elif name == "order" and i + 1 < len(args):
+            i += 1
+            atom_order = args[i].split(",")
+        elif name == "large-mdat":
+            large_mdat = True
+        elif name == "open-mdat":
+            open_mdat = True
+        else:
+            PrintUsage()
+            sys.exit(-1)
+        i += 1
+
+    bmdt = MakeBmdt(counts, int(options["duration_s"] * 1e6), options["corrupt"], sources=options["sources"],
+                    seed=options["seed"])
+    bmdt = DamageBmdt(bmdt, options["damage"], seed=options["seed"])
+    if options["fragments"] > 0:
+        pieces = FragmentedPieces(bmdt, options["fragments"], options["mdat_size"])
+    else:
+        pieces = MoviePieces(bmdt, options["mdat_size"], atom_order, large_mdat)
+    size = WritePieces(path, pieces, options["live_s"], open_mdat=open_mdat)
+    print("%s: %d bytes, bmdt %d bytes, %d packets, %d corrupt, %d damaged stretches" %(
+        path, size, len(bmdt), sum(counts.values()) + options["corrupt"], options["corrupt"], options["damage"]))
@@ -0,0 +1,629 @@
+/**
+ * @file TextWriter.c
+ * Buffered text output with fast number formatting for the CSV and stdout rows
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TextWriter.h"
+
+static const char DIGIT_PAIRS[201] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static const uint64_t POW10[19] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+};
+
+static size_t FormatUInt(char* out, uint64_t value)
+{
+    char text[20];
+    char* p = text + sizeof(text);
+    while (value >= 100)
+    {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = DIGIT_PAIRS[pair];
+        p[1] = DIGIT_PAIRS[pair + 1];
+    }
+    if (value >= 10)
+    {
+        p -= 2;
+        p[0] = DIGIT_PAIRS[value * 2];
+        p[1] = DIGIT_PAIRS[value * 2 + 1];
+    }
+    else
+    {
+        *--p = (char)('0' + value);
+    }
+
+    size_t length = (size_t)(text + sizeof(text) - p);
+    memcpy(out, p, length);
+    return length;
+}
+
+static size_t FormatSpecial(char* out, bool negative, bool nan)
+{
+    const char* text = nan ? "nan" : negative ? "-inf" : "inf";
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return length;
+}
+
+/*
+ * 'digits' * 10^'exponent' like Python repr(): positional for decimal
+ * exponents -4 to 15 with at least one digit after the point, else
+ * scientific with a two digit exponent
+ */
+static size_t LayoutDecimal(char* out, bool negative, uint64_t digits, int32_t exponent)
+{
+    while (digits >= 10 && digits % 10 == 0)
+    {
+        digits /= 10;
+        exponent++;
+    }
+
+    char text[20];
+    int32_t count = (int32_t)FormatUInt(text, digits);
+    int32_t point = count + exponent;
+    int32_t scientific = point - 1;
+    char* p = out;
+
+    if (negative)
+    {
+        *p++ = '-';
+    }
+
+    if (scientific < -4 || scientific >= 16)
+    {
+        *p++ = text[0];
+        if (count > 1)
+        {
+            *p++ = '.';
+            memcpy(p, text + 1, count - 1);
+            p += count - 1;
+        }
+        *p++ = 'e';
+        *p++ = scientific < 0 ? '-' : '+';
+        uint32_t magnitude = (uint32_t)(scientific < 0 ? -scientific : scientific);
+        if (magnitude < 10)
+        {
+            *p++ = '0';
+        }
+        p += FormatUInt(p, magnitude);
+    }
+    else if (point <= 0)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, text, count);
+        p += count;
+    }
+    else if (point < count)
+    {
+        memcpy(p, text, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, text + point, count - point);
+        p += count - point;
+    }
+    else
+    {
+        memcpy(p, text, count);
+        p += count;
+        memset(p, '0', point - count);
+        p += point - count;
+        *p++ = '.';
+        *p++ = '0';
+    }
+
+    return (size_t)(p - out);
+}
+
+/*
+ * Shortest round-trip digits of a float: Ryu by Ulf Adams, "Ryu: fast
+ * float-to-string conversion", PLDI 2018, f2s with 64-bit multiplications.
+ */
+
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+
+/* floor(2^(bitlength(5^q) - 1 + 59) / 5^q) + 1 */
+#define FLOAT_POW5_INV_BITCOUNT 59
+static const uint64_t FLOAT_POW5_INV_SPLIT[31] =
+{
+    0x0800000000000001ULL, 0x0666666666666667ULL, 0x051EB851EB851EB9ULL, 0x04189374BC6A7EFAULL,
+    0x068DB8BAC710CB2AULL, 0x053E2D6238DA3C22ULL, 0x0431BDE82D7B634EULL, 0x06B5FCA6AF2BD216ULL,
+    0x055E63B88C230E78ULL, 0x044B82FA09B5A52DULL, 0x06DF37F675EF6EAEULL, 0x057F5FF85E592558ULL,
+    0x0465E6604B7A8447ULL, 0x0709709A125DA071ULL, 0x05A126E1A84AE6C1ULL, 0x0480EBE7B9D58567ULL,
+    0x0734ACA5F6226F0BULL, 0x05C3BD5191B525A3ULL, 0x049C97747490EAE9ULL, 0x0760F253EDB4AB0EULL,
+    0x05E72843249088D8ULL, 0x04B8ED0283A6D3E0ULL, 0x078E480405D7B966ULL, 0x060B6CD004AC9452ULL,
+    0x04D5F0A66A23A9DBULL, 0x07BCB43D769F762BULL, 0x063090312BB2C4EFULL, 0x04F3A68DBC8F03F3ULL,
+    0x07EC3DAF94180651ULL, 0x065697BFA9ACD1DAULL, 0x051212FFBAF0A7E2ULL,
+};
+
+/* 5^i scaled to 61 bits */
+#define FLOAT_POW5_BITCOUNT 61
+static const uint64_t FLOAT_POW5_SPLIT[47] =
+{
+    0x1000000000000000ULL, 0x1400000000000000ULL, 0x1900000000000000ULL, 0x1F40000000000000ULL,
+    0x1388000000000000ULL, 0x186A000000000000ULL, 0x1E84800000000000ULL, 0x1312D00000000000ULL,
+    0x17D7840000000000ULL, 0x1DCD650000000000ULL, 0x12A05F2000000000ULL, 0x174876E800000000ULL,
+    0x1D1A94A200000000ULL, 0x12309CE540000000ULL, 0x16BCC41E90000000ULL, 0x1C6BF52634000000ULL,
+    0x11C37937E0800000ULL, 0x16345785D8A00000ULL, 0x1BC16D674EC80000ULL, 0x1158E460913D0000ULL,
+    0x15AF1D78B58C4000ULL, 0x1B1AE4D6E2EF5000ULL, 0x10F0CF064DD59200ULL, 0x152D02C7E14AF680ULL,
+    0x1A784379D99DB420ULL, 0x108B2A2C28029094ULL, 0x14ADF4B7320334B9ULL, 0x19D971E4FE8401E7ULL,
+    0x1027E72F1F128130ULL, 0x1431E0FAE6D7217CULL, 0x193E5939A08CE9DBULL, 0x1F8DEF8808B02452ULL,
+    0x13B8B5B5056E16B3ULL, 0x18A6E32246C99C60ULL, 0x1ED09BEAD87C0378ULL, 0x13426172C74D822BULL,
+    0x1812F9CF7920E2B6ULL, 0x1E17B84357691B64ULL, 0x12CED32A16A1B11EULL, 0x178287F49C4A1D66ULL,
+    0x1D6329F1C35CA4BFULL, 0x125DFA371A19E6F7ULL, 0x16F578C4E0A060B5ULL, 0x1CB2D6F618C878E3ULL,
+    0x11EFC659CF7D4B8DULL, 0x166BB7F0435C9E71ULL, 0x1C06A5EC5433C60DULL,
+};
+
+/* bitlength(5^e), e >= 0 */
+static inline int32_t Pow5Bits(int32_t e)
+{
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)), floor(log10(5^e)) */
+static inline uint32_t Log10Pow2(int32_t e)
+{
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+static inline uint32_t Log10Pow5(int32_t e)
+{
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline bool IsMultipleOfPow5(uint32_t value, uint32_t p)
+{
+    uint32_t count = 0;
+    while (value % 5 == 0)
+    {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static inline bool IsMultipleOfPow2(uint32_t value, uint32_t p)
+{
+    return (value & ((1u << p) - 1)) == 0;
+}
+
+/* (m * factor) >> shift, shift > 32 */
+static inline uint32_t MulShift(uint32_t m, uint64_t factor, int32_t shift)
+{
+    uint64_t bits0 = (uint64_t)m * (uint32_t)factor;
+    uint64_t bits1 = (uint64_t)m * (uint32_t)(factor >> 32);
+    uint64_t sum = (bits0 >> 32) + bits1;
+    return (uint32_t)(sum >> (shift - 32));
+}
+
+/* Finite non-zero float as 'digits' * 10^'exponent' */
+static void FloatToDecimal(uint32_t ieeeMantissa, uint32_t ieeeExponent, uint32_t* digits, int32_t* exponent)
+{
+    int32_t e2;
+    uint32_t m2;
+    if (ieeeExponent == 0)
+    {
+        e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = ieeeMantissa;
+    }
+    else
+    {
+        e2 = (int32_t)ieeeExponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+    }
+    bool acceptBounds = (m2 & 1) == 0;
+
+    // the interval of decimals that read back as this float, times 4
+    uint32_t mv = 4 * m2;
+    uint32_t mp = 4 * m2 + 2;
+    uint32_t mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+    uint32_t mm = 4 * m2 - 1 - mmShift;
+
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vmIsTrailingZeros = false;
+    bool vrIsTrailingZeros = false;
+    uint8_t lastRemovedDigit = 0;
+
+    if (e2 >= 0)
+    {
+        uint32_t q = Log10Pow2(e2);
+        e10 = (int32_t)q;
+        int32_t k = FLOAT_POW5_INV_BITCOUNT + Pow5Bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        vr = MulShift(mv, FLOAT_POW5_INV_SPLIT[q], i);
+        vp = MulShift(mp, FLOAT_POW5_INV_SPLIT[q], i);
+        vm = MulShift(mm, FLOAT_POW5_INV_SPLIT[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            // one removed digit is needed for the rounding even if the loop below removes none
+            int32_t l = FLOAT_POW5_INV_BITCOUNT + Pow5Bits((int32_t)q - 1) - 1;
+            lastRemovedDigit = (uint8_t)(MulShift(mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + (int32_t)q - 1 + l) % 10);
+        }
+        if (q <= 9)
+        {
+            // only one of mp, mv and mm can be a multiple of 5, if any
+            if (mv % 5 == 0)
+            {
+                vrIsTrailingZeros = IsMultipleOfPow5(mv, q);
+            }
+            else if (acceptBounds)
+            {
+                vmIsTrailingZeros = IsMultipleOfPow5(mm, q);
+            }
+            else
+            {
+                vp -= IsMultipleOfPow5(mp, q);
+            }
+        }
+    }
+    else
+    {
+        uint32_t q = Log10Pow5(-e2);
+        e10 = (int32_t)q + e2;
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = Pow5Bits(i) - FLOAT_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        vr = MulShift(mv, FLOAT_POW5_SPLIT[i], j);
+        vp = MulShift(mp, FLOAT_POW5_SPLIT[i], j);
+        vm = MulShift(mm, FLOAT_POW5_SPLIT[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10)
+        {
+            j = (int32_t)q - 1 - (Pow5Bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            lastRemovedDigit = (uint8_t)(MulShift(mv, FLOAT_POW5_SPLIT[i + 1], j) % 10);
+        }
+        if (q <= 1)
+        {
+            // mv = 4 * m2 has at least two trailing zero bits
+            vrIsTrailingZeros = true;
+            if (acceptBounds)
+            {
+                vmIsTrailingZeros = mmShift == 1;
+            }
+            else
+            {
+                vp--;
+            }
+        }
+        else if (q < 31)
+        {
+            vrIsTrailingZeros = IsMultipleOfPow2(mv, q - 1);
+        }
+    }
+
+    // drop digits while the interval still holds a shorter decimal
+    int32_t removed = 0;
+    uint32_t output;
+    if (vmIsTrailingZeros || vrIsTrailingZeros)
+    {
+        while (vp / 10 > vm / 10)
+        {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vmIsTrailingZeros)
+        {
+            while (vm % 10 == 0)
+            {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = (uint8_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+        {
+            // exactly halfway, round to even
+            lastRemovedDigit = 4;
+        }
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+    }
+    else
+    {
+        while (vp / 10 > vm / 10)
+        {
+            lastRemovedDigit = (uint8_t)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || lastRemovedDigit >= 5);
+    }
+
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+size_t FormatFloatShortest(char* out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool negative = (bits >> 31) != 0;
+    uint32_t ieeeMantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+    uint32_t ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+
+    if (ieeeExponent == (1u << FLOAT_EXPONENT_BITS) - 1)
+    {
+        return FormatSpecial(out, negative, ieeeMantissa != 0);
+    }
+    if (ieeeExponent == 0 && ieeeMantissa == 0)
+    {
+        return LayoutDecimal(out, negative, 0, 0);
+    }
+
+    uint32_t digits;
+    int32_t exponent;
+    FloatToDecimal(ieeeMantissa, ieeeExponent, &digits, &exponent);
+    return LayoutDecimal(out, negative, digits, exponent);
+}
+
+/*
+ * Doubles are rare in the metadata (geo packets), their shortest digits are
+ * found by printing 15, 16 and 17 significant digits until one reads back.
+ * 15 digits, correctly rounded, hold any shorter decimal that reads back;
+ * not so for subnormals, which search from one digit up.
+ */
+size_t FormatDoubleShortest(char* out, double value)
+{
+    if (!isfinite(value))
+    {
+        return FormatSpecial(out, signbit(value) != 0, isnan(value));
+    }
+    if (value == 0.0)
+    {
+        return LayoutDecimal(out, signbit(value) != 0, 0, 0);
+    }
+
+    char text[40];
+    for (int precision = isnormal(value) ? 15 : 1; precision <= 17; precision++)
+    {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        if (precision == 17 || strtod(text, NULL) == value)
+        {
+            break;
+        }
+    }
+
+    // [-]d.ddde[+-]x
+    const char* p = text;
+    bool negative = *p == '-';
+    p += negative;
+    uint64_t digits = 0;
+    int32_t count = 0;
+    for (; *p != 'e'; p++)
+    {
+        if (*p != '.')
+        {
+            digits = digits * 10 + (uint64_t)(*p - '0');
+            count++;
+        }
+    }
+    int32_t exponent = atoi(p + 1) - (count - 1);
+    return LayoutDecimal(out, negative, digits, exponent);
+}
+
+typedef struct
+{
+    uint64_t hi;
+    uint64_t lo;
+} SUInt128;
+
+static SUInt128 Multiply64(uint64_t a, uint64_t b)
+{
+    uint64_t aLo = (uint32_t)a, aHi = a >> 32;
+    uint64_t bLo = (uint32_t)b, bHi = b >> 32;
+    uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+
+    SUInt128 product;
+    product.lo = (mid << 32) | (uint32_t)ll;
+    product.hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return product;
+}
+
+static inline bool GetBit128(SUInt128 value, int bit)
+{
+    return ((bit < 64 ? value.lo >> bit : value.hi >> (bit - 64)) & 1) != 0;
+}
+
+/* Any of the bits below 'bit' set */
+static inline bool HasBitsBelow128(SUInt128 value, int bit)
+{
+    if (bit <= 64)
+    {
+        return bit > 0 && (value.lo & (UINT64_MAX >> (64 - bit))) != 0;
+    }
+    return value.lo != 0 || (value.hi & (UINT64_MAX >> (128 - bit))) != 0;
+}
+
+/*
+ * value * 10^decimals rounded half to even, exactly as glibc and the UCRT
+ * round in printf(). The binary value m * 2^e is scaled in integers:
+ * m * 10^decimals fits 128 bits, false if the result does not fit 64 bits.
+ */
+static bool ScaleFixed(double value, int decimals, uint64_t* scaled)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+    int32_t exponent = (int32_t)((bits >> 52) & 0x7FF);
+
+    if (exponent == 0 && mantissa == 0)
+    {
+        *scaled = 0;
+        return true;
+    }
+
+    uint64_t m = exponent != 0 ? mantissa | (1ULL << 52) : mantissa;
+    int32_t e = (exponent != 0 ? exponent : 1) - 1075;
+
+    // floats have at most 24 significant bits, keeps the product small
+    while ((m & 1) == 0)
+    {
+        m >>= 1;
+        e++;
+    }
+
+    SUInt128 product = Multiply64(m, POW10[decimals]);
+    if (e >= 0)
+    {
+        if (product.hi != 0 || e >= 64 || (e > 0 && (product.lo >> (64 - e)) != 0))
+        {
+            return false;
+        }
+        *scaled = product.lo << e;
+        return true;
+    }
+
+    int shift = -e;
+    if (shift >= 128)
+    {
+        // product < 2^117, far below half a unit
+        *scaled = 0;
+        return true;
+    }
+
+    uint64_t q;
+    if (shift < 64)
+    {
+        if ((product.hi >> shift) != 0)
+        {
+            return false;
+        }
+        q = (product.lo >> shift) | (product.hi << (64 - shift));
+    }
+    else
+    {
+        q = product.hi >> (shift - 64);
+    }
+
+    if (GetBit128(product, shift - 1) && (HasBitsBelow128(product, shift - 1) || (q & 1) != 0))
+    {
+        if (q == UINT64_MAX)
+        {
+            return false;
+        }
+        q++;
+    }
+    *scaled = q;
+    return true;
+}
+
+size_t FormatFixed(char* out, double value, int decimals)
+{
+    uint64_t scaled;
+    if (!isfinite(value) || decimals < 0 || decimals > 18 || !ScaleFixed(value, decimals, &scaled))
+    {
+        return (size_t)snprintf(out, TEXT_MAX_VALUE, "%.*f", decimals, value);
+    }
+
+    char* p = out;
+    if (signbit(value))
+    {
+        // printf keeps the sign of values that round to zero: -0.000000
+        *p++ = '-';
+    }
+    p += FormatUInt(p, scaled / POW10[decimals]);
+    if (decimals > 0)
+    {
+        char fraction[20];
+        size_t length = FormatUInt(fraction, scaled % POW10[decimals]);
+        *p++ = '.';
+        memset(p, '0', decimals - length);
+        p += decimals - length;
+        memcpy(p, fraction, length);
+        p += length;
+    }
+    return (size_t)(p - out);
+}
+
+int OpenTextWriter(STextWriter* writer, FILE* file, ETextFloats floats)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->data = malloc(TEXT_WRITER_CAPACITY);
+    if (writer->data == NULL)
+    {
+        return -1;
+    }
+    writer->file = file;
+    writer->floats = floats;
+    writer->capacity = TEXT_WRITER_CAPACITY;
+    return 0;
+}
+
+int FlushTextWriter(STextWriter* writer)
+{
+    if (writer->size > 0 && !writer->failed &&
+        fwrite(writer->data, 1, writer->size, writer->file) != writer->size)
+    {
+        writer->failed = true;
+    }
+    writer->size = 0;
+    return writer->failed ? -1 : 0;
+}
+
+int CloseTextWriter(STextWriter* writer)
+{
+    int ret = writer->data != NULL ? FlushTextWriter(writer) : 0;
+    free(writer->data);
+    memset(writer, 0, sizeof(*writer));
+    return ret;
+}
+
+void TextWrite(STextWriter* writer, const char* text, size_t length)
+{
+    if (length > writer->capacity)
+    {
+        FlushTextWriter(writer);
+        if (!writer->failed && fwrite(text, 1, length, writer->file) != length)
+        {
+            writer->failed = true;
+        }
+        return;
+    }
+
+    memcpy(ReserveText(writer, length), text, length);
+    writer->size += length;
+}
+
+void TextUInt(STextWriter* writer, uint64_t value)
+{
+    writer->size += FormatUInt(ReserveText(writer, 20), value);
+}
+
+void TextFloat(STextWriter* writer, float value, int decimals)
+{
+    char* out = ReserveText(writer, TEXT_MAX_VALUE);
+    writer->size += writer->floats == TEXT_FLOATS_LEGACY ? FormatFixed(out, value, decimals) :
+        FormatFloatShortest(out, value);
+}
+
+void TextDouble(STextWriter* writer, double value, int decimals)
+{
+    char* out = ReserveText(writer, TEXT_MAX_VALUE);
+    writer->size += writer->floats == TEXT_FLOATS_LEGACY ? FormatFixed(out, value, decimals) :
+        FormatDoubleShortest(out, value);
+}
@@ -0,0 +1,86 @@
+/**
+ * @file TextWriter.h
+ * Buffered text output with fast number formatting for the CSV and stdout rows
+ *
+ * Values are formatted straight into one reusable buffer per output, which
+ * goes to the file with a single fwrite() whenever it is full, no stdio
+ * call or allocation per value.
+ *
+ * Floats are written in one of two ways:
+ *   TEXT_FLOATS_SHORTEST  the shortest decimal that reads back as the same
+ *                         float (double for TextDouble()), Ryu for floats,
+ *                         laid out like Python repr(): 0.0123, 100.0, 1e-05
+ *   TEXT_FLOATS_LEGACY    printf("%.Nf") with the 'decimals' given per value,
+ *                         byte for byte; computed exactly in integers, values
+ *                         too large for that and nan/inf go through snprintf
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    TEXT_FLOATS_SHORTEST,
+    TEXT_FLOATS_LEGACY,
+} ETextFloats;
+
+/** Buffer size, one fwrite() per this many bytes */
+#define TEXT_WRITER_CAPACITY (256 * 1024)
+
+/** Longest single value: printf("%.8f", -DBL_MAX) */
+#define TEXT_MAX_VALUE 330
+
+typedef struct
+{
+    FILE* file;
+    ETextFloats floats;
+
+    char* data;
+    size_t size;
+    size_t capacity;
+
+    /** Set by the first failed fwrite(), later output is dropped */
+    bool failed;
+} STextWriter;
+
+/**
+ * Start buffering output to 'file', which stays owned by the caller
+ * @return 0 on success, -1 if the buffer can not be allocated
+ */
+int OpenTextWriter(STextWriter* writer, FILE* file, ETextFloats floats);
+
+/** Write the buffered text to the file, -1 if this or an earlier write failed */
+int FlushTextWriter(STextWriter* writer);
+
+/** Flush and free the buffer, the file is not closed. Safe on a zeroed struct */
+int CloseTextWriter(STextWriter* writer);
+
+/** Make room for 'length' more bytes, flushing the buffer if needed */
+static inline char* ReserveText(STextWriter* writer, size_t length)
+{
+    if (writer->capacity - writer->size < length)
+    {
+        FlushTextWriter(writer);
+    }
+    return writer->data + writer->size;
+}
+
+void TextWrite(STextWriter* writer, const char* text, size_t length);
+
+/** Write a string literal */
+#define TEXT_LITERAL(writer, literal) TextWrite(writer, literal, sizeof(literal) - 1)
+
+void TextUInt(STextWriter* writer, uint64_t value);
+
+/** Write 'value' as configured, 'decimals' is the printf precision of TEXT_FLOATS_LEGACY */
+void TextFloat(STextWriter* writer, float value, int decimals);
+void TextDouble(STextWriter* writer, double value, int decimals);
+
+/** The formatters behind TextFloat()/TextDouble(), 'out' must hold TEXT_MAX_VALUE bytes, returns the length */
+size_t FormatFloatShortest(char* out, float value);
+size_t FormatDoubleShortest(char* out, double value);
+size_t FormatFixed(char* out, double value, int decimals);
@@ -0,0 +1,111 @@
+/**
+ * @file Threads.h
+ * Mutexes and threads on POSIX threads or, under MSVC and MinGW, the Windows API
+ *
+ * SMutex can be initialized statically with MUTEX_INITIALIZER. A thread runs
+ * a function taking and returning void*, its return value is not kept.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#if _WIN32
+#include <windows.h>
+#include <process.h>
+
+typedef SRWLOCK SMutex;
+#define MUTEX_INITIALIZER SRWLOCK_INIT
+
+typedef struct
+{
+    HANDLE handle;
+    void* (*function)(void* arg);
+    void* arg;
+} SThread;
+
+static inline void InitMutex(SMutex* mutex)
+{
+    InitializeSRWLock(mutex);
+}
+
+static inline void DestroyMutex(SMutex* mutex)
+{
+    (void)mutex;
+}
+
+static inline void LockMutex(SMutex* mutex)
+{
+    AcquireSRWLockExclusive(mutex);
+}
+
+static inline void UnlockMutex(SMutex* mutex)
+{
+    ReleaseSRWLockExclusive(mutex);
+}
+
+static inline unsigned __stdcall RunThread(void* thread)
+{
+    SThread* self = thread;
+    self->function(self->arg);
+    return 0;
+}
+
+/** 'thread' must stay in place until JoinThread(), it is passed to the new thread */
+static inline int StartThread(SThread* thread, void* (*function)(void* arg), void* arg)
+{
+    thread->function = function;
+    thread->arg = arg;
+    thread->handle = (HANDLE)_beginthreadex(NULL, 0, RunThread, thread, 0, NULL);
+    return thread->handle != NULL ? 0 : -1;
+}
+
+static inline void JoinThread(SThread* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t SMutex;
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+typedef struct
+{
+    pthread_t handle;
+} SThread;
+
+static inline void InitMutex(SMutex* mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+static inline void DestroyMutex(SMutex* mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static inline void LockMutex(SMutex* mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static inline void UnlockMutex(SMutex* mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+/** 'thread' must stay in place until JoinThread(), it is passed to the new thread */
+static inline int StartThread(SThread* thread, void* (*function)(void* arg), void* arg)
+{
+    return pthread_create(&thread->handle, NULL, function, arg) == 0 ? 0 : -1;
+}
+
+static inline void JoinThread(SThread* thread)
+{
+    pthread_join(thread->handle, NULL);
+}
+
+#endif
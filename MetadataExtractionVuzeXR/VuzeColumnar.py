@@ -0,0 +1,79 @@
+import struct
+import numpy as np
+
+# Layout written by ColumnarWriter.c, see ColumnarWriter.h
+COLUMNAR_MAGIC = b"VZCOLS1\0"
+FILE_HEADER = struct.Struct("<8sIIQ16sIII12x")
+COLUMN_HEADER = struct.Struct("<24s8sIIQ")
+
+def ReadColumnarHeader(path):
+
+    with open(path, "rb") as f:
+        magic, version, column_count, row_count, stream, fps_num, fps_den, skew_us = \
+            FILE_HEADER.unpack(f.read(FILE_HEADER.size))
+
+        if magic != COLUMNAR_MAGIC:
+            raise ValueError("%s is not a columnar metadata file" % path)
+
+        columns = []
+        for i in range(column_count):
+            name, dtype, item_size, _, offset = COLUMN_HEADER.unpack(f.read(COLUMN_HEADER.size))
+            columns.append((name.rstrip(b"\0").decode(), dtype.rstrip(b"\0").decode(), offset))
+
+    info = {
+        "version": version,
+        "stream": stream.rstrip(b"\0").decode(),
+        "rows": row_count,
+        "fps": fps_num / fps_den if fps_den else 0.0,
+        "fps_fraction": (fps_num, fps_den),
+        "rolling_shutter_skew_us": skew_us,
+    }
+    return info, columns
+
+def LoadColumnar(path):
+    """Returns (info, {column name: read-only np.memmap}) without copying the data"""
+
+    info, columns = ReadColumnarHeader(path)
+
+    arrays = {}
+    for name, dtype, offset in columns:
+        if info["rows"] == 0:
+            arrays[name] = np.empty(0, dtype=dtype)
+        else:
+            arrays[name] = np.memmap(path, dtype=dtype, mode="r", offset=offset, shape=(info["rows"],))
+
+    return info, arrays
+
+# Layout written by QuaternionTrack.c, see QuaternionTrack.h
+QUATERNION_TRACK_MAGIC = b"VZQUAT1\0"
+QUATERNION_TRACK_HEADER = struct.Struct("<8sIIQQ")
+QUATERNION_TRACK_SCALE = 32767
+
+def LoadQuaternionTrack(path):
+    """Returns (relTsUs of the steps, float32 (w, x, y, z) per step) of a --fusion track"""
+
+    with open(path, "rb") as f:
+        magic, version, rate_hz, first_step, step_count = \
+            QUATERNION_TRACK_HEADER.unpack(f.read(QUATERNION_TRACK_HEADER.size))
+
+    if magic != QUATERNION_TRACK_MAGIC:
+        raise ValueError("%s is not a quaternion track" % path)
+
+    # a track still being written has no count yet
+    items = np.memmap(path, dtype="<i2", mode="r", offset=QUATERNION_TRACK_HEADER.size).reshape(-1, 4)
+    if step_count != 0:
+        items = items[:step_count]
+
+    steps = first_step + np.arange(len(items), dtype=np.uint64)
+    timestamps_us = steps * np.uint64(1000000) // np.uint64(rate_hz)
+    return timestamps_us, items.astype(np.float32) / QUATERNION_TRACK_SCALE
+
+
+if __name__ == "__main__":
+
+    import sys
+
+    info, arrays = LoadColumnar(sys.argv[1])
+    print(info)
+    for name, values in arrays.items():
+        print("%-16s %-4s %s" % (name, values.dtype.str, values[:5]))
@@ -0,0 +1,676 @@
+/*
+ * Copyright (C) 2018 Rhonda Software.
+ * All rights reserved.
+ */
+
+/**
+ * @file VuzeMetadata.c
+ * Locate and decode binary metadata from the UDTA of a MOV/MP4 file
+ */
+
+// Instruct GCC to use 64-bit off_t/fseeko/ftello, which is not the default on MinGW
+#define _FILE_OFFSET_BITS 64
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AtomLocator.h"
+#include "MappedFile.h"
+#include "VuzeMetadata.h"
+
+_Static_assert(sizeof(off_t) > 4, "off_t must be greater than 32 bits to fseek over 2 GB");
+
+/** Storage large enough for any known packet */
+typedef union
+{
+    SMetadataPacketHeader header;
+    SImuPacket imu;
+    SGeoPacket geo;
+    SIqPacket iq;
+    STemperaturePacket temperature;
+} UPacket;
+
+static int Perror(FILE* mov, const char* str)
+{
+    if (feof(mov))
+    {
+        fprintf(stderr, "%s: Unexpected end of file\n", str);
+    }
+    else
+    {
+        perror(str);
+    }
+    return -1;
+}
+
+uint32_t GetFrameIndex(uint64_t pts, SFraction fps)
+{
+    uint64_t frameIndex = 0ULL;
+    frameIndex = (pts * fps.num + fps.num - 1) / fps.den / 1000000ULL;
+    return (uint32_t)frameIndex;
+}
+
+uint64_t GetFrameStartUs(uint32_t frame, SFraction fps)
+{
+    // smallest pts with pts * num + num - 1 >= frame * den * 1000000, see GetFrameIndex()
+    return (uint64_t)frame * fps.den * 1000000ULL / fps.num;
+}
+
+/*
+ * Emit<Name>Packets(): hand 'count' packets of one type, back to back at
+ * 'data', to the batch callback of the type or one by one to its packet
+ * callback. The packet size is known at compile time, the frame indices are
+ * computed in one pass over the run.
+ */
+#define DEFINE_EMIT_PACKETS(typeId, Name, title, stream) \
+    static int Emit##Name##Packets(const SMetadataCallbacks* callbacks, const uint8_t* data, size_t count, \
+        SFraction fps, uint32_t* frameIndices) \
+    { \
+        const S##Name##Packet* packets = (const S##Name##Packet*)data; \
+        if (callbacks->on##Name##Batch != NULL) \
+        { \
+            for (size_t i = 0; i < count; i++) \
+            { \
+                frameIndices[i] = GetFrameIndex(packets[i].header.relTsUs, fps); \
+            } \
+            return callbacks->on##Name##Batch(callbacks->context, packets, frameIndices, count); \
+        } \
+        if (callbacks->on##Name == NULL) \
+        { \
+            return 0; \
+        } \
+        for (size_t i = 0; i < count; i++) \
+        { \
+            int ret = callbacks->on##Name(callbacks->context, &packets[i], \
+                GetFrameIndex(packets[i].header.relTsUs, fps)); \
+            if (ret != 0) \
+            { \
+                return ret; \
+            } \
+        } \
+        return 0; \
+    }
+
+METADATA_PACKET_TYPES(DEFINE_EMIT_PACKETS)
+#undef DEFINE_EMIT_PACKETS
+
+typedef struct
+{
+    size_t size;
+    const char* title;
+    int (*emit)(const SMetadataCallbacks* callbacks, const uint8_t* data, size_t count, SFraction fps,
+        uint32_t* frameIndices);
+} SPacketType;
+
+#define PACKET_TYPE_ENTRY(typeId, Name, title, stream) \
+    [typeId] = { sizeof(S##Name##Packet), title, Emit##Name##Packets },
+static const SPacketType PACKET_TYPES[PACKET_TYPE_COUNT] = { METADATA_PACKET_TYPES(PACKET_TYPE_ENTRY) };
+#undef PACKET_TYPE_ENTRY
+
+size_t GetPacketSize(uint8_t typeId)
+{
+    return typeId < PACKET_TYPE_COUNT ? PACKET_TYPES[typeId].size : 0;
+}
+
+const char* GetPacketTypeName(uint8_t typeId)
+{
+    return typeId < PACKET_TYPE_COUNT ? PACKET_TYPES[typeId].title : "unknown";
+}
+
+void InitPacketRun(SPacketRun* run, const SMetadataCallbacks* callbacks, SFraction fps)
+{
+    run->callbacks = callbacks;
+    run->fps = fps;
+    run->typeId = 0;
+    run->first = NULL;
+    run->count = 0;
+}
+
+int FlushPacketRun(SPacketRun* run)
+{
+    size_t count = run->count;
+    if (count == 0)
+    {
+        return 0;
+    }
+    run->count = 0;
+    return PACKET_TYPES[run->typeId].emit(run->callbacks, run->first, count, run->fps, run->frameIndices);
+}
+
+int AddPacketToRun(SPacketRun* run, const SMetadataPacketHeader* packet)
+{
+    int ret = 0;
+    const uint8_t* data = (const uint8_t*)packet;
+
+    if (run->count > 0 && (packet->typeId != run->typeId || run->count == PACKET_BATCH_SIZE ||
+        data != run->first + run->count * PACKET_TYPES[run->typeId].size))
+    {
+        ret = FlushPacketRun(run);
+    }
+    if (run->count == 0)
+    {
+        run->typeId = packet->typeId;
+        run->first = data;
+    }
+    run->count++;
+    return ret;
+}
+
+/** Timestamp bounds of a SDecodeRange, resolved once the fps is known */
+typedef struct
+{
+    uint64_t fromUs;
+    uint64_t toUs;
+
+    /** Packets beyond this end decoding */
+    uint64_t stopUs;
+} STimeRange;
+
+static STimeRange ResolveRange(const SDecodeRange* range, SFraction fps)
+{
+    STimeRange resolved = { 0, UINT64_MAX, UINT64_MAX };
+    if (range == NULL)
+    {
+        return resolved;
+    }
+
+    resolved.fromUs = range->fromUs;
+    resolved.toUs = range->toUs;
+
+    if (fps.num != 0 && fps.den != 0)
+    {
+        uint64_t frameFromUs = GetFrameStartUs(range->fromFrame, fps);
+        if (frameFromUs > resolved.fromUs)
+        {
+            resolved.fromUs = frameFromUs;
+        }
+
+        if (range->toFrame != UINT32_MAX)
+        {
+            uint64_t frameEndUs = GetFrameStartUs(range->toFrame + 1, fps);
+            uint64_t frameToUs = frameEndUs > 0 ? frameEndUs - 1 : 0;
+            if (frameToUs < resolved.toUs)
+            {
+                resolved.toUs = frameToUs;
+            }
+        }
+    }
+
+    resolved.stopUs = resolved.toUs > UINT64_MAX - DECODE_RANGE_SLACK_US ?
+        UINT64_MAX : resolved.toUs + DECODE_RANGE_SLACK_US;
+    return resolved;
+}
+
+/* Report a corrupt packet after the packets before it */
+static int ReportCorrupt(SPacketRun* run, const SMetadataPacketHeader* header, uint64_t offset,
+    const SMetadataCallbacks* callbacks)
+{
+    int ret = FlushPacketRun(run);
+    if (callbacks->onCorrupt != NULL)
+    {
+        callbacks->onCorrupt(callbacks->context, header, offset);
+    }
+    return ret;
+}
+
+static void ReportResync(const SMetadataCallbacks* callbacks, uint64_t offset, uint64_t skipped)
+{
+    if (callbacks->onResync != NULL)
+    {
+        callbacks->onResync(callbacks->context, offset, skipped);
+    }
+}
+
+typedef enum
+{
+    RESYNC_CHAIN_BROKEN,
+    RESYNC_CHAIN_CONFIRMED,
+    RESYNC_CHAIN_UNDECIDED,
+} EResyncChain;
+
+/* Does a chain of plausible packets start at 'data', see FindResyncPoint() */
+static EResyncChain CheckResyncChain(const uint8_t* data, size_t size, uint64_t lastTsUs, bool atEnd)
+{
+    uint64_t previousTsUs = lastTsUs;
+
+    for (int i = 0; i <= RESYNC_CONFIRM_PACKETS; i++)
+    {
+        SMetadataPacketHeader header;
+        if (size < sizeof(header))
+        {
+            // the last packets of bmdt confirm a candidate as far as they go
+            return !atEnd ? RESYNC_CHAIN_UNDECIDED : i > 0 ? RESYNC_CHAIN_CONFIRMED : RESYNC_CHAIN_BROKEN;
+        }
+        memcpy(&header, data, sizeof(header));
+
+        size_t packetSize = GetPacketSize(header.typeId);
+        if (packetSize == 0 || header.length + sizeof(uint16_t) != packetSize)
+        {
+            return RESYNC_CHAIN_BROKEN;
+        }
+
+        // sensors are not in strict timestamp order, but neither go back nor jump within a chain
+        if (header.relTsUs + DECODE_RANGE_SLACK_US < previousTsUs ||
+            (i > 0 && header.relTsUs > previousTsUs + DECODE_RANGE_SLACK_US))
+        {
+            return RESYNC_CHAIN_BROKEN;
+        }
+
+        if (size < packetSize)
+        {
+            return !atEnd ? RESYNC_CHAIN_UNDECIDED : i > 0 ? RESYNC_CHAIN_CONFIRMED : RESYNC_CHAIN_BROKEN;
+        }
+        previousTsUs = header.relTsUs;
+        data += packetSize;
+        size -= packetSize;
+    }
+    return RESYNC_CHAIN_CONFIRMED;
+}
+
+size_t FindResyncPoint(const uint8_t* data, size_t size, uint64_t lastTsUs, bool atEnd, bool* found)
+{
+    for (size_t offset = 0; offset < size; offset++)
+    {
+        EResyncChain chain = CheckResyncChain(data + offset, size - offset, lastTsUs, atEnd);
+        if (chain != RESYNC_CHAIN_BROKEN)
+        {
+            *found = chain == RESYNC_CHAIN_CONFIRMED;
+            return offset;
+        }
+    }
+    *found = false;
+    return size;
+}
+
+/*
+ * Read on from the second byte of the corrupt packet at 'offset' until
+ * FindResyncPoint() decides, and leave the file at the packet found or at
+ * the end of bmdt. Only runs after a corrupt packet, the decode loop itself
+ * stays as it is.
+ */
+static int ResyncFile(FILE* mov, uint64_t offset, uint64_t size, uint64_t lastTsUs, uint64_t* skipped)
+{
+    uint8_t* window = malloc(RESYNC_WINDOW_SIZE);
+    if (window == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    // the file is past the packet header already
+    int ret = 0;
+    if (fseeko(mov, -(off_t)(sizeof(SMetadataPacketHeader) - 1), SEEK_CUR) != 0)
+    {
+        ret = Perror(mov, "Failed to seek back to resynchronize");
+    }
+
+    uint64_t windowOffset = offset + 1;
+    size_t filled = 0;
+
+    while (ret == 0)
+    {
+        size_t length = RESYNC_WINDOW_SIZE - filled;
+        if (size - (windowOffset + filled) < length)
+        {
+            length = (size_t)(size - (windowOffset + filled));
+        }
+        if (length > 0 && fread(window + filled, length, 1, mov) != 1)
+        {
+            ret = Perror(mov, "Failed to read packets to resynchronize");
+            break;
+        }
+        filled += length;
+
+        bool atEnd = windowOffset + filled == size;
+        bool found;
+        size_t next = FindResyncPoint(window, filled, lastTsUs, atEnd, &found);
+        if (found || atEnd)
+        {
+            *skipped = windowOffset + next - offset;
+            if (fseeko(mov, -(off_t)(filled - next), SEEK_CUR) != 0)
+            {
+                ret = Perror(mov, "Failed to seek to resynchronized packet");
+            }
+            break;
+        }
+
+        // an undecided candidate is less than RESYNC_CONFIRM_PACKETS + 1 packets from the end of the window
+        memmove(window, window + next, filled - next);
+        filled -= next;
+        windowOffset += next;
+    }
+
+    free(window);
+    return ret;
+}
+
+int FindBmdt(FILE* mov, off_t* offset, uint64_t* size)
+{
+    SAtomLocation location;
+    if (LocateBmdt(mov, &location) != 0)
+    {
+        return -1;
+    }
+
+    if (fseeko(mov, (off_t)location.bmdt.offset, SEEK_SET) != 0)
+    {
+        return Perror(mov, "Failed to seek to 'moov/udta/bmdt'");
+    }
+
+    *offset = (off_t)location.bmdt.offset;
+    *size = location.bmdt.size;
+    return 0;
+}
+
+/*
+ * Decode packets from 'startOffset' on, which must be a packet boundary
+ * relative to the bmdt payload. The metadata header is read first in any case.
+ * 'bytesRead' receives the bytes walked, header and skipped packets included.
+ */
+static int DecodeFileRange(FILE* mov, uint64_t size, uint64_t startOffset, const SDecodeRange* range,
+    bool resync, const SMetadataCallbacks* callbacks, uint64_t* bytesRead)
+{
+    int ret = 0;
+    SMetadataHeader metaHeader = { 0 };
+
+    // Read header
+    if (size < sizeof(metaHeader) || fread(&metaHeader, sizeof(metaHeader), 1, mov) != 1)
+    {
+        return Perror(mov, "Failed to read metadata header");
+    }
+
+    if (callbacks->onHeader != NULL)
+    {
+        ret = callbacks->onHeader(callbacks->context, &metaHeader);
+    }
+
+    uint64_t offset = sizeof(metaHeader);
+    UPacket packet;
+    STimeRange times = ResolveRange(range, metaHeader.fps);
+    uint64_t lastTsUs = 0;
+    bool seeded = false;
+    *bytesRead = offset;
+
+    // packets are read back to back into 'batch' until the run is passed on
+    uint8_t batch[PACKET_BATCH_SIZE * sizeof(UPacket)];
+    size_t used = 0;
+    SPacketRun run;
+    InitPacketRun(&run, callbacks, metaHeader.fps);
+
+    if (startOffset > offset && startOffset < size)
+    {
+        if (fseeko(mov, (off_t)(startOffset - offset), SEEK_CUR) != 0)
+        {
+            return Perror(mov, "Failed to seek to range");
+        }
+        offset = startOffset;
+    }
+    uint64_t firstOffset = offset;
+
+    while (ret == 0 && offset + sizeof(SMetadataPacketHeader) <= size)
+    {
+        if (fread(&packet.header, sizeof(packet.header), 1, mov) != 1)
+        {
+            FlushPacketRun(&run);
+            return Perror(mov, "Failed to read packet header");
+        }
+
+        size_t totalLength = packet.header.length + sizeof(uint16_t);
+        bool truncated = totalLength < sizeof(packet.header) || offset + totalLength > size;
+
+        if (truncated && !resync)
+        {
+            FlushPacketRun(&run);
+            fprintf(stderr, "Truncated packet at bmdt offset %" PRIu64 "!\n", offset);
+            return -1;
+        }
+
+        size_t payloadLength = totalLength - sizeof(packet.header);
+
+        bool valid = !truncated && totalLength == GetPacketSize(packet.header.typeId);
+        bool inRange = packet.header.relTsUs >= times.fromUs && packet.header.relTsUs <= times.toUs;
+
+        if (valid && packet.header.relTsUs > times.stopUs)
+        {
+            break;
+        }
+
+        if (!valid && resync)
+        {
+            uint64_t skipped = 0;
+            ret = ReportCorrupt(&run, &packet.header, offset, callbacks);
+            if (ResyncFile(mov, offset, size, lastTsUs, &skipped) != 0)
+            {
+                return -1;
+            }
+            ReportResync(callbacks, offset, skipped);
+            offset += skipped;
+            continue;
+        }
+        if (valid)
+        {
+            lastTsUs = ContinueTimestamp(lastTsUs, seeded, packet.header.relTsUs);
+            seeded = true;
+        }
+
+        if (!valid || !inRange)
+        {
+            if (!valid)
+            {
+                ret = ReportCorrupt(&run, &packet.header, offset, callbacks);
+            }
+            if (fseeko(mov, payloadLength, SEEK_CUR) != 0)
+            {
+                FlushPacketRun(&run);
+                return Perror(mov, "Failed to skip packet");
+            }
+        }
+        else
+        {
+            if (run.count > 0 && (run.typeId != packet.header.typeId || run.count == PACKET_BATCH_SIZE))
+            {
+                ret = FlushPacketRun(&run);
+            }
+            if (run.count == 0)
+            {
+                used = 0;
+            }
+
+            uint8_t* slot = batch + used;
+            memcpy(slot, &packet.header, sizeof(packet.header));
+            if (fread(slot + sizeof(packet.header), payloadLength, 1, mov) != 1)
+            {
+                FlushPacketRun(&run);
+                return Perror(mov, "Failed to read packet");
+            }
+            used += totalLength;
+            if (ret == 0)
+            {
+                ret = AddPacketToRun(&run, (const SMetadataPacketHeader*)slot);
+            }
+        }
+
+        offset += totalLength;
+    }
+
+    if (ret == 0)
+    {
+        ret = FlushPacketRun(&run);
+    }
+    *bytesRead = sizeof(metaHeader) + offset - firstOffset;
+    return ret;
+}
+
+int DecodeBmdtFile(FILE* mov, uint64_t size, const SMetadataCallbacks* callbacks)
+{
+    uint64_t bytesRead;
+    return DecodeFileRange(mov, size, 0, NULL, false, callbacks, &bytesRead);
+}
+
+/*
+ * Same walk as DecodeFileRange(), but the packed packet structs are used in
+ * place, there is no read or copy per packet.
+ */
+static int DecodeBufferRange(const uint8_t* data, size_t size, uint64_t startOffset,
+    const SDecodeRange* range, bool resync, const SMetadataCallbacks* callbacks, uint64_t* bytesRead)
+{
+    int ret = 0;
+    *bytesRead = 0;
+
+    if (size < sizeof(SMetadataHeader))
+    {
+        fprintf(stderr, "bmdt too short for metadata header!\n");
+        return -1;
+    }
+
+    const SMetadataHeader* metaHeader = (const SMetadataHeader*)data;
+    SFraction fps = metaHeader->fps;
+
+    if (callbacks->onHeader != NULL)
+    {
+        ret = callbacks->onHeader(callbacks->context, metaHeader);
+    }
+
+    const uint8_t* ptr = data + sizeof(SMetadataHeader);
+    const uint8_t* end = data + size;
+    STimeRange times = ResolveRange(range, fps);
+    uint64_t lastTsUs = 0;
+    bool seeded = false;
+
+    if (startOffset > sizeof(SMetadataHeader) && startOffset < size)
+    {
+        ptr = data + startOffset;
+    }
+    const uint8_t* first = ptr;
+
+    // runs of packets of one type go to the callbacks in place
+    SPacketRun run;
+    InitPacketRun(&run, callbacks, fps);
+
+    while (ret == 0 && (size_t)(end - ptr) >= sizeof(SMetadataPacketHeader))
+    {
+        const SMetadataPacketHeader* header = (const SMetadataPacketHeader*)ptr;
+        size_t totalLength = header->length + sizeof(uint16_t);
+        bool truncated = totalLength < sizeof(SMetadataPacketHeader) || totalLength > (size_t)(end - ptr);
+
+        if (truncated && !resync)
+        {
+            FlushPacketRun(&run);
+            fprintf(stderr, "Truncated packet at bmdt offset %zu!\n", (size_t)(ptr - data));
+            return -1;
+        }
+
+        if (truncated || totalLength != GetPacketSize(header->typeId))
+        {
+            uint64_t offset = (uint64_t)(ptr - data);
+            ret = ReportCorrupt(&run, header, offset, callbacks);
+            if (resync)
+            {
+                bool found;
+                size_t skipped = 1 + FindResyncPoint(ptr + 1, (size_t)(end - ptr) - 1, lastTsUs, true, &found);
+                ReportResync(callbacks, offset, skipped);
+                ptr += skipped;
+                continue;
+            }
+        }
+        else if (header->relTsUs >= times.fromUs && header->relTsUs <= times.toUs)
+        {
+            lastTsUs = ContinueTimestamp(lastTsUs, seeded, header->relTsUs);
+            seeded = true;
+            ret = AddPacketToRun(&run, header);
+        }
+        else if (header->relTsUs > times.stopUs)
+        {
+            break;
+        }
+        else
+        {
+            lastTsUs = ContinueTimestamp(lastTsUs, seeded, header->relTsUs);
+            seeded = true;
+        }
+
+        ptr += totalLength;
+    }
+
+    if (ret == 0)
+    {
+        ret = FlushPacketRun(&run);
+    }
+    *bytesRead = sizeof(SMetadataHeader) + (uint64_t)(ptr - first);
+    return ret;
+}
+
+int DecodeBmdtBuffer(const uint8_t* data, size_t size, const SMetadataCallbacks* callbacks)
+{
+    uint64_t bytesRead;
+    return DecodeBufferRange(data, size, 0, NULL, false, callbacks, &bytesRead);
+}
+
+int DecodeMetadata(FILE* mov, const SDecodeOptions* options, const SMetadataCallbacks* callbacks)
+{
+    static const SDecodeOptions defaults = { 0 };
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+
+    off_t offset = 0;
+    uint64_t size = 0;
+    int ret = 0;
+    SProfileMark locate, decode;
+    ProfileBegin(options->profile, PROFILE_LOCATE_BMDT, &locate);
+
+    if (options->index != NULL)
+    {
+        offset = (off_t)options->index->header.bmdtOffset;
+        size = options->index->header.bmdtSize;
+        if (fseeko(mov, offset, SEEK_SET) != 0)
+        {
+            return Perror(mov, "Failed to seek to 'moov/udta/bmdt'");
+        }
+    }
+    else
+    {
+        ret = FindBmdt(mov, &offset, &size);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    // with an index, skip everything before the range
+    uint64_t startOffset = 0;
+    if (options->index != NULL && options->range != NULL)
+    {
+        STimeRange times = ResolveRange(options->range, options->index->header.metaHeader.fps);
+        startOffset = FindIndexedOffset(options->index, times.fromUs);
+    }
+    ProfileEnd(options->profile, PROFILE_LOCATE_BMDT, &locate);
+
+    uint64_t bytesRead = 0;
+    ProfileBegin(options->profile, PROFILE_DECODE_BMDT, &decode);
+    if (!options->useMmap)
+    {
+        ret = DecodeFileRange(mov, size, startOffset, options->range, options->resync, callbacks, &bytesRead);
+    }
+    else
+    {
+        SMappedRange bmdt;
+        if ((size_t)size != size || MapFileRange(mov, offset, (size_t)size, &bmdt) != 0)
+        {
+            return Perror(mov, "Failed to map 'moov/udta/bmdt'");
+        }
+
+        ret = DecodeBufferRange(bmdt.data, bmdt.size, startOffset, options->range, options->resync, callbacks,
+            &bytesRead);
+        UnmapFileRange(&bmdt);
+    }
+    ProfileEnd(options->profile, PROFILE_DECODE_BMDT, &decode);
+
+    if (options->profile != NULL)
+    {
+        options->profile->bytesRead += bytesRead;
+    }
+    return ret;
+}
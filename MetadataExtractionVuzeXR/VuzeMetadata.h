@@ -0,0 +1,195 @@
+/**
+ * @file VuzeMetadata.h
+ * Decoding of the binary metadata stored in the moov/udta/bmdt atom of
+ * Vuze XR MOV/MP4 files. Packets are delivered through typed callbacks,
+ * no text formatting is done by the library.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "LargeFile.h"
+#include "MetadataFormat.h"
+#include "MetadataIndex.h"
+#include "MetadataPackets.h"
+#include "Profiler.h"
+
+/** Most packets passed to one batch callback */
+#define PACKET_BATCH_SIZE 256
+
+/**
+ * Callbacks of one packet type, e.g. onImu and onImuBatch for SImuPacket:
+ * onImu receives one packet, onImuBatch a run of up to PACKET_BATCH_SIZE
+ * consecutive packets of the type, as a packed array, with their frame indices.
+ * If both are set only the batch callback is called.
+ */
+#define METADATA_PACKET_CALLBACKS(typeId, Name, title, stream) \
+    int (*on##Name)(void* context, const S##Name##Packet* packet, uint32_t frameIndex); \
+    int (*on##Name##Batch)(void* context, const S##Name##Packet* packets, const uint32_t* frameIndices, \
+        size_t count);
+
+/**
+ * Packet callbacks. Every callback is optional, packets of a type without
+ * callback are skipped without further work. A non-zero return value stops
+ * decoding and is returned by the Decode* function. Packet pointers are only
+ * valid for the duration of the call. Packets arrive in file order, a batch
+ * ends where a packet of another type, a corrupt packet or the end of a read
+ * comes in between.
+ */
+typedef struct
+{
+    /** Passed back as first argument of every callback */
+    void* context;
+
+    /** Called once with the bmdt header, before any packet */
+    int (*onHeader)(void* context, const SMetadataHeader* header);
+
+    METADATA_PACKET_TYPES(METADATA_PACKET_CALLBACKS)
+
+    /** Packet of unknown type or with unexpected length, 'offset' is relative to the bmdt payload */
+    void (*onCorrupt)(void* context, const SMetadataPacketHeader* header, uint64_t offset);
+
+    /**
+     * Decoding went on 'skipped' bytes after the corrupt packet at 'offset',
+     * at the next packet found by FindResyncPoint() or the end of bmdt (resync only)
+     */
+    void (*onResync)(void* context, uint64_t offset, uint64_t skipped);
+} SMetadataCallbacks;
+
+/**
+ * Inclusive packet range, every bound applies. Packets outside are skipped and
+ * decoding stops DECODE_RANGE_SLACK_US after 'toUs' or the end of 'toFrame'.
+ */
+typedef struct
+{
+    uint64_t fromUs;
+    uint64_t toUs;
+    uint32_t fromFrame;
+    uint32_t toFrame;
+} SDecodeRange;
+
+/** Packets of different sensors are not stored in strict timestamp order, keep going this long past the range */
+#define DECODE_RANGE_SLACK_US 1000000ULL
+
+/** Range covering all packets */
+#define DECODE_RANGE_ALL { 0, UINT64_MAX, 0, UINT32_MAX }
+
+typedef struct
+{
+    /** Map the bmdt payload and decode packets in place instead of reading packet by packet */
+    bool useMmap;
+
+    /** Take the bmdt location from this index instead of walking the atoms, may be NULL */
+    const SMetadataIndex* index;
+
+    /** Decode only this range, may be NULL. With an index decoding starts at the range */
+    const SDecodeRange* range;
+
+    /** Receives the locate/decode times and the bytes walked, may be NULL (see Profiler.h) */
+    SProfile* profile;
+
+    /**
+     * Search for the next packet after a corrupt one instead of trusting its
+     * length, and go on after truncated packets instead of failing
+     */
+    bool resync;
+} SDecodeOptions;
+
+/** Video frame index of a packet timestamp, rounded up */
+uint32_t GetFrameIndex(uint64_t pts, SFraction fps);
+
+/** First packet timestamp that GetFrameIndex() maps to 'frame' or later */
+uint64_t GetFrameStartUs(uint32_t frame, SFraction fps);
+
+/** Expected total size of a packet of the given type, 0 for unknown types */
+size_t GetPacketSize(uint8_t typeId);
+
+/** Human readable packet type name, "unknown" for unknown types */
+const char* GetPacketTypeName(uint8_t typeId);
+
+/**
+ * Packets waiting for their callbacks: a run of packets of one type that lie
+ * back to back in memory. Lets decoders outside this file (MetadataFollower.h)
+ * batch like the Decode* functions do.
+ */
+typedef struct
+{
+    const SMetadataCallbacks* callbacks;
+    SFraction fps;
+
+    uint8_t typeId;
+    const uint8_t* first;
+    size_t count;
+
+    uint32_t frameIndices[PACKET_BATCH_SIZE];
+} SPacketRun;
+
+void InitPacketRun(SPacketRun* run, const SMetadataCallbacks* callbacks, SFraction fps);
+
+/**
+ * Add a packet whose size was checked against GetPacketSize(). The run is
+ * passed to the callbacks first if the packet does not continue it; the
+ * packet must stay in place until the next FlushPacketRun().
+ * @return the non-zero return value of a callback, else 0
+ */
+int AddPacketToRun(SPacketRun* run, const SMetadataPacketHeader* packet);
+
+/** Pass the pending packets to the callbacks, before anything else is reported or the memory reused */
+int FlushPacketRun(SPacketRun* run);
+
+/** Packets that must follow a resynchronization candidate, see FindResyncPoint() */
+#define RESYNC_CONFIRM_PACKETS 3
+
+/** Bytes read at once while resynchronizing a stdio decode */
+#define RESYNC_WINDOW_SIZE (64 * 1024)
+
+/**
+ * Find where packets start again after a corrupt one. A candidate is a packet
+ * of known type and size, no older than 'lastTsUs' (see ContinueTimestamp())
+ * minus DECODE_RANGE_SLACK_US, followed by RESYNC_CONFIRM_PACKETS more such
+ * packets, each within DECODE_RANGE_SLACK_US of its predecessor.
+ * @param data bytes after the start of the corrupt packet
+ * @param atEnd 'data' ends with the bmdt, else more bytes may follow and a
+ *        candidate that runs into the end of 'data' is left undecided
+ * @param found set if a packet starts at the returned offset
+ * @return offset of the packet found, else of the first undecided candidate
+ *         or 'size': the bytes before it hold no packet start
+ */
+size_t FindResyncPoint(const uint8_t* data, size_t size, uint64_t lastTsUs, bool atEnd, bool* found);
+
+/**
+ * Timestamp the packets after a corrupt one must continue, updated with
+ * every good packet. The first good packet decoded sets it ('seeded' false),
+ * whatever its timestamp: a decode may start in the middle of the bmdt. After
+ * that it moves forward by at most DECODE_RANGE_SLACK_US at a time, so a
+ * damaged timestamp in a packet whose type and length survived can not rule
+ * out the packets that follow.
+ */
+static inline uint64_t ContinueTimestamp(uint64_t lastTsUs, bool seeded, uint64_t relTsUs)
+{
+    return !seeded || relTsUs - lastTsUs <= DECODE_RANGE_SLACK_US ? relTsUs : lastTsUs;
+}
+
+/**
+ * Locate moov/udta/bmdt with LocateBmdt(), see AtomLocator.h. On success the
+ * file is positioned at the start of the bmdt payload.
+ * @return 0 on success, -1 on failure (reported to stderr)
+ */
+int FindBmdt(FILE* mov, off_t* offset, uint64_t* size);
+
+/** Decode 'size' bytes of bmdt payload at the current file position with stdio reads */
+int DecodeBmdtFile(FILE* mov, uint64_t size, const SMetadataCallbacks* callbacks);
+
+/** Decode a bmdt payload that is already in memory (mapped or loaded) */
+int DecodeBmdtBuffer(const uint8_t* data, size_t size, const SMetadataCallbacks* callbacks);
+
+/**
+ * Locate and decode the bmdt atom of an open MOV/MP4 file.
+ * @param options may be NULL for defaults
+ */
+int DecodeMetadata(FILE* mov, const SDecodeOptions* options, const SMetadataCallbacks* callbacks);
@@ -0,0 +1,283 @@
+import ntpath
+import os
+import queue
+import sys
+import threading
+import time
+import cv2
+from ImageWriterPool import ImageWriterPool
+from Profiler import NULL_PROFILER
+from UnstitchMovieFramesVuzeXR import UnstitchImage, LEFT_EYE_SCHEME, RIGHT_EYE_SCHEME
+
+# NativeNFOV.py and its library, see GnomonicProjectionVuzeXR/HowToCompile.txt
+PROJECTION_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "GnomonicProjectionVuzeXR")
+
+LEFT_VIEW_SCHEME = "_LEFT_VIEW_"
+RIGHT_VIEW_SCHEME = "_RIGHT_VIEW_"
+
+# camera orientation of frames without one in the orientation file
+IDENTITY = (1.0, 0.0, 0.0, 0.0)
+
+LEFT_EYE = 0
+RIGHT_EYE = 1
+EYE_SCHEMES = (LEFT_EYE_SCHEME, RIGHT_EYE_SCHEME)
+VIEW_SCHEMES = (LEFT_VIEW_SCHEME, RIGHT_VIEW_SCHEME)
+
+# marks the end of the stream in the queues
+END_OF_STREAM = None
+
+class FramePool():
+    """Decode buffers handed out again once every user of a frame released it"""
+
+    def __init__(self, size):
+        self.size = size
+        self.free = queue.Queue()
+        self.allocated = 0
+
+    def acquire(self):
+        """A free buffer, or None while fewer than 'size' exist and cv2 should allocate a new one.
+        Blocks when all buffers are in use, which bounds the frames in flight."""
+
+        try:
+            return self.free.get_nowait()
+        except queue.Empty:
+            pass
+        if self.allocated < self.size:
+            self.allocated += 1
+            return None
+        return self.free.get()
+
+    def release(self, buffer):
+        self.free.put(buffer)
+
+class StreamedFrame():
+    """One decoded frame on its way through the pipeline"""
+
+    def __init__(self, number, frame, pool):
+        self.number = number
+        self.frame = frame
+
+        # strided views into 'frame', no copy
+        self.eyes = UnstitchImage(frame)
+
+        # projections of each eye, one per center point
+        self.views = ([], [])
+
+        # one reference per eye worker, see retain()
+        self.pool = pool
+        self.references = 2
+        self.lock = threading.Lock()
+
+    @property
+    def left_eye(self):
+        return self.eyes[LEFT_EYE]
+
+    @property
+    def right_eye(self):
+        return self.eyes[RIGHT_EYE]
+
+    def retain(self):
+        """Keeps the frame buffer out of the pool for a sink that still uses it after returning"""
+
+        with self.lock:
+            self.references += 1
+
+    def release(self):
+        """Drops a reference, the last one returns the buffer to the pool for the next frame"""
+
+        with self.lock:
+            self.references -= 1
+            last = self.references == 0
+        if last:
+            self.eyes = None
+            self.pool.release(self.frame)
+            self.frame = None
+
+def WriteImage(writer, frame, path, image):
+    """cv2.imwrite() without a 'writer', else queued there while 'frame' is kept out of the pool"""
+
+    if writer is None:
+        cv2.imwrite(path, image)
+    else:
+        frame.retain()
+        try:
+            writer.write(path, image, frame.release)
+        except Exception:
+            # not queued, an earlier image failed: 'on_done' will not run
+            frame.release()
+            raise
+
+class EyeImageSink():
+    """The left/right eye image dump of ProcessMovie(), same file names"""
+
+    def __init__(self, target_dir, naming_scheme, extension=".jpg", writer=None):
+        self.image_paths = [os.path.join(target_dir, naming_scheme + scheme) for scheme in EYE_SCHEMES]
+        self.extension = extension
+        self.writer = writer
+
+    def __call__(self, frame, eye):
+        path = "%s%d%s" %(self.image_paths[eye], frame.number, self.extension)
+        WriteImage(self.writer, frame, path, frame.eyes[eye])
+
+class ViewImageSink():
+    """Writes the projected views as <naming_scheme>_LEFT_VIEW_<view>_<frame>.jpg"""
+
+    def __init__(self, target_dir, naming_scheme, extension=".jpg", writer=None):
+        self.image_paths = [os.path.join(target_dir, naming_scheme + scheme) for scheme in VIEW_SCHEMES]
+        self.extension = extension
+        self.writer = writer
+
+    def __call__(self, frame, eye):
+        for index, view in enumerate(frame.views[eye]):
+            path = "%s%d_%d%s" %(self.image_paths[eye], index, frame.number, self.extension)
+            WriteImage(self.writer, frame, path, view)
+
+def LoadNativeNFOV(height, width):
+
+    if PROJECTION_DIR not in sys.path:
+        sys.path.append(PROJECTION_DIR)
+    from NativeNFOV import NativeNFOV
+    return NativeNFOV(height, width)
+
+class FramePipeline():
+    """
+    decode + split -> per eye: project -> sinks. The decoder reads into
+    pooled buffers and hands both eyes as strided views of the same buffer
+    to one worker thread per eye; the buffer is reused once both eyes are
+    done. Bounded queues keep at most 'queue_size' frames in front of each
+    worker. A sink is any callable taking (StreamedFrame, eye) and runs on
+    the worker of that eye. With 'orientations' ({frame: (w, x, y, z)}, see
+    SparseFrames.LoadOrientations()) the views are stabilized: counter-rotated
+    by the camera orientation of each frame, or of each row with orientations
+    of the first, middle and last scanline. 'profiler' times decoding, the
+    projections (NativeNFOV.toNFOVs ...) and the sinks.
+    """
+
+    def __init__(self, sinks, center_points=None, view_size=(800, 1600), queue_size=4, orientations=None,
+                 profiler=NULL_PROFILER):
+        self.sinks = list(sinks)
+        self.center_points = list(center_points) if center_points is not None else []
+        self.queue_size = queue_size
+        self.orientations = orientations
+        self.profiler = profiler
+
+        # one projector per eye, the native library keeps the tables of both
+        self.projectors = [LoadNativeNFOV(*view_size) for eye in EYE_SCHEMES] if self.center_points else None
+        for projector in self.projectors or []:
+            for method in ("toNFOV", "toNFOVs", "toStabilizedNFOVs"):
+                profiler.instrument(projector, method)
+        self.projection_threads = max(1, (os.cpu_count() or 2) // len(EYE_SCHEMES))
+
+        self.stop = threading.Event()
+        self.errors = []
+        self.total_frames = 0
+
+    def _fail(self, error):
+        self.errors.append(error)
+        self.stop.set()
+
+    def _decode(self, movie_path, outputs, pool):
+
+        movie_cap = cv2.VideoCapture(movie_path)
+        try:
+            if not movie_cap.isOpened():
+                raise IOError("Can not open %s" %movie_path)
+            self.total_frames = int(movie_cap.get(cv2.CAP_PROP_FRAME_COUNT))
+
+            frame_number = 0
+            while not self.stop.is_set():
+                buffer = pool.acquire()
+                with self.profiler.scope("decode_frame"):
+                    ret, frame = movie_cap.read(buffer)
+                if not ret:
+                    break
+                self.profiler.count("frames")
+                self.profiler.count("decoded_bytes", frame.nbytes)
+
+                streamed = StreamedFrame(frame_number, frame, pool)
+                for output in outputs:
+                    output.put(streamed)
+                frame_number += 1
+        except Exception as error:
+            self._fail(error)
+        finally:
+            movie_cap.release()
+            for output in outputs:
+                output.put(END_OF_STREAM)
+
+    def _process_eye(self, eye, input):
+        """Projection and sinks of one eye, after an error the input is only drained"""
+
+        while True:
+            frame = input.get()
+            if frame is END_OF_STREAM:
+                break
+
+            try:
+                if not self.stop.is_set():
+                    if self.projectors is not None and self.orientations is not None:
+                        orientation = self.orientations.get(frame.number, IDENTITY)
+                        frame.views[eye][:] = self.projectors[eye].toStabilizedNFOVs(frame.eyes[eye],
+                                                                                     self.center_points, orientation)
+                    elif self.projectors is not None:
+                        frame.views[eye][:] = self.projectors[eye].toNFOVs(frame.eyes[eye], self.center_points,
+                                                                           threads=self.projection_threads)
+                    with self.profiler.scope("sinks"):
+                        for sink in self.sinks:
+                            sink(frame, eye)
+                    if eye == LEFT_EYE:
+                        self.frames_done += 1
+            except Exception as error:
+                self._fail(error)
+            finally:
+                frame.release()
+
+    def run(self, movie_path):
+        """Streams the whole movie through the pipeline, returns the number of frames"""
+
+        self.stop.clear()
+        self.errors = []
+        self.frames_done = 0
+
+        # every queued frame holds a buffer, plus the ones being decoded and processed
+        pool = FramePool(self.queue_size + 3)
+        eye_queues = [queue.Queue(self.queue_size) for eye in EYE_SCHEMES]
+        threads = [threading.Thread(target=self._decode, args=(movie_path, eye_queues, pool), name="decode")]
+        for eye, eye_queue in enumerate(eye_queues):
+            threads.append(threading.Thread(target=self._process_eye, args=(eye, eye_queue), name="eye%d" %eye))
+
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        if self.errors:
+            raise self.errors[0]
+        return self.frames_done
+
+def StreamMovie(movie_path, target_dir, naming_scheme, write_eyes=True, center_points=None, writer_threads=None,
+                orientations=None, profiler=NULL_PROFILER):
+    """ProcessMovie() as a streaming pipeline, optionally with projected views of both eyes,
+    stabilized with 'orientations'"""
+
+    writer = ImageWriterPool(writer_threads, profiler=profiler)
+    sinks = []
+    if write_eyes:
+        sinks.append(EyeImageSink(target_dir, naming_scheme, writer=writer))
+    if center_points:
+        sinks.append(ViewImageSink(target_dir, naming_scheme, writer=writer))
+
+    print("Stream frames of %s" %ntpath.basename(movie_path))
+    start = time.perf_counter()
+    try:
+        pipeline = FramePipeline(sinks, center_points, orientations=orientations, profiler=profiler)
+        with profiler.scope("StreamMovie"):
+            frames = pipeline.run(movie_path)
+    finally:
+        writer.close()
+    elapsed = time.perf_counter() - start
+
+    print("Number of frames: %d of %d, %.1f frames/s" %(frames, pipeline.total_frames, frames / max(elapsed, 1e-9)))
+    writer.print_stats()
+    print("Images saved to: %s" %target_dir)
+    return 1
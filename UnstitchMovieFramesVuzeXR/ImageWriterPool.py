@@ -0,0 +1,130 @@
+import os
+import queue
+import threading
+import time
+import cv2
+from Profiler import NULL_PROFILER
+
+class ImageWriterPool():
+    """
+    Encodes and writes images on 'threads' threads (default: one per
+    processor). write() only queues the image; at most 'max_in_flight' images
+    wait for a free encoder, further calls block until one is taken, so a
+    fast producer is held back instead of piling up frames in memory. The
+    format follows the file extension like cv2.imwrite(), the files are
+    byte for byte the same. cv2.imencode() releases the GIL, so the encoders
+    run in parallel with each other and with the producer. Encoding and
+    writing are timed as stage "encode_image" of 'profiler'.
+    """
+
+    def __init__(self, threads=None, max_in_flight=None, params=None, profiler=NULL_PROFILER):
+        self.threads = threads if threads else os.cpu_count() or 1
+        self.max_in_flight = max_in_flight if max_in_flight else 2 * self.threads
+        self.params = list(params) if params is not None else []
+        self.jobs = queue.Queue(self.max_in_flight)
+        self.errors = []
+        self.profiler = profiler
+        self.closed = False
+
+        # statistics, guarded by 'lock'
+        self.lock = threading.Lock()
+        self.submitted = 0
+        self.written = 0
+        self.bytes_written = 0
+        self.encode_seconds = 0.0
+        self.depth_sum = 0
+        self.depth_max = 0
+        self.start_time = time.perf_counter()
+
+        self.workers = [threading.Thread(target=self._work, name="writer%d" %i) for i in range(self.threads)]
+        for worker in self.workers:
+            worker.start()
+
+    def write(self, path, image, on_done=None):
+        """Queues 'image' for 'path', 'on_done()' is called on an encoder thread once it is written or
+        failed. 'image' must not change until then. Raises the first error of an earlier image, the
+        encoders are stopped before, a caller that does not reach close() leaves no thread waiting."""
+
+        if self.errors:
+            self._stop()
+            raise self.errors[0]
+
+        depth = self.jobs.qsize()
+        with self.lock:
+            self.submitted += 1
+            self.depth_sum += depth
+            self.depth_max = max(self.depth_max, depth)
+
+        self.jobs.put((path, image, on_done))
+
+    def _work(self):
+
+        while True:
+            job = self.jobs.get()
+            if job is None:
+                break
+
+            path, image, on_done = job
+            try:
+                start = time.perf_counter()
+                with self.profiler.scope("encode_image"):
+                    ret, data = cv2.imencode(os.path.splitext(path)[1], image, self.params)
+                    if not ret:
+                        raise IOError("Can not encode %s" %path)
+                    data.tofile(path)
+                self.profiler.count("images_written")
+                self.profiler.count("image_bytes", data.size)
+
+                with self.lock:
+                    self.written += 1
+                    self.bytes_written += data.size
+                    self.encode_seconds += time.perf_counter() - start
+            except Exception as error:
+                self.errors.append(error)
+            finally:
+                if on_done is not None:
+                    on_done()
+
+    def _stop(self):
+        """Lets the encoders finish the queued images and waits for them, once"""
+
+        if self.closed:
+            return
+        self.closed = True
+
+        for worker in self.workers:
+            self.jobs.put(None)
+        for worker in self.workers:
+            worker.join()
+        self.end_time = time.perf_counter()
+
+    def close(self):
+        """Waits for all queued images, raises the first error"""
+
+        self._stop()
+        if self.errors:
+            raise self.errors[0]
+
+    def stats(self):
+        """Throughput and queue depth seen by write(), valid after close()"""
+
+        elapsed = max(getattr(self, "end_time", time.perf_counter()) - self.start_time, 1e-9)
+        return {
+            "threads": self.threads,
+            "images": self.written,
+            "bytes": self.bytes_written,
+            "images_per_second": self.written / elapsed,
+            "encode_ms_per_image": self.encode_seconds * 1000 / max(self.written, 1),
+            "mean_queue_depth": self.depth_sum / max(self.submitted, 1),
+            "max_queue_depth": self.depth_max,
+            "queue_size": self.max_in_flight,
+        }
+
+    def print_stats(self):
+
+        stats = self.stats()
+        print("Wrote %d images (%.1f MB) on %d threads: %.1f images/s, %.1f ms encode per image" %(
+            stats["images"], stats["bytes"] / 1e6, stats["threads"], stats["images_per_second"],
+            stats["encode_ms_per_image"]))
+        print("Writer queue depth: mean %.1f, max %d of %d" %(
+            stats["mean_queue_depth"], stats["max_queue_depth"], stats["queue_size"]))
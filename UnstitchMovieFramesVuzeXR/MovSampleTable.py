@@ -0,0 +1,142 @@
+import bisect
+import os
+import struct
+import numpy as np
+
+# Sample tables of the video track of a MOV/MP4 file, read from
+# moov/trak/mdia/minf/stbl like AtomLocator.c finds moov/udta/bmdt
+
+ATOM_HEADER = struct.Struct(">I4s")
+LARGE_SIZE = struct.Struct(">Q")
+FULL_ATOM_HEADER = struct.Struct(">I")
+
+def ReadAtoms(f, start, end):
+    """(type, payload offset, payload end) of the atoms in [start, end), 64-bit and size-0 atoms included"""
+
+    atoms = []
+    offset = start
+    while offset + ATOM_HEADER.size <= end:
+        f.seek(offset)
+        size, atom_type = ATOM_HEADER.unpack(f.read(ATOM_HEADER.size))
+        header_size = ATOM_HEADER.size
+
+        if size == 1:
+            size = LARGE_SIZE.unpack(f.read(LARGE_SIZE.size))[0]
+            header_size += LARGE_SIZE.size
+        elif size == 0:
+            size = end - offset
+
+        if size < header_size or offset + size > end:
+            break
+        atoms.append((atom_type, offset + header_size, offset + size))
+        offset += size
+    return atoms
+
+def FindAtom(f, start, end, path):
+    """Payload range of the first atom along 'path' (list of types), None if missing"""
+
+    for atom_type in path:
+        found = [atom for atom in ReadAtoms(f, start, end) if atom[0] == atom_type]
+        if not found:
+            return None
+        _, start, end = found[0]
+    return start, end
+
+def ReadPayload(f, atom):
+
+    f.seek(atom[0])
+    return f.read(atom[1] - atom[0])
+
+class SampleTable():
+    """
+    Per frame timing, key frames and file position of the first video track.
+    Frames are numbered from 0 like cv2.CAP_PROP_POS_FRAMES and GetFrameIndex().
+    """
+
+    def __init__(self, movie_path):
+
+        with open(movie_path, "rb") as f:
+            file_size = os.fstat(f.fileno()).st_size
+            moov = FindAtom(f, 0, file_size, [b"moov"])
+            if moov is None:
+                raise ValueError("%s has no moov atom" %movie_path)
+
+            for atom_type, start, end in ReadAtoms(f, *moov):
+                if atom_type == b"trak" and self._is_video(f, start, end):
+                    self._read_track(f, start, end)
+                    return
+
+        raise ValueError("%s has no video track" %movie_path)
+
+    @staticmethod
+    def _is_video(f, start, end):
+
+        hdlr = FindAtom(f, start, end, [b"mdia", b"hdlr"])
+        # version/flags, pre_defined, handler_type
+        return hdlr is not None and ReadPayload(f, hdlr)[8:12] == b"vide"
+
+    def _read_track(self, f, start, end):
+
+        mdia = FindAtom(f, start, end, [b"mdia"])
+        mdhd = ReadPayload(f, FindAtom(f, *mdia, [b"mdhd"]))
+        # version 1 has 64-bit creation/modification times and duration
+        self.timescale = struct.unpack_from(">I", mdhd, 20 if mdhd[0] == 1 else 12)[0]
+
+        stbl = FindAtom(f, *mdia, [b"minf", b"stbl"])
+        tables = {atom_type: (payload_start, payload_end) for atom_type, payload_start, payload_end in ReadAtoms(f, *stbl)}
+
+        # stts: runs of (sample count, duration)
+        stts = np.frombuffer(ReadPayload(f, tables[b"stts"]), dtype=">u4", offset=8).reshape(-1, 2).astype(np.int64)
+        durations = np.repeat(stts[:, 1], stts[:, 0])
+        self.frame_count = len(durations)
+        self.timestamps = np.concatenate(([0], np.cumsum(durations)[:-1])) if self.frame_count else np.empty(0, np.int64)
+
+        # stss: 1-based numbers of the sync samples, every sample is one without it
+        if b"stss" in tables:
+            self.keyframes = (np.frombuffer(ReadPayload(f, tables[b"stss"]), dtype=">u4", offset=8).astype(np.int64) - 1).tolist()
+        else:
+            self.keyframes = list(range(self.frame_count))
+
+        # stsz: common sample size or one size per sample
+        stsz = ReadPayload(f, tables[b"stsz"])
+        sample_size, count = struct.unpack_from(">II", stsz, 4)
+        self.sizes = np.full(count, sample_size, np.int64) if sample_size else \
+            np.frombuffer(stsz, dtype=">u4", offset=12, count=count).astype(np.int64)
+
+        # stco/co64: chunk offsets, stsc: runs of (first chunk, samples per chunk, description)
+        if b"co64" in tables:
+            chunks = np.frombuffer(ReadPayload(f, tables[b"co64"]), dtype=">u8", offset=8).astype(np.int64)
+        else:
+            chunks = np.frombuffer(ReadPayload(f, tables[b"stco"]), dtype=">u4", offset=8).astype(np.int64)
+        stsc = np.frombuffer(ReadPayload(f, tables[b"stsc"]), dtype=">u4", offset=8).reshape(-1, 3).astype(np.int64)
+
+        first_chunks = np.append(stsc[:, 0] - 1, len(chunks))
+        samples_per_chunk = np.repeat(stsc[:, 1], np.diff(first_chunks))
+        chunk_of_sample = np.repeat(np.arange(len(chunks)), samples_per_chunk)[:count]
+        first_sample_of_chunk = np.concatenate(([0], np.cumsum(samples_per_chunk)[:-1]))
+
+        # offset of a sample: its chunk plus the sizes of the samples before it in the chunk
+        sizes_before = np.concatenate(([0], np.cumsum(self.sizes)[:-1]))
+        self.offsets = chunks[chunk_of_sample] + sizes_before - sizes_before[first_sample_of_chunk[chunk_of_sample]]
+
+    def time_of(self, frame):
+        """Presentation time of 'frame' in seconds (without edit lists)"""
+
+        return self.timestamps[frame] / self.timescale
+
+    def keyframe_before(self, frame):
+        """Last key frame at or before 'frame', decoding has to start there"""
+
+        index = bisect.bisect_right(self.keyframes, frame) - 1
+        return self.keyframes[max(index, 0)]
+
+
+if __name__ == "__main__":
+
+    import sys
+
+    table = SampleTable(sys.argv[1])
+    print("Frames: %d, timescale %d, %d key frames" %(table.frame_count, table.timescale, len(table.keyframes)))
+    for frame in table.keyframes[:10]:
+        print("  key frame %6d at %8.3f s, offset %d, %d bytes" %(
+            frame, table.time_of(frame), table.offsets[frame], table.sizes[frame]))
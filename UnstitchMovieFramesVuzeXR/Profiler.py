@@ -0,0 +1,113 @@
+import functools
+import json
+import threading
+import time
+
+class Profiler():
+    """
+    Scoped timers and counters of one run, written as a JSON summary like
+    ExtractMetadata --profile. A stage sums the wall time and the CPU time of
+    the calling thread over its scopes, scopes of several threads add up.
+    Pass NULL_PROFILER instead to switch profiling off: its scopes and
+    counters do nothing and instrument() leaves the object untouched.
+    """
+
+    enabled = True
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.stages = {}
+        self.counters = {}
+        self.start_time = time.perf_counter()
+
+    def scope(self, stage):
+        """with profiler.scope("decode"): ... adds the time of the block to 'stage'"""
+
+        return _Scope(self, stage)
+
+    def add(self, stage, wall_seconds, cpu_seconds):
+
+        with self.lock:
+            timer = self.stages.setdefault(stage, [0, 0.0, 0.0])
+            timer[0] += 1
+            timer[1] += wall_seconds
+            timer[2] += cpu_seconds
+
+    def count(self, counter, value=1):
+
+        with self.lock:
+            self.counters[counter] = self.counters.get(counter, 0) + value
+
+    def instrument(self, obj, method, stage=None):
+        """Times every call of obj.method as 'stage' (default: the class and method name), by replacing
+        the bound method on this instance only"""
+
+        function = getattr(obj, method)
+        stage = stage if stage is not None else "%s.%s" %(type(obj).__name__, method)
+
+        @functools.wraps(function)
+        def timed(*args, **kwargs):
+            with _Scope(self, stage):
+                return function(*args, **kwargs)
+
+        setattr(obj, method, timed)
+        return obj
+
+    def summary(self):
+
+        with self.lock:
+            return {
+                "wall_s": time.perf_counter() - self.start_time,
+                "counters": dict(self.counters),
+                "stages": {stage: {"calls": calls, "wall_s": wall, "cpu_s": cpu}
+                           for stage, (calls, wall, cpu) in self.stages.items()},
+            }
+
+    def write_json(self, path):
+
+        with open(path, "w") as f:
+            json.dump(self.summary(), f, indent=2)
+
+class _Scope():
+
+    def __init__(self, profiler, stage):
+        self.profiler = profiler
+        self.stage = stage
+
+    def __enter__(self):
+        self.cpu = time.thread_time()
+        self.wall = time.perf_counter()
+        return self
+
+    def __exit__(self, *exception):
+        wall = time.perf_counter() - self.wall
+        self.profiler.add(self.stage, wall, time.thread_time() - self.cpu)
+        return False
+
+class _NullScope():
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exception):
+        return False
+
+class _NullProfiler():
+    """Profiler with profiling off"""
+
+    enabled = False
+    _scope = _NullScope()
+
+    def scope(self, stage):
+        return self._scope
+
+    def add(self, stage, wall_seconds, cpu_seconds):
+        pass
+
+    def count(self, counter, value=1):
+        pass
+
+    def instrument(self, obj, method, stage=None):
+        return obj
+
+NULL_PROFILER = _NullProfiler()
@@ -0,0 +1,169 @@
+import os
+import sys
+import time
+import cv2
+import numpy as np
+from ImageWriterPool import ImageWriterPool
+from MovSampleTable import SampleTable
+from Profiler import NULL_PROFILER
+from UnstitchMovieFramesVuzeXR import UnstitchImage, LEFT_EYE_SCHEME, RIGHT_EYE_SCHEME
+
+# VuzeColumnar.py for the .vzc output of ExtractMetadata
+METADATA_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "MetadataExtractionVuzeXR")
+
+# frames_<name>.csv header of ExtractMetadata --frames -> column names of frames_<name>.vzc
+FRAME_CSV_COLUMNS = {
+    "FrameNumber": "frame", "Samples": "samples", "ExposureTimestamp[µs]": "exposure_us",
+    "xAccel": "accel_x", "yAccel": "accel_y", "zAccel": "accel_z",
+    "xGyro": "gyro_x", "yGyro": "gyro_y", "zGyro": "gyro_z",
+    "xRotation": "rotation_x", "yRotation": "rotation_y", "zRotation": "rotation_z",
+    "xAccelMean": "mean_accel_x", "yAccelMean": "mean_accel_y", "zAccelMean": "mean_accel_z",
+    "xGyroMean": "mean_gyro_x", "yGyroMean": "mean_gyro_y", "zGyroMean": "mean_gyro_z",
+}
+
+def ParseFrameList(value):
+    """"0,5,10-20" -> [0, 5, 10, 11, ..., 20]"""
+
+    frames = []
+    for part in value.split(","):
+        if "-" in part:
+            first, last = part.split("-")
+            frames.extend(range(int(first), int(last) + 1))
+        elif part:
+            frames.append(int(part))
+    return frames
+
+def LoadFrameImu(path):
+    """{column: array} of the per-frame rows of ExtractMetadata --frames or --orientation, .vzc or .csv"""
+
+    if path.endswith(".vzc"):
+        if METADATA_DIR not in sys.path:
+            sys.path.append(METADATA_DIR)
+        from VuzeColumnar import LoadColumnar
+        return LoadColumnar(path)[1]
+
+    # the header holds a latin-1 micro sign
+    with open(path, encoding="latin-1") as f:
+        header = [FRAME_CSV_COLUMNS.get(name.strip(), name.strip()) for name in f.readline().split(",")]
+        values = np.loadtxt(f, delimiter=",", ndmin=2)
+    return {name: values[:, i] for i, name in enumerate(header)}
+
+def FindFrameImu(target_dir, naming_scheme, stream="frames"):
+    """<stream>_<name>.vzc or .csv that ExtractMetadata --frames (or --orientation with
+    stream="orientation") wrote to the same directory, None if neither"""
+
+    for extension in (".vzc", ".csv"):
+        path = os.path.join(target_dir, "%s_%s%s" %(stream, naming_scheme, extension))
+        if os.path.isfile(path):
+            return path
+    return None
+
+def LoadOrientations(path, rolling_shutter=False):
+    """{frame: (w, x, y, z)} of an orientation_<name>.vzc/.csv, with 'rolling_shutter'
+    {frame: (first row, exposure, last row)} quaternions for NativeNFOV.toStabilizedNFOVs()"""
+
+    columns = LoadFrameImu(path)
+    prefixes = ("first_", "", "last_") if rolling_shutter else ("",)
+    quaternions = np.stack([np.stack([columns[prefix + name] for name in ("qw", "qx", "qy", "qz")], axis=1)
+                            for prefix in prefixes], axis=1).astype(np.float64)
+    if not rolling_shutter:
+        return {int(frame): tuple(q[0]) for frame, q in zip(columns["frame"], quaternions)}
+    return {int(frame): tuple(map(tuple, q)) for frame, q in zip(columns["frame"], quaternions)}
+
+def SelectFrames(frame_imu, predicate):
+    """
+    Frames whose IMU rows satisfy 'predicate': a callable taking the column
+    arrays and returning a boolean mask, or an expression over the column
+    names such as "sqrt(mean_gyro_x**2 + mean_gyro_y**2 + mean_gyro_z**2) > 0.5"
+    """
+
+    if isinstance(predicate, str):
+        expression = predicate
+        names = {"abs": np.abs, "sqrt": np.sqrt, "maximum": np.maximum, "minimum": np.minimum, "np": np}
+        predicate = lambda columns: eval(expression, {"__builtins__": {}}, dict(names, **columns))
+
+    columns = {name: np.asarray(values) for name, values in frame_imu.items()}
+    mask = np.broadcast_to(np.asarray(predicate(columns), dtype=bool), columns["frame"].shape)
+    return columns["frame"][mask].astype(np.int64).tolist()
+
+class SparseFrameReader():
+    """
+    Decodes only the requested frames. Before a frame that lies beyond the
+    next key frame the reader seeks to the last key frame before it (stss),
+    decoding always starts on a key frame so the position is exact, and the
+    frames up to the requested one are only grabbed, not converted. Frames
+    closer than the next key frame are reached by grabbing forward.
+    """
+
+    def __init__(self, movie_path):
+        self.table = SampleTable(movie_path)
+        self.movie_cap = cv2.VideoCapture(movie_path)
+        if not self.movie_cap.isOpened():
+            raise IOError("Can not open %s" %movie_path)
+
+        # next frame grab() returns
+        self.position = 0
+        self.seeks = 0
+        self.decoded = 0
+        self.bytes_decoded = 0
+
+    def _seek(self, frame):
+
+        keyframe = self.table.keyframe_before(frame)
+        if keyframe > self.position or frame < self.position:
+            self.movie_cap.set(cv2.CAP_PROP_POS_FRAMES, keyframe)
+            self.position = keyframe
+            self.seeks += 1
+
+        while self.position <= frame:
+            if not self.movie_cap.grab():
+                return False
+            self.decoded += 1
+            self.bytes_decoded += int(self.table.sizes[self.position])
+            self.position += 1
+        return True
+
+    def read(self, frames):
+        """Yields (frame number, image) of 'frames' in ascending order, out of range frames are skipped"""
+
+        for frame in sorted(set(frames)):
+            if frame < 0 or frame >= self.table.frame_count:
+                continue
+            if not self._seek(frame):
+                break
+            ret, image = self.movie_cap.retrieve()
+            if ret:
+                yield frame, image
+
+    def release(self):
+        self.movie_cap.release()
+
+def ExtractSparseFrames(movie_path, target_dir, naming_scheme, frames, writer_threads=None, profiler=NULL_PROFILER):
+    """ProcessMovie() for the given frames only, same file names"""
+
+    right_image_path = os.path.join(target_dir, naming_scheme + RIGHT_EYE_SCHEME)
+    left_image_path = os.path.join(target_dir, naming_scheme + LEFT_EYE_SCHEME)
+
+    reader = SparseFrameReader(movie_path)
+    writer = ImageWriterPool(writer_threads, profiler=profiler)
+
+    print("Extract %d of %d frames and unstitch" %(len(set(frames)), reader.table.frame_count))
+    start = time.perf_counter()
+    try:
+        with profiler.scope("ExtractSparseFrames"):
+            for frame_number, frame in reader.read(frames):
+                profiler.count("frames")
+                profiler.count("decoded_bytes", frame.nbytes)
+                left_eye_frame, right_eye_frame = UnstitchImage(frame)
+                writer.write("%s%d.jpg" %(right_image_path, frame_number), right_eye_frame)
+                writer.write("%s%d.jpg" %(left_image_path, frame_number), left_eye_frame)
+    finally:
+        reader.release()
+        writer.close()
+    elapsed = time.perf_counter() - start
+
+    print("Decoded %d frames (%.1f of %.1f MB) with %d seeks in %.2f s" %(
+        reader.decoded, reader.bytes_decoded / 1e6, reader.table.sizes.sum() / 1e6, reader.seeks, elapsed))
+    writer.print_stats()
+    print("Images saved to: %s" %target_dir)
+    return 1
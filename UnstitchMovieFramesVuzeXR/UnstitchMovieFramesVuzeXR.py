@@ -2,6 +2,8 @@ import cv2
 import os
 import ntpath
 import numpy as np
+from ImageWriterPool import ImageWriterPool
+from Profiler import NULL_PROFILER
 
 LEFT_EYE_SCHEME = "_LEFT_EYE_"
 RIGHT_EYE_SCHEME = "_RIGHT_EYE_"
@@ -14,7 +16,12 @@ def UnstitchImage(frame):
         
     return left_eye_frame, right_eye_frame
 
-def ProcessMovie(movie_path, target_dir, naming_scheme):
+def ProcessMovie(movie_path, target_dir, naming_scheme, writer_threads=None, profiler=NULL_PROFILER):
+
+    with profiler.scope("ProcessMovie"):
+        return _ProcessMovie(movie_path, target_dir, naming_scheme, writer_threads, profiler)
+
+def _ProcessMovie(movie_path, target_dir, naming_scheme, writer_threads, profiler):
 
     # define target paths
     right_image_path = os.path.join(target_dir, naming_scheme + RIGHT_EYE_SCHEME)
@@ -25,29 +32,41 @@ def ProcessMovie(movie_path, target_dir, naming_scheme):
     
     frame_number= 0
 
+    # encode on a pool of threads, the loop only decodes
+    writer = ImageWriterPool(writer_threads, profiler=profiler)
+
     print("Extract frames and unstitch")
-    ret = True
-    while ret:
-        # Capture frame-by-frame
-        ret, frame = movie_cap.read()
-
-        if ret:
-            if frame_number == 0:
-                total_frames = int(movie_cap.get(cv2.CAP_PROP_FRAME_COUNT))
-                print("Number of frames: %d" %total_frames)
-
-            left_eye_frame, right_eye_frame = UnstitchImage(frame)
-             
-            print("%s%d.jpg" %(ntpath.basename(right_image_path), frame_number))
-            print("%s%d.jpg" %(ntpath.basename(left_image_path), frame_number))
-
-            cv2.imwrite("%s%d.jpg" %(right_image_path, frame_number), right_eye_frame)
-            cv2.imwrite("%s%d.jpg" %(left_image_path, frame_number), left_eye_frame)    
-            
-            frame_number += 1
-    
+    try:
+        ret = True
+        while ret:
+            # Capture frame-by-frame
+            with profiler.scope("decode_frame"):
+                ret, frame = movie_cap.read()
+
+            if ret:
+                profiler.count("frames")
+                profiler.count("decoded_bytes", frame.nbytes)
+                if frame_number == 0:
+                    total_frames = int(movie_cap.get(cv2.CAP_PROP_FRAME_COUNT))
+                    print("Number of frames: %d" %total_frames)
+
+                left_eye_frame, right_eye_frame = UnstitchImage(frame)
+                 
+                print("%s%d.jpg" %(ntpath.basename(right_image_path), frame_number))
+                print("%s%d.jpg" %(ntpath.basename(left_image_path), frame_number))
+
+                # blocks while the encoders are behind
+                with profiler.scope("queue_images"):
+                    writer.write("%s%d.jpg" %(right_image_path, frame_number), right_eye_frame)
+                    writer.write("%s%d.jpg" %(left_image_path, frame_number), left_eye_frame)    
+                
+                frame_number += 1
+    finally:
+        # When everything done, release the capture
+        movie_cap.release()
+        writer.close()
+
+    writer.print_stats()
     print("Images saved to: %s" %target_dir)
-    # When everything done, release the capture
-    movie_cap.release()
 
     return 1
\ No newline at end of file
@@ -1,6 +1,7 @@
 import sys
 import ntpath
 import os
+from Profiler import NULL_PROFILER, Profiler
 from UnstitchMovieFramesVuzeXR import ProcessMovie
 
 def ExtractAndCreateFileDir(input_video_string):
@@ -25,18 +26,148 @@ def ExtractAndCreateFileDir(input_video_string):
     return [new_dir, new_folder_name]
 
 
+def PrintUsage():
+
+    print("Usage: __main__ MOVIE [--stream] [--project X,Y[;X,Y...]] [--no-eyes] [--writers N]")
+    print("                      [--stabilize [--rolling-shutter]] [--frames LIST] [--every N] [--where EXPR]")
+    print("                      [--profile JSON]")
+    print("  --stream     decode, unstitch and write on separate threads")
+    print("  --project    also write gnomonic views of both eyes around the given")
+    print("               center points in [0,1] (implies --stream)")
+    print("  --stabilize  counter-rotate the views by the camera orientation of each frame from")
+    print("               orientation_<name>.vzc/.csv (ExtractMetadata --orientation, with --project)")
+    print("  --rolling-shutter")
+    print("               with --stabilize, correct every row for the orientation it was exposed at")
+    print("  --no-eyes    do not write the unstitched eye images (with --project)")
+    print("  --writers    number of image encoding threads, default one per processor")
+    print("  --profile    write wall and CPU time per stage (decode, projection, encoding, ...) and frame and")
+    print("               byte counts of the run to JSON")
+    print("sparse extraction, only the selected frames are decoded (combined: frames matching all):")
+    print("  --frames     frame numbers and ranges, e.g. 0,5,10-20")
+    print("  --every      every Nth frame")
+    print("  --where      expression over the per-frame IMU columns of frames_<name>.vzc/.csv")
+    print("               (ExtractMetadata --frames), e.g. \"abs(mean_gyro_z) > 0.5\"")
+
+def ParseCenterPoints(value):
+
+    return [tuple(float(v) for v in point.split(",")) for point in value.split(";") if point]
+
+def SelectSparseFrames(movie_path, target_dir, naming_scheme, frame_list, every, where):
+
+    from MovSampleTable import SampleTable
+    from SparseFrames import FindFrameImu, LoadFrameImu, ParseFrameList, SelectFrames
+
+    frames = set(range(SampleTable(movie_path).frame_count))
+    if frame_list is not None:
+        frames &= set(ParseFrameList(frame_list))
+    if every is not None:
+        frames &= set(range(0, max(frames, default=0) + 1, every))
+    if where is not None:
+        frame_imu_path = FindFrameImu(target_dir, naming_scheme)
+        if frame_imu_path is None:
+            print("ERROR: No frames_%s.vzc/.csv in %s, run ExtractMetadata --frames first" %(naming_scheme, target_dir))
+            return None
+        frames &= set(SelectFrames(LoadFrameImu(frame_imu_path), where))
+    return sorted(frames)
+
 def main():
 
     # read input arguments
-    if len(sys.argv) != 2:
+    args = sys.argv[1:]
+    if len(args) < 1:
         print("ERROR: Input argmuments missing")
+        PrintUsage()
+        return -1
+
+    input_video_string = args[0]
+    stream = False
+    write_eyes = True
+    center_points = None
+    writer_threads = None
+    frame_list = None
+    every = None
+    where = None
+    stabilize = False
+    rolling_shutter = False
+    profile_path = None
+
+    i = 1
+    while i < len(args):
+        if args[i] == "--stream":
+            stream = True
+        elif args[i] == "--stabilize":
+            stabilize = True
+        elif args[i] == "--rolling-shutter":
+            rolling_shutter = True
+        elif args[i] == "--no-eyes":
+            write_eyes = False
+        elif args[i] == "--project" and i + 1 < len(args):
+            stream = True
+            i += 1
+            center_points = ParseCenterPoints(args[i])
+        elif args[i] == "--writers" and i + 1 < len(args):
+            i += 1
+            writer_threads = int(args[i])
+        elif args[i] == "--frames" and i + 1 < len(args):
+            i += 1
+            frame_list = args[i]
+        elif args[i] == "--every" and i + 1 < len(args):
+            i += 1
+            every = int(args[i])
+        elif args[i] == "--where" and i + 1 < len(args):
+            i += 1
+            where = args[i]
+        elif args[i] == "--profile" and i + 1 < len(args):
+            i += 1
+            profile_path = args[i]
+        else:
+            print("ERROR: Unknown argument %s" %args[i])
+            PrintUsage()
+            return -1
+        i += 1
+
+    if every is not None and every < 1:
+        print("ERROR: --every must be at least 1")
+        PrintUsage()
+        return -1
+    if (stabilize or rolling_shutter) and center_points is None:
+        print("ERROR: --stabilize and --rolling-shutter need --project")
+        PrintUsage()
+        return -1
+    if rolling_shutter and not stabilize:
+        print("ERROR: --rolling-shutter needs --stabilize")
+        PrintUsage()
         return -1
 
-    input_video_string = sys.argv[1];
     target_dir, naming_scheme  = ExtractAndCreateFileDir(input_video_string)
+    profiler = Profiler() if profile_path is not None else NULL_PROFILER
     
     # get single frames, unstitch and save to target_dir
-    ProcessMovie(input_video_string, target_dir, naming_scheme)
+    if frame_list is not None or every is not None or where is not None:
+        frames = SelectSparseFrames(input_video_string, target_dir, naming_scheme, frame_list, every, where)
+        if frames is None:
+            return -1
+        from SparseFrames import ExtractSparseFrames
+        ExtractSparseFrames(input_video_string, target_dir, naming_scheme, frames, writer_threads, profiler)
+    elif stream:
+        orientations = None
+        if stabilize:
+            from SparseFrames import FindFrameImu, LoadOrientations
+            orientation_path = FindFrameImu(target_dir, naming_scheme, "orientation")
+            if orientation_path is None:
+                print("ERROR: No orientation_%s.vzc/.csv in %s, run ExtractMetadata --orientation first" %(
+                    naming_scheme, target_dir))
+                return -1
+            orientations = LoadOrientations(orientation_path, rolling_shutter)
+        from FramePipeline import StreamMovie
+        StreamMovie(input_video_string, target_dir, naming_scheme, write_eyes, center_points, writer_threads,
+                    orientations, profiler)
+    else:
+        ProcessMovie(input_video_string, target_dir, naming_scheme, writer_threads, profiler)
+
+    if profile_path is not None:
+        profiler.write_json(profile_path)
+        print("Profile saved to: %s" %profile_path)
     
 
 